@@ -22,6 +22,17 @@
 #include "cdc_string.h"
 #include "buffer.h"
 
+#ifdef USE_COMPRESSION
+/* zlib's Byte, uInt and uLong clash with ours */
+#define Byte  z_Byte
+#define uInt  z_uInt
+#define uLong z_uLong
+#include <zlib.h>
+#undef Byte
+#undef uInt
+#undef uLong
+#endif
+
 #ifdef USE_CLEANER_THREAD
 pthread_mutex_t db_mutex;
 
@@ -67,18 +78,58 @@ FILE *dump_db_file = NULL;
 #define LOGICAL_BLOCK(off)  ((off) / BLOCK_SIZE)
 #define BLOCK_OFFSET(block) ((block) * BLOCK_SIZE)
 
+/* A packed object starts with the length of its parents list, which
+   write_long() never encodes as 0xFF, so that byte marks an image which
+   was compressed by simble_put().  The marker is followed by the codec
+   and the packed length (four bytes, most significant first). */
+#define IMAGE_COMPRESSED    0xFF
+#define IMAGE_ZLIB          1
+#define IMAGE_HEADER        6
+
 static void simble_mark(off_t start, Int size);
 static void simble_unmark(off_t start, Int size);
 static void simble_grow_bitmap(Int new_blocks);
 static Int  simble_alloc(Int size);
+static void extent_rebuild(void);
+static void extent_take(Int start, Int len);
+static void extent_release(Int start, Int len);
 static void simble_flag_as_clean(void);
 static void simble_flag_as_dirty(void);
 static void simble_verify_clean(void);
-
-static Int last_free = 0;        /* Last known or suspected free block */
+static void journal_open(char *mode);
+static void journal_note(cObjnum objnum, char kind);
+static cBuf * image_pack(Obj * obj, Int size_hint);
+static cBuf * image_unpack(cBuf * buf, cObjnum objnum);
+
+/* see cache_stats('compression); the cleaner thread packs objects too,
+   so these are only touched under LOCK_DB */
+static struct {
+    Long compressed;          /* images stored compressed */
+    Long raw_bytes;           /* their packed size */
+    Long stored_bytes;        /* and the size actually stored */
+    Long compress_usec;       /* time spent compressing, kept or not */
+    Long skipped;             /* over the threshold but not worth it */
+    Long inflated;            /* compressed images read back */
+    Long inflate_usec;
+} compress_stats;
 
 static FILE *database_file = NULL;
 
+/* set in forked coldcc workers, which only ever read the db; anything
+   they would write is thrown away (see simble_attach()) */
+static Bool db_readonly = false;
+
+/*
+// The change journal ("journal" in the binary directory) lists objects
+// written or deleted since the last checkpoint, one per line as "+objnum"
+// or "-objnum", for coldcc's incremental dumps.  A line is only written
+// when an object's state changes from the last one noted, so it stays
+// about the size of the set of changed objects.
+*/
+static FILE *journal_file = NULL;
+static char *journal_kinds = NULL;
+static Long  journal_size = 0;
+
 static char *dump_bitmap  = NULL;
 static Int   dump_blocks;
 static off_t last_dumped;
@@ -87,6 +138,49 @@ static char *bitmap = NULL;
 static Int bitmap_blocks = 0;
 static Int allocated_blocks = 0;
 
+/*
+// Free extents.  The bitmap stays the record of which blocks are in
+// use; alongside it each maximal run of free blocks below extent_top is
+// kept on the list for its size class (the log2 of its length), and in
+// two hash tables by its first block and by the block just past its end,
+// so an allocation only looks at the head of a few lists and a release
+// coalesces with both neighbours directly.  Everything from extent_top
+// up is free.  The extents are rebuilt from the bitmap once sync_index()
+// has filled it in.
+*/
+typedef struct extent_s Extent;
+
+struct extent_s {
+    Int      start;
+    Int      len;
+    Extent * prev;              /* size class list */
+    Extent * next;
+    Extent * by_start;          /* hash chains */
+    Extent * by_end;
+};
+
+#define EXTENT_CLASSES      32
+#define EXTENT_SCAN         64  /* runs looked at in a class which may not fit */
+
+static Extent  * extent_class[EXTENT_CLASSES];
+static Extent ** extent_starts = NULL;
+static Extent ** extent_ends = NULL;
+static Int       extent_hash_size = 0;
+static Int       extent_count = 0;
+static Int       extent_top = 0;
+static Bool      extents_ready = false;
+
+/* objects to relocate while compacting, highest first */
+typedef struct compact_entry_s {
+    cObjnum objnum;
+    Int     block;
+} compact_entry_t;
+
+static compact_entry_t * compact_list = NULL;
+static Int               compact_len;
+static Int               compact_pos;
+static Int               compact_moved;
+
 static char c_clean_file[255];
 
 static Int db_clean;
@@ -180,12 +274,12 @@ static void simble_verify_clean(void) {
          v_minor[LINE],
          v_patch[LINE],
          magicmod[LINE],
-         search[LINE];
+         epoch[LINE];
     char * s;
     FILE * fp;
 
     v_major[0] = v_minor[0] = v_patch[0] = magicmod[0] =
-        system[0] = search[0] = '\0';
+        system[0] = epoch[0] = '\0';
 
     if ((fp = fopen(c_clean_file, "rb"))) {
         fgets(system, LINE, fp);
@@ -193,7 +287,12 @@ static void simble_verify_clean(void) {
         fgets(v_minor, LINE, fp);
         fgets(v_patch, LINE, fp);
         fgets(magicmod, LINE, fp);
-        fgets(search, LINE, fp);
+        fgets(epoch, LINE, fp);
+
+        /* see object_get_ancestors(); a db without one has no lists */
+        ancestry_epoch = atol(epoch);
+        if (ancestry_epoch < 1)
+            ancestry_epoch = 1;
 
         /* cleanup anything after the system name */
         s = &system[strlen(system)-1];
@@ -267,8 +366,10 @@ void init_binary_db(void) {
 
     open_db_objects("rb+");
     lookup_open(fdb_index, 0);
+    journal_open("a");
     init_bitmaps();
     sync_index();
+    extent_rebuild();
     fprintf (errfile, "[%s] Binary database free space: %.2f%%\n",
              timestamp(NULL), (100.0 * simble_fragmentation()));
 
@@ -296,8 +397,10 @@ void init_new_db(void) {
     open_db_directory();
     open_db_objects("wb+");
     lookup_open(fdb_index, 1);
+    journal_open("w");
     init_bitmaps();
     sync_index();
+    extent_rebuild();
     simble_flag_as_clean();
     UNLOCK_DB("init_new_db")
 }
@@ -349,6 +452,250 @@ static void simble_mark(off_t start, Int size)
 
     for (i = start; i < start + blocks; i++)
         bitmap[i >> 3] |= (1 << (i & 7));
+
+    if (extents_ready)
+        extent_take(start, blocks);
+}
+
+/*
+// -----------------------------------------------------------------
+// Free extent bookkeeping, see the comment at the top of this file.
+*/
+static Int extent_size_class(Int len)
+{
+    Int c = 0;
+
+    while (len > 1 && c < EXTENT_CLASSES - 1) {
+        len >>= 1;
+        c++;
+    }
+    return c;
+}
+
+static void extent_hash_resize(Int size)
+{
+    Extent ** starts, ** ends, * e, * next;
+    Int       i, h;
+
+    starts = EMALLOC(Extent *, size);
+    ends = EMALLOC(Extent *, size);
+    memset(starts, 0, size * sizeof(Extent *));
+    memset(ends, 0, size * sizeof(Extent *));
+
+    for (i = 0; i < extent_hash_size; i++) {
+        for (e = extent_starts[i]; e; e = next) {
+            next = e->by_start;
+            h = e->start & (size - 1);
+            e->by_start = starts[h];
+            starts[h] = e;
+        }
+        for (e = extent_ends[i]; e; e = next) {
+            next = e->by_end;
+            h = (e->start + e->len) & (size - 1);
+            e->by_end = ends[h];
+            ends[h] = e;
+        }
+    }
+    if (extent_starts) {
+        efree(extent_starts);
+        efree(extent_ends);
+    }
+    extent_starts = starts;
+    extent_ends = ends;
+    extent_hash_size = size;
+}
+
+static void extent_insert(Int start, Int len)
+{
+    Extent * e;
+    Int      c, h;
+
+    if (extent_count >= extent_hash_size)
+        extent_hash_resize(extent_hash_size ? extent_hash_size * 2 : 1024);
+
+    e = EMALLOC(Extent, 1);
+    e->start = start;
+    e->len = len;
+
+    c = extent_size_class(len);
+    e->prev = NULL;
+    e->next = extent_class[c];
+    if (e->next)
+        e->next->prev = e;
+    extent_class[c] = e;
+
+    h = start & (extent_hash_size - 1);
+    e->by_start = extent_starts[h];
+    extent_starts[h] = e;
+    h = (start + len) & (extent_hash_size - 1);
+    e->by_end = extent_ends[h];
+    extent_ends[h] = e;
+
+    extent_count++;
+}
+
+static void extent_remove(Extent * e)
+{
+    Extent ** ep;
+
+    if (e->prev)
+        e->prev->next = e->next;
+    else
+        extent_class[extent_size_class(e->len)] = e->next;
+    if (e->next)
+        e->next->prev = e->prev;
+
+    ep = &extent_starts[e->start & (extent_hash_size - 1)];
+    while (*ep != e)
+        ep = &(*ep)->by_start;
+    *ep = e->by_start;
+
+    ep = &extent_ends[(e->start + e->len) & (extent_hash_size - 1)];
+    while (*ep != e)
+        ep = &(*ep)->by_end;
+    *ep = e->by_end;
+
+    efree(e);
+    extent_count--;
+}
+
+static Extent * extent_starting(Int start)
+{
+    Extent * e;
+
+    if (!extent_hash_size)
+        return NULL;
+    for (e = extent_starts[start & (extent_hash_size - 1)]; e; e = e->by_start)
+        if (e->start == start)
+            return e;
+    return NULL;
+}
+
+static Extent * extent_ending(Int end)
+{
+    Extent * e;
+
+    if (!extent_hash_size)
+        return NULL;
+    for (e = extent_ends[end & (extent_hash_size - 1)]; e; e = e->by_end)
+        if (e->start + e->len == end)
+            return e;
+    return NULL;
+}
+
+/* Use the first len blocks of e, keeping whatever is left over. */
+static void extent_split(Extent * e, Int len)
+{
+    Int start = e->start + len,
+        left = e->len - len;
+
+    extent_remove(e);
+    if (left)
+        extent_insert(start, left);
+}
+
+/* Find len free blocks, from the smallest size class which can hold
+   them, or else past the last object. */
+static Int extent_claim(Int len)
+{
+    Extent * e;
+    Int      c, n, start;
+
+    /* runs in the first class may be too short, those above never are */
+    c = extent_size_class(len);
+    for (e = extent_class[c], n = 0; e && n < EXTENT_SCAN; e = e->next, n++) {
+        if (e->len >= len)
+            break;
+    }
+    if (e && e->len < len)
+        e = NULL;
+    while (!e && ++c < EXTENT_CLASSES)
+        e = extent_class[c];
+
+    if (!e) {
+        start = extent_top;
+        extent_top += len;
+        return start;
+    }
+
+    start = e->start;
+    extent_split(e, len);
+    return start;
+}
+
+/* Blocks marked in use other than by extent_claim(), which are always
+   the front of a run (an object growing in place) or past the top. */
+static void extent_take(Int start, Int len)
+{
+    Extent * e;
+
+    if (start >= extent_top) {
+        if (start > extent_top)
+            extent_insert(extent_top, start - extent_top);
+        extent_top = start + len;
+    } else if ((e = extent_starting(start)) && e->len >= len) {
+        extent_split(e, len);
+    } else {
+        extent_rebuild();
+    }
+}
+
+static void extent_release(Int start, Int len)
+{
+    Extent * e;
+
+    if ((e = extent_ending(start))) {
+        start = e->start;
+        len += e->len;
+        extent_remove(e);
+    }
+
+    /* the file's free tail is not kept as an extent */
+    if (start + len >= extent_top) {
+        extent_top = start;
+        return;
+    }
+
+    if ((e = extent_starting(start + len))) {
+        len += e->len;
+        extent_remove(e);
+    }
+    extent_insert(start, len);
+}
+
+#define BLOCK_USED(b) (bitmap[(b) >> 3] & (1 << ((b) & 7)))
+
+static void extent_rebuild(void)
+{
+    Int b, start, c;
+
+    for (c = 0; c < EXTENT_CLASSES; c++) {
+        while (extent_class[c])
+            extent_remove(extent_class[c]);
+    }
+
+    for (b = bitmap_blocks; b > 0 && !BLOCK_USED(b - 1); b--);
+    extent_top = b;
+
+    b = 0;
+    while (b < extent_top) {
+        if (!(b & 7) && bitmap[b >> 3] == (char) 255) {
+            b += 8;
+        } else if (BLOCK_USED(b)) {
+            b++;
+        } else {
+            start = b;
+            while (b < extent_top && !BLOCK_USED(b)) {
+                if (!(b & 7) && !bitmap[b >> 3] && b + 8 <= extent_top)
+                    b += 8;
+                else
+                    b++;
+            }
+            extent_insert(start, b - start);
+        }
+    }
+
+    extents_ready = true;
 }
 
 /* This routine copies the object from the current binary to the
@@ -510,75 +857,164 @@ static void simble_unmark(off_t start, Int size)
 
     if (dump_db_file) dump_copy (start, blocks);
 
-    /* Remember a free block was here. */
-    last_free = start;
-
     for (i = start; i < start + blocks; i++)
         bitmap[i >> 3] &= ~(1 << (i & 7));
+
+    if (extents_ready)
+        extent_release(start, blocks);
 }
 
 static Int simble_alloc(Int size)
 {
-    Int blocks_needed, b, count, starting_block, over_the_top;
+    Int blocks, start, b;
 
-    b = last_free;
-    blocks_needed = NEEDED(size, BLOCK_SIZE);
-#ifdef BUILDING_COLDCC
-    over_the_top = 1;
-#else
-    over_the_top = 0;
-#endif
+    blocks = NEEDED(size, BLOCK_SIZE);
+    start = extent_claim(blocks);
 
-    for (;;) {
+    while (start + blocks > bitmap_blocks)
+        simble_grow_bitmap(bitmap_blocks + DB_BITBLOCK);
 
-        if (b < bitmap_blocks && bitmap[b >> 3] == (char)255) {
-            /* 8 full blocks. Let's run away from this! */
-            b = (b & ~7) + 8;
-            while (b < bitmap_blocks && bitmap[b >> 3] == (char)255) {
-                b += 8;
-            }
-        }
+    allocated_blocks += blocks;
+    for (b = start; b < start + blocks; b++)
+        bitmap[b >> 3] |= (1 << (b & 7));
 
-        if (b >= bitmap_blocks) {
-            /* Only wrap around once. */
-            if (!over_the_top) {
-                b = 0;
-                over_the_top = 1;
-                continue;
-            } else {
-                simble_grow_bitmap(b + DB_BITBLOCK);
-            }
-        }
+    return start;
+}
 
-        starting_block = b;
+/*
+// -----------------------------------------------------------------
+// Object images.  image_pack() returns the packed object, compressed
+// when it is at least compress_threshold bytes and that saves a block,
+// padded out to a whole number of blocks.
+*/
+static cBuf * image_pack(Obj * obj, Int size_hint)
+{
+    cBuf * buf;
+#ifdef USE_COMPRESSION
+    cBuf   * zbuf;
+    uLongf   zlen;
+    int64_t  start, elapsed;
+    Int      raw_len, kept;
+#endif
 
-        for (count = 0; count < blocks_needed; count++) {
-            if (bitmap[b >> 3] & (1 << (b & 7)))
-                break;
-            b++;
-            if (b >= bitmap_blocks) {
-                /* time to wrap around if we still haven't */
-                if (!over_the_top) {
-                    b = 0;
-                    over_the_top = 1;
-                    break;
-                } else {
-                    simble_grow_bitmap(b + ROUND_UP(blocks_needed-count, DB_BITBLOCK));
-                }
-            }
+    buf = pack_object(buffer_new(size_hint), obj);
+
+#ifdef USE_COMPRESSION
+    raw_len = buf->len;
+    if (compress_threshold > 0 && raw_len >= compress_threshold) {
+        start = usec_time();
+        zlen = compressBound(raw_len);
+        zbuf = buffer_new(zlen + IMAGE_HEADER);
+        if (compress2(zbuf->s + IMAGE_HEADER, &zlen, buf->s, raw_len,
+                      Z_BEST_SPEED) == Z_OK &&
+            NEEDED(zlen + IMAGE_HEADER, BLOCK_SIZE) <
+                                           NEEDED(raw_len, BLOCK_SIZE)) {
+            zbuf->s[0] = IMAGE_COMPRESSED;
+            zbuf->s[1] = IMAGE_ZLIB;
+            zbuf->s[2] = (raw_len >> 24) & 255;
+            zbuf->s[3] = (raw_len >> 16) & 255;
+            zbuf->s[4] = (raw_len >> 8) & 255;
+            zbuf->s[5] = raw_len & 255;
+            zbuf->len = zlen + IMAGE_HEADER;
+            buffer_discard(buf);
+            buf = zbuf;
+            kept = 1;
+        } else {
+            buffer_discard(zbuf);
+            kept = 0;
         }
+        elapsed = usec_time() - start;
 
-        if (count == blocks_needed) {
-            /* Mark these blocks taken and return the starting block. */
-            allocated_blocks+=count;
-            for (b = starting_block; b < starting_block + count; b++)
-                bitmap[b >> 3] |= (1 << (b & 7));
-            last_free = b;
-            return starting_block;
+        LOCK_DB("image_pack")
+        if (kept) {
+            compress_stats.compressed++;
+            compress_stats.raw_bytes += raw_len;
+            compress_stats.stored_bytes += buf->len;
+        } else {
+            compress_stats.skipped++;
         }
-
-        b++;
+        compress_stats.compress_usec += elapsed;
+        UNLOCK_DB("image_pack")
     }
+#endif
+
+    if (buf->len % BLOCK_SIZE)
+        buf = buffer_append_uchars_single_ref(buf, (uChar*)pad_string->s, 256 - (buf->len % BLOCK_SIZE));
+
+    return buf;
+}
+
+/* Replace a compressed image read from disk with the packed object. */
+static cBuf * image_unpack(cBuf * buf, cObjnum objnum)
+{
+#ifdef USE_COMPRESSION
+    cBuf   * out;
+    uLongf   len;
+    int64_t  start, elapsed;
+
+    if (buf->len < IMAGE_HEADER || buf->s[1] != IMAGE_ZLIB)
+        panic("simble_get: object #%l has an unknown image format.", objnum);
+
+    start = usec_time();
+    len = ((uLong) buf->s[2] << 24) | ((uLong) buf->s[3] << 16) |
+          ((uLong) buf->s[4] << 8) | (uLong) buf->s[5];
+    out = buffer_new(len);
+
+    /* the zero padding after the stream is ignored by uncompress() */
+    if (uncompress(out->s, &len, buf->s + IMAGE_HEADER,
+                   buf->len - IMAGE_HEADER) != Z_OK)
+        panic("simble_get: object #%l is corrupt.", objnum);
+    out->len = len;
+    buffer_discard(buf);
+
+    elapsed = usec_time() - start;
+    LOCK_DB("image_unpack")
+    compress_stats.inflated++;
+    compress_stats.inflate_usec += elapsed;
+    UNLOCK_DB("image_unpack")
+
+    return out;
+#else
+    panic("simble_get: object #%l is compressed, rebuild with USE_COMPRESSION.",
+          objnum);
+    return buf;
+#endif
+}
+
+/* Counters for cache_stats('compression): images compressed, their
+   packed and stored sizes, the stored size as a percentage of the packed
+   size, usecs spent compressing, images left raw because compressing
+   them saved nothing, images inflated on read and usecs spent doing so. */
+cList * simble_compress_info(void)
+{
+    cList * out;
+    cData * d;
+    Int     x;
+
+    out = list_new(8);
+    d = list_empty_spaces(out, 8);
+    for (x = 0; x < 8; x++)
+        d[x].type = INTEGER;
+    LOCK_DB("simble_compress_info")
+    d[0].u.val = compress_stats.compressed;
+    d[1].u.val = compress_stats.raw_bytes;
+    d[2].u.val = compress_stats.stored_bytes;
+    d[3].u.val = compress_stats.raw_bytes ?
+        (compress_stats.stored_bytes * 100) / compress_stats.raw_bytes : 100;
+    d[4].u.val = compress_stats.compress_usec;
+    d[5].u.val = compress_stats.skipped;
+    d[6].u.val = compress_stats.inflated;
+    d[7].u.val = compress_stats.inflate_usec;
+    UNLOCK_DB("simble_compress_info")
+
+    return out;
+}
+
+void simble_compress_reset(void)
+{
+    LOCK_DB("simble_compress_reset")
+    memset(&compress_stats, 0, sizeof(compress_stats));
+    UNLOCK_DB("simble_compress_reset")
 }
 
 Int simble_get(Obj *object, cObjnum objnum, Long *sizeread)
@@ -612,6 +1048,9 @@ Int simble_get(Obj *object, cObjnum objnum, Long *sizeread)
     if (buf_pos != size)
         panic("simble_get: only read %d of %d bytes.", buf_pos, size);
 
+    if (size && buf->s[0] == IMAGE_COMPRESSED)
+        buf = image_unpack(buf, objnum);
+
     buf_pos = 0;
     unpack_object(buf, &buf_pos, object);
     buffer_discard(buf);
@@ -641,12 +1080,14 @@ Int simble_put(Obj *obj, cObjnum objnum, Long *sizewritten)
     off_t old_offset, new_offset;
     Int old_size, new_size, tmp1, tmp2;
 
+    if (db_readonly) {
+        if (sizewritten) *sizewritten = 0;
+        return 1;
+    }
+
     old_offset = -1;
     if (lookup_retrieve_objnum(objnum, &old_offset, &old_size)) {
-        buf = buffer_new(old_size);
-        buf = pack_object(buf, obj);
-        if (buf->len % BLOCK_SIZE)
-            buf = buffer_append_uchars_single_ref(buf, (uChar*)pad_string->s, 256 - (buf->len % BLOCK_SIZE));
+        buf = image_pack(obj, old_size);
         new_size = buf->len;
 
         LOCK_DB("simble_put")
@@ -676,10 +1117,7 @@ Int simble_put(Obj *obj, cObjnum objnum, Long *sizewritten)
         }
     } else {
         ++num_objects;
-        buf = buffer_new(0);
-        buf = pack_object(buf, obj);
-        if (buf->len % BLOCK_SIZE)
-            buf = buffer_append_uchars_single_ref(buf, (uChar*)pad_string->s, 256 - (buf->len % BLOCK_SIZE));
+        buf = image_pack(obj, 0);
         new_size = buf->len;
 
         LOCK_DB("simble_put")
@@ -710,6 +1148,7 @@ Int simble_put(Obj *obj, cObjnum objnum, Long *sizewritten)
     old_size = fwrite(buf->s, sizeof(uChar), new_size, database_file);
     buffer_discard(buf);
     fflush(database_file);
+    journal_note(objnum, JOURNAL_CHANGED);
     UNLOCK_DB("simble_put")
     if (old_size != new_size)
         panic("simble_put: only wrote %d of %d bytes.", old_size, new_size);
@@ -733,6 +1172,9 @@ Int simble_del(cObjnum objnum)
     Int size;
     cBuf *buf;
 
+    if (db_readonly)
+        return 1;
+
     /* Get offset and size of key. */
     if (!lookup_retrieve_objnum(objnum, &offset, &size))
         return 0;
@@ -764,6 +1206,7 @@ Int simble_del(cObjnum objnum)
     fwrite(buf->s, sizeof(uChar), size, database_file);
     buffer_discard(buf);
     fflush(database_file);
+    journal_note(objnum, JOURNAL_DESTROYED);
 
     UNLOCK_DB("simble_del")
 
@@ -775,6 +1218,10 @@ void simble_close(void)
     LOCK_DB("simble_close")
     lookup_close();
     fclose(database_file);
+    if (journal_file)
+        fclose(journal_file);
+    if (journal_kinds)
+        efree(journal_kinds);
     efree(bitmap);
     simble_flag_as_clean();
     string_discard(pad_string);
@@ -787,15 +1234,141 @@ void simble_flush(void)
 
     LOCK_DB("simble_flush")
 
+    if (journal_file)
+        fflush(journal_file);
     simble_flag_as_clean();
 
     UNLOCK_DB("simble_flush")
 }
 
+static void journal_open(char *mode)
+{
+    char fdb_journal[BUF];
+
+    DBFILE(fdb_journal, "journal");
+    journal_file = fopen(fdb_journal, mode);
+    if (!journal_file)
+        WARN("Cannot open change journal \"%s/journal\".\n")
+}
+
+static void journal_note(cObjnum objnum, char kind)
+{
+    Long size;
+
+    if (!journal_file || objnum < 0)
+        return;
+
+    if (objnum >= journal_size) {
+        size = objnum * 2 + 1024;
+        journal_kinds = EREALLOC(journal_kinds, char, size);
+        memset(journal_kinds + journal_size, 0, size - journal_size);
+        journal_size = size;
+    }
+
+    if (journal_kinds[objnum] == kind)
+        return;
+    journal_kinds[objnum] = kind;
+
+    fprintf(journal_file, "%c%li\n",
+            (kind == JOURNAL_CHANGED) ? '+' : '-', (long) objnum);
+}
+
+/*
+// Read back the journal: *kinds is set to a table, indexed by objnum, of
+// JOURNAL_CHANGED or JOURNAL_DESTROYED for each object touched since the
+// last checkpoint, and its length is returned.  The caller frees it.
+*/
+Long simble_journal_read(char **kinds)
+{
+    char   fdb_journal[BUF];
+    FILE * fp;
+    char   kind;
+    long   objnum;
+    Long   len = 0, size = 0;
+
+    *kinds = NULL;
+
+    LOCK_DB("simble_journal_read")
+    if (journal_file)
+        fflush(journal_file);
+    UNLOCK_DB("simble_journal_read")
+
+    DBFILE(fdb_journal, "journal");
+    fp = fopen(fdb_journal, "r");
+    if (!fp)
+        return 0;
+
+    while (fscanf(fp, " %c%ld", &kind, &objnum) == 2) {
+        if (objnum < 0 || (kind != '+' && kind != '-'))
+            continue;
+        if (objnum >= size) {
+            Long new_size = objnum * 2 + 1024;
+
+            *kinds = EREALLOC(*kinds, char, new_size);
+            memset(*kinds + size, 0, new_size - size);
+            size = new_size;
+        }
+        (*kinds)[objnum] = (kind == '+') ? JOURNAL_CHANGED : JOURNAL_DESTROYED;
+        if (objnum >= len)
+            len = objnum + 1;
+    }
+    fclose(fp);
+
+    return len;
+}
+
+/* Start a new journal, as after a full text dump. */
+void simble_journal_checkpoint(void)
+{
+    LOCK_DB("simble_journal_checkpoint")
+    if (journal_file)
+        fclose(journal_file);
+    journal_open("w");
+    if (journal_kinds)
+        memset(journal_kinds, 0, journal_size);
+    UNLOCK_DB("simble_journal_checkpoint")
+}
+
+/*
+// Give up the index so that other processes can open the database, as
+// the parallel decompiler does.  The cache should be synced first, and
+// simble_attach() must be called before the db is used again.
+*/
+void simble_detach(void)
+{
+    LOCK_DB("simble_detach")
+    fflush(database_file);
+    if (journal_file)
+        fflush(journal_file);
+    lookup_close();
+    UNLOCK_DB("simble_detach")
+}
+
+/*
+// Reattach after simble_detach().  A forked reader also replaces its
+// inherited object file handle, since that shares a file offset with
+// the parent, and drops anything it would write back, since the parent
+// owns the db.
+*/
+void simble_attach(Bool readonly)
+{
+    char fdb_objects[BUF];
+
+    LOCK_DB("simble_attach")
+    if (readonly) {
+        DBFILE(fdb_objects, "objects");
+        fclose(database_file);
+        open_db_objects("rb");
+    }
+    db_readonly = readonly;
+    lookup_reopen(readonly);
+    UNLOCK_DB("simble_attach")
+}
+
 #define write_clean_file(_fp_) \
-    fprintf(_fp_, "%s\n%d\n%d\n%d\n%li\n", SYSTEM_TYPE, \
+    fprintf(_fp_, "%s\n%d\n%d\n%d\n%li\n%li\n", SYSTEM_TYPE, \
                 VERSION_MAJOR, VERSION_MINOR, VERSION_PATCH,\
-                (long) MAGIC_MODNUMBER)\
+                (long) MAGIC_MODNUMBER, (long) ancestry_epoch)\
 
 void simble_dump_finish(void) {
     FILE * fp;
@@ -881,6 +1454,161 @@ void init_core_objects(void) {
     list_discard(parents);
 }
 
+/* The share of the objects file, up to its last object, which is free. */
 Float simble_fragmentation(void) {
-    return 1.0 - ((float)allocated_blocks/(float)bitmap_blocks);
+    if (!extent_top)
+        return 0.0;
+    return 1.0 - ((float)allocated_blocks/(float)extent_top);
+}
+
+/*
+// -----------------------------------------------------------------
+// Online compaction.  simble_compact_start() lists every object by its
+// position in the file, and each call to simble_compact_some_blocks()
+// from the main loop then moves the objects nearest the end of the file
+// into the lowest free run which holds them, until maxblocks have been
+// copied.  The file is truncated once the last object cannot be moved
+// any lower.  Nothing is moved while a dump is running, as the dump
+// copies blocks by position.
+*/
+static int compact_cmp(const void * a, const void * b)
+{
+    return ((compact_entry_t *) b)->block - ((compact_entry_t *) a)->block;
+}
+
+/* returns 0, or COMPACT_IN_PROGRESS when already compacting */
+Int simble_compact_start(void)
+{
+    cObjnum objnum;
+    off_t   offset;
+    Int     size, alloc;
+
+    if (compact_list)
+        return COMPACT_IN_PROGRESS;
+
+    LOCK_DB("simble_compact_start")
+
+    alloc = num_objects + 16;
+    compact_list = EMALLOC(compact_entry_t, alloc);
+    compact_len = compact_pos = compact_moved = 0;
+
+    objnum = lookup_first_objnum();
+    while (objnum != NOT_AN_IDENT && objnum != INV_OBJNUM) {
+        if (lookup_retrieve_objnum(objnum, &offset, &size)) {
+            if (compact_len == alloc) {
+                alloc *= 2;
+                compact_list = EREALLOC(compact_list, compact_entry_t, alloc);
+            }
+            compact_list[compact_len].objnum = objnum;
+            compact_list[compact_len].block = LOGICAL_BLOCK(offset);
+            compact_len++;
+        }
+        objnum = lookup_next_objnum();
+    }
+    qsort(compact_list, compact_len, sizeof(compact_entry_t), compact_cmp);
+
+    UNLOCK_DB("simble_compact_start")
+
+    fprintf(errfile, "[%s] Compacting binary database, free space: %.2f%%\n",
+            timestamp(NULL), (100.0 * simble_fragmentation()));
+
+    return 0;
+}
+
+/* the lowest extent of at least len blocks ending at or before limit,
+   looking at no more than EXTENT_SCAN runs of each size class */
+static Extent * extent_below(Int len, Int limit)
+{
+    Extent * e, * best = NULL;
+    Int      c, n;
+
+    for (c = extent_size_class(len); c < EXTENT_CLASSES; c++) {
+        for (e = extent_class[c], n = 0; e && n < EXTENT_SCAN; e = e->next, n++) {
+            if (e->len >= len && e->start + len <= limit &&
+                (!best || e->start < best->start))
+                best = e;
+        }
+    }
+    return best;
+}
+
+/* Move one object to the block at new_block, returns 0 on failure. */
+static Int compact_move(cObjnum objnum, off_t offset, Int size, Int new_block)
+{
+    cBuf * buf;
+    Int    len;
+
+    buf = buffer_new(size);
+    if (fseeko(database_file, offset, SEEK_SET) ||
+        (len = fread(buf->s, sizeof(uChar), size, database_file)) != size ||
+        fseeko(database_file, BLOCK_OFFSET((off_t) new_block), SEEK_SET) ||
+        (len = fwrite(buf->s, sizeof(uChar), size, database_file)) != size) {
+        buffer_discard(buf);
+        write_err("ERROR: Failed to move object %l.", objnum);
+        return 0;
+    }
+    buffer_discard(buf);
+    fflush(database_file);
+
+    if (!lookup_store_objnum(objnum, BLOCK_OFFSET((off_t) new_block), size))
+        return 0;
+    simble_mark(new_block, size);
+    simble_unmark(LOGICAL_BLOCK(offset), size);
+
+    return 1;
+}
+
+/* Called from the main loop, like simble_dump_some_blocks(). */
+Int simble_compact_some_blocks(Int maxblocks)
+{
+    compact_entry_t * entry;
+    Extent          * e;
+    off_t             offset;
+    Int               size;
+
+    if (!compact_list)
+        return COMPACT_NOT_IN_PROGRESS;
+    if (dump_db_file)
+        return COMPACT_WAITING;
+
+    LOCK_DB("simble_compact_some_blocks")
+    simble_flag_as_dirty();
+
+    while (maxblocks > 0 && compact_pos < compact_len) {
+        entry = &compact_list[compact_pos++];
+
+        /* skip anything written elsewhere or destroyed since */
+        if (!lookup_retrieve_objnum(entry->objnum, &offset, &size) ||
+            LOGICAL_BLOCK(offset) != entry->block)
+            continue;
+
+        e = extent_below(NEEDED(size, BLOCK_SIZE), entry->block);
+        if (!e || !compact_move(entry->objnum, offset, size, e->start)) {
+            compact_pos = compact_len;
+            break;
+        }
+        compact_moved++;
+        maxblocks -= NEEDED(size, BLOCK_SIZE);
+    }
+
+    if (compact_pos < compact_len) {
+        UNLOCK_DB("simble_compact_some_blocks")
+        return COMPACT_MOVED_BLOCKS;
+    }
+
+#ifdef __UNIX__
+    if (ftruncate(fileno(database_file), BLOCK_OFFSET((off_t) extent_top)))
+        write_err("ERROR: Failed to truncate objects file: %s",
+                  strerror(errno));
+#endif
+    efree(compact_list);
+    compact_list = NULL;
+
+    UNLOCK_DB("simble_compact_some_blocks")
+
+    fprintf(errfile, "[%s] Binary database compacted, %d objects moved, "
+            "free space: %.2f%%\n", timestamp(NULL), (int) compact_moved,
+            (100.0 * simble_fragmentation()));
+
+    return COMPACT_FINISHED;
 }
@@ -37,9 +37,44 @@ void *cache_cleaner_worker(void *dummy);
 #define UNLOCK_BUCKET(func, bucket) \
     pthread_mutex_unlock(&dirty[bucket].lock);
 #endif
+
+/*
+// Object locks, which keep the cleaner thread from writing out an object
+// the interpreter is pulling back into use.  The interpreter holds an
+// object's write lock for as long as the object is active (its refcount
+// is above zero), taking it when the object comes off the inactive chain
+// or in from disk and releasing it when cache_discard() drops the last
+// reference.  The cleaner only tries for the read lock, and skips the
+// object if it is held.  The interpreter itself is single threaded.
+*/
+#ifdef DEBUG_OBJECT_LOCK
+#define LOCK_OBJECT(func, obj) \
+    write_err("%s: locking object %d", func, (obj)->objnum); \
+    pthread_rwlock_wrlock(&(obj)->lock); \
+    write_err("%s: locked object %d", func, (obj)->objnum);
+#define UNLOCK_OBJECT(func, obj) \
+    pthread_rwlock_unlock(&(obj)->lock); \
+    write_err("%s: unlocked object %d", func, (obj)->objnum);
+#else
+#define LOCK_OBJECT(func, obj) \
+    pthread_rwlock_wrlock(&(obj)->lock);
+#define UNLOCK_OBJECT(func, obj) \
+    pthread_rwlock_unlock(&(obj)->lock);
+#endif
+#define TRYLOCK_OBJECT_READ(obj) \
+    (pthread_rwlock_tryrdlock(&(obj)->lock) == 0)
+#define INIT_OBJECT_LOCK(obj) \
+    pthread_rwlock_init(&(obj)->lock, NULL);
+#define DESTROY_OBJECT_LOCK(obj) \
+    pthread_rwlock_destroy(&(obj)->lock);
 #else
 #define LOCK_BUCKET(func, bucket)
 #define UNLOCK_BUCKET(func, bucket)
+#define LOCK_OBJECT(func, obj)
+#define UNLOCK_OBJECT(func, obj)
+#define TRYLOCK_OBJECT_READ(obj) 1
+#define INIT_OBJECT_LOCK(obj)
+#define DESTROY_OBJECT_LOCK(obj)
 #endif
 
 
@@ -69,6 +104,66 @@ typedef struct dirty_buckets DirtyBuckets;
 DirtyBuckets *dirty;
 #endif
 
+Long cache_faults = 0;
+
+/*
+// Object cache statistics, reported by cache_stats('object_cache).
+// Latencies go into power of two buckets of microseconds: bucket 0 is
+// under 1us, bucket n is 2^(n-1) up to 2^n us, and the last bucket
+// holds everything slower.  Writes from the cleaner thread update these
+// without locking, so the counts are approximate when it is in use.
+*/
+static struct {
+    Long hits_active;
+    Long hits_inactive;
+    Long faults_base;       /* cache_faults at the last reset */
+    Long evictions;
+    Long dirty_evictions;
+    Long writes;
+    Long bytes_read;
+    Long bytes_written;
+    Long read_latency[CACHE_LATENCY_BUCKETS];
+    Long write_latency[CACHE_LATENCY_BUCKETS];
+} cache_stats;
+
+static inline void cache_latency_add(Long * hist, int64_t usec) {
+    Int bucket = 0;
+
+    while (usec > 0 && bucket < CACHE_LATENCY_BUCKETS - 1) {
+        usec >>= 1;
+        bucket++;
+    }
+    hist[bucket]++;
+}
+
+/* simble_get() and simble_put() with the bookkeeping for cache_stats */
+static Int cache_read_object(Obj *obj, Long objnum, Long *obj_size) {
+    int64_t start = usec_time();
+    Int     ok;
+
+    cache_faults++;
+    ok = simble_get(obj, objnum, obj_size);
+    cache_latency_add(cache_stats.read_latency, usec_time() - start);
+    if (ok)
+        cache_stats.bytes_read += *obj_size;
+
+    return ok;
+}
+
+static Int cache_write_object(Obj *obj, Long *obj_size) {
+    int64_t start = usec_time();
+    Int     ok;
+
+    ok = simble_put(obj, obj->objnum, obj_size);
+    cache_latency_add(cache_stats.write_latency, usec_time() - start);
+    if (ok) {
+        cache_stats.writes++;
+        cache_stats.bytes_written += *obj_size;
+    }
+
+    return ok;
+}
+
 #if DEBUG_CACHE
 Int        _acounter = 0;
 Int        _icounter = 0;
@@ -237,6 +332,7 @@ void init_cache(Bool spawn_cleaner)
             obj->ucounter=0;
 #endif
             obj->dead=0;
+            INIT_OBJECT_LOCK(obj)
 
             cache_add_to_list_head(&inactive[i], obj);
         }
@@ -264,6 +360,8 @@ void uninit_cache()
                     fprintf(stderr, "and its dirty still!!\n");
                 object_free(tmp);
             }
+            UNLOCK_OBJECT("uninit_cache", tmp)
+            DESTROY_OBJECT_LOCK(tmp)
             efree(tmp);
         }
 
@@ -276,6 +374,7 @@ void uninit_cache()
                             tmp->objname != -1 ? ident_name(tmp->objname) : "not named", tmp->objnum);
                 object_free(tmp);
             }
+            DESTROY_OBJECT_LOCK(tmp)
             efree(tmp);
         }
     }
@@ -301,14 +400,18 @@ Obj * cache_get_holder(Long objnum) {
     Long obj_size;
 
     if (inactive[ind].last) {
-        /* Use the object at the tail of the inactive list. */
+        /* Use the object at the tail of the inactive list, waiting for
+           the cleaner if it is in the middle of writing it out. */
         obj = inactive[ind].last;
+        LOCK_OBJECT("cache_get_holder", obj)
 
         /* Check if we need to swap anything out. */
         if (obj->objnum != INV_OBJNUM) {
+            cache_stats.evictions++;
             LOCK_BUCKET("cache_get_holder", ind)
             if (obj->dirty) {
-                if (!simble_put(obj, obj->objnum, &obj_size)) {
+                cache_stats.dirty_evictions++;
+                if (!cache_write_object(obj, &obj_size)) {
                     UNLOCK_BUCKET("cache_get_holder", ind)
                     panic("Could not store an object.");
                 }
@@ -330,6 +433,8 @@ Obj * cache_get_holder(Long objnum) {
     } else {
         /* Allocate a new object. */
         obj = EMALLOC(Obj, 1);
+        INIT_OBJECT_LOCK(obj)
+        LOCK_OBJECT("cache_get_holder", obj)
         write_err("cache_get_holder: no holders left, allocating a blank object");
     }
 
@@ -378,6 +483,7 @@ Obj *cache_retrieve(Long objnum) {
     /* Search active chain for object. */
     for (obj = active[ind].first; obj; obj = obj->next_obj) {
         if (obj->objnum == objnum) {
+            cache_stats.hits_active++;
             obj->refs++;
 #ifdef CLEAN_CACHE
             obj->ucounter += OBJECT_PERSISTENCE;
@@ -389,6 +495,8 @@ Obj *cache_retrieve(Long objnum) {
     /* Search inactive chain for object. */
     for (obj = inactive[ind].first; obj; obj = obj->next_obj) {
         if (obj->objnum == objnum) {
+            LOCK_OBJECT("cache_retrieve", obj)
+            cache_stats.hits_inactive++;
             cache_remove_from_list(&inactive[ind], obj);
 
 #if DEBUG_CACHE
@@ -413,11 +521,12 @@ Obj *cache_retrieve(Long objnum) {
 
     /* Read the object into the place-holder, if it's on disk. */
     LOCK_BUCKET("cache_retrieve", ind)
-    if (!simble_get(obj, objnum, &obj_size)) {
+    if (!cache_read_object(obj, objnum, &obj_size)) {
         /* Oops.  add back to inactive list tail*/
         obj->objnum = INV_OBJNUM;
         cache_remove_from_list(&active[ind], obj);
         cache_add_to_list_tail(&inactive[ind], obj);
+        UNLOCK_OBJECT("cache_retrieve", obj)
         obj = NULL;
     }
     UNLOCK_BUCKET("cache_retrieve", ind)
@@ -499,6 +608,8 @@ void cache_discard(Obj *obj) {
         _icounter++;
 #endif
     }
+
+    UNLOCK_OBJECT("cache_discard", obj)
 }
 
 /*
@@ -585,7 +696,7 @@ void cache_sync(void) {
                         if (cache_log_flag & CACHE_LOG_DEAD_WRITE)
                             write_err("cache_sync: skipping dead object");
                     } else {
-                        if (!simble_put(obj, obj->objnum, &obj_size)) {
+                        if (!cache_write_object(obj, &obj_size)) {
                             UNLOCK_BUCKET("cache_sync", i)
                             panic("Could not store an object.");
                         }
@@ -665,14 +776,24 @@ void *cache_cleaner_worker(void *dummy)
             tobj = dirty[cache_bucket].first;
             while (tobj) {
                 cthis.u.objnum = tobj->objnum;
-                if (tobj->refs == 0 &&
-                    !dict_contains(cleaner_ignore_dict, &cthis)) {
+                if (dict_contains(cleaner_ignore_dict, &cthis)) {
+                    tobj = tobj->next_dirty;
+                    continue;
+                }
+
+                /* if we can't get a read lock it is active, skip it */
+                if (!TRYLOCK_OBJECT_READ(tobj)) {
+                    tobj = tobj->next_dirty;
+                    continue;
+                }
+
+                if (tobj->refs == 0) {
                     if (tobj->dead) {
                         if (cache_log_flag & CACHE_LOG_DEAD_WRITE)
                             write_err("cache_cleaner_worker: skipping dead object");
                     } else {
                         wrote_something = 1;
-                        if (!simble_put(tobj, tobj->objnum, &obj_size)) {
+                        if (!cache_write_object(tobj, &obj_size)) {
                             UNLOCK_BUCKET("cache_cleaner_worker", cache_bucket)
                             panic("Could not store an object.");
                         }
@@ -684,10 +805,13 @@ void *cache_cleaner_worker(void *dummy)
 
                     tobj2 = tobj->next_dirty;
                     cache_remove_from_dirty(&dirty[cache_bucket], tobj);
+                    UNLOCK_OBJECT("cache_cleaner_worker", tobj)
                     tobj = tobj2;
                 }
-                else
+                else {
+                    UNLOCK_OBJECT("cache_cleaner_worker", tobj)
                     tobj = tobj->next_dirty;
+                }
             }
 
             UNLOCK_BUCKET("cache_cleaner_worker", cache_bucket)
@@ -770,7 +894,8 @@ void cache_cleanup(void) {
             if (obj->ucounter > 0)
                 continue;
             if (obj->objnum != INV_OBJNUM && obj->dirty) {
-                if (!simble_put(obj, obj->objnum, &obj_size))
+                cache_stats.dirty_evictions++;
+                if (!cache_write_object(obj, &obj_size))
                     panic("Could not store an object.");
                 if (cache_log_flag & CACHE_LOG_CLEANUP)
                     write_err("cache_cleanup: wrote object %s (size: %d bytes) (dirty: %d)",
@@ -778,6 +903,7 @@ void cache_cleanup(void) {
                 obj->dirty = 0;
             }
             if (obj->objnum != INV_OBJNUM) {
+                cache_stats.evictions++;
 #if DEBUG_CACHE
                 _icounter--;
                 fprintf(errfile,"<%d\n",_icounter);
@@ -855,3 +981,65 @@ cList * cache_info(int level) {
 
     return out;
 }
+
+/*
+// ----------------------------------------------------------------------
+//
+// Effects: returns the object cache statistics as:
+//
+//    [active hits, inactive hits, misses, evictions, dirty evictions,
+//     writes, bytes read, bytes written, WIDTH, DEPTH,
+//     [read latency histogram], [write latency histogram]]
+//
+// Misses are objects read from disk, dirty evictions are the evictions
+// which had to write the object out first.
+//
+*/
+static cList * cache_latency_list(Long * hist) {
+    cList * list;
+    cData * d;
+    Int     x;
+
+    list = list_new(CACHE_LATENCY_BUCKETS);
+    d = list_empty_spaces(list, CACHE_LATENCY_BUCKETS);
+    for (x = 0; x < CACHE_LATENCY_BUCKETS; x++) {
+        d[x].type = INTEGER;
+        d[x].u.val = hist[x];
+    }
+
+    return list;
+}
+
+cList * cache_stats_info(void) {
+    cList * out;
+    cData * d;
+    Int     x;
+
+    out = list_new(12);
+    d = list_empty_spaces(out, 12);
+    for (x = 0; x < 10; x++)
+        d[x].type = INTEGER;
+    d[0].u.val = cache_stats.hits_active;
+    d[1].u.val = cache_stats.hits_inactive;
+    d[2].u.val = cache_faults - cache_stats.faults_base;
+    d[3].u.val = cache_stats.evictions;
+    d[4].u.val = cache_stats.dirty_evictions;
+    d[5].u.val = cache_stats.writes;
+    d[6].u.val = cache_stats.bytes_read;
+    d[7].u.val = cache_stats.bytes_written;
+    d[8].u.val = cache_width;
+    d[9].u.val = cache_depth;
+    d[10].type = LIST;
+    d[10].u.list = cache_latency_list(cache_stats.read_latency);
+    d[11].type = LIST;
+    d[11].u.list = cache_latency_list(cache_stats.write_latency);
+
+    return out;
+}
+
+void cache_stats_reset(void) {
+    Long faults = cache_faults;
+
+    memset(&cache_stats, 0, sizeof(cache_stats));
+    cache_stats.faults_base = faults;
+}
@@ -1824,6 +1824,7 @@ static Method *final_pass(Obj *object)
     method->m_flags  = MF_NONE;
     method->m_access = MS_PUBLIC;
     method->native   = -1;
+    method->stats    = NULL;
 
     /* Set argument names. */
     method->num_args = id_list_size(the_prog->args->ids);
@@ -30,6 +30,8 @@ extern pthread_t cleaner;
 Int    c_nowrite = 1;
 Int    c_opt = OPT_COMP;
 Bool   print_objs = true;
+Int    coldcc_workers = 1;
+Bool   dump_incremental = false;
 Bool   print_names = false;
 Bool   print_invalid = true;
 Bool   print_warn = true;
@@ -126,6 +128,10 @@ static void compile_db(Int newdb) {
         fclose(fp);
     }
 
+    /* the textdump is the base for incremental dumps from here */
+    if (newdb)
+        simble_journal_checkpoint();
+
     write_err ("Database compiled to \"%s\"", c_dir_binary);
 }
 
@@ -267,6 +273,18 @@ static void initialize(Int argc, char **argv) {
                 case 'o':
                     print_objs = opt_bool;
                     break;
+                case 'i':
+                    dump_incremental = true;
+                    break;
+                case 'j':
+                    argv += getarg(name, &buf, opt, argv, &argc, usage);
+                    coldcc_workers = atoi(buf);
+                    if (coldcc_workers < 1) {
+                        usage(name);
+                        printf("\n** Invalid worker count: '%s'\n", buf);
+                        exit(0);
+                    }
+                    break;
                 case 'p':
                     c_opt = OPT_PARTIAL;
                     break;
@@ -355,6 +373,11 @@ void usage (char * name) {
              "    -v              version\n"
              "    -h              This message.\n"
              "    -d              Decompile.\n"
+             "    -i              With -d, only decompile objects changed since\n"
+             "                    the last full decompile, as a patch which can\n"
+             "                    be compiled over it with -p.\n"
+             "    -j workers      Compile or decompile with this many worker\n"
+             "                    processes, default 1.\n"
              "    -c              Compile (default).\n"
              "    -b binary       binary db directory name, current: \"%s\"\n"
              "    -t target       target text db, current: \"%s\"\n"
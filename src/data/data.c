@@ -19,6 +19,7 @@ cInstance class_registry[] = {
 
 void register_instance (InstanceID instance, Ident id) {
     class_registry[instance - FIRST_INSTANCE].id_name = id;
+    data_type_handlers_reset();
 }
 
 void init_instances(void) {
@@ -570,6 +571,38 @@ Long data_type_id(Int type)
     }
 }
 
+/*
+// Handler objects for messages sent to data other than objects ($string
+// for strings and so on), by type.  Each is looked up by name on first
+// use and kept, missing ones too, until an object name is set or removed
+// and data_type_handlers_reset() is called.
+*/
+#define HANDLER_UNKNOWN -2
+
+static cObjnum type_handlers[LAST_INSTANCE];
+static Bool    type_handlers_valid = false;
+
+void data_type_handlers_reset(void) {
+    type_handlers_valid = false;
+}
+
+Bool data_type_handler(Int type, cObjnum * objnum) {
+    Int i;
+
+    if (!type_handlers_valid) {
+        for (i = 0; i < LAST_INSTANCE; i++)
+            type_handlers[i] = HANDLER_UNKNOWN;
+        type_handlers_valid = true;
+    }
+
+    if (type_handlers[type] == HANDLER_UNKNOWN &&
+        !lookup_retrieve_name(data_type_id(type), &type_handlers[type]))
+        type_handlers[type] = INV_OBJNUM;
+
+    *objnum = type_handlers[type];
+    return *objnum != INV_OBJNUM;
+}
+
 char * data_from_literal(cData *d, char *s) {
 
     while (isspace(*s))
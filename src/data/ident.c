@@ -18,7 +18,7 @@ Ident perm_id, type_id, div_id, integer_id, float_id, string_id, objnum_id,
       address_id, refused_id, net_id, timeout_id, other_id, failed_id,
       heartbeat_id, regexp_id, buffer_id, object_id, namenf_id, salt_id,
       function_id, opcode_id, method_id, interpreter_id, signal_id,
-      directory_id, eof_id, backup_done_id;
+      directory_id, eof_id, backup_done_id, compact_done_id;
 
 Ident public_id, protected_id, private_id, root_id, driver_id, fpe_id, inf_id,
       noover_id, sync_id, locked_id, native_id, forked_id, atomic_id;
@@ -33,9 +33,31 @@ Ident left_id, right_id, both_id;
 /* config options */
 Ident cachelog_id, cachewatch_id, cachewatchcount_id, cleanerwait_id, cleanerignore_id;
 Ident log_malloc_size_id, log_method_cache_id, cache_history_size_id;
+Ident sched_ticks_id, sched_time_id, method_stats_id;
+Ident file_workers_id, file_async_threshold_id, compress_threshold_id,
+      accept_budget_id, metrics_log_id;
+
+/* task scheduler classes */
+Ident interactive_id, background_id;
+
+/* profile_report() formats */
+Ident folded_id, lines_id, methods_id;
+
+/* method_stats_top() keys */
+Ident calls_id, time_id, faults_id;
+
+/* spawn() stream events */
+Ident stdout_id, stderr_id, exit_id;
+
+/* set_framing() modes */
+Ident raw_id, line_id, length_id, datagram_id;
+
+/* driver_metrics() phases */
+Ident io_wait_id, input_id, output_id, paused_id, dump_id, lag_id;
 
 /* cache stats options */
-Ident ancestor_cache_id, method_cache_id, name_cache_id, object_cache_id;
+Ident ancestor_cache_id, method_cache_id, name_cache_id, object_cache_id,
+      compression_id;
 
 void init_ident(void)
 {
@@ -105,6 +127,7 @@ void init_ident(void)
     native_id = ident_get("native");
     atomic_id = ident_get("atomic");
     backup_done_id = ident_get("backup_done");
+    compact_done_id = ident_get("compact_done");
     SEEK_SET_id = ident_get("SEEK_SET");
     SEEK_CUR_id = ident_get("SEEK_CUR");
     SEEK_END_id = ident_get("SEEK_END");
@@ -126,11 +149,47 @@ void init_ident(void)
     log_malloc_size_id = ident_get("log_malloc_size");
     log_method_cache_id = ident_get("log_method_cache");
     cache_history_size_id = ident_get("cache_history_size");
+    sched_ticks_id = ident_get("sched_ticks");
+    sched_time_id = ident_get("sched_time");
+    method_stats_id = ident_get("method_stats");
+    file_workers_id = ident_get("file_workers");
+    file_async_threshold_id = ident_get("file_async_threshold");
+    compress_threshold_id = ident_get("compress_threshold");
+    accept_budget_id = ident_get("accept_budget");
+    metrics_log_id = ident_get("metrics_log");
+
+    interactive_id = ident_get("interactive");
+    background_id = ident_get("background");
+
+    folded_id = ident_get("folded");
+    lines_id = ident_get("lines");
+    methods_id = ident_get("methods");
+
+    calls_id = ident_get("calls");
+    time_id = ident_get("time");
+    faults_id = ident_get("faults");
+
+    stdout_id = ident_get("stdout");
+    stderr_id = ident_get("stderr");
+    exit_id = ident_get("exit");
+
+    raw_id = ident_get("raw");
+    line_id = ident_get("line");
+    length_id = ident_get("length");
+    datagram_id = ident_get("datagram");
+
+    io_wait_id = ident_get("io_wait");
+    input_id = ident_get("input");
+    output_id = ident_get("output");
+    paused_id = ident_get("paused");
+    dump_id = ident_get("dump");
+    lag_id = ident_get("lag");
 
     ancestor_cache_id = ident_get("ancestor_cache");
     method_cache_id = ident_get("method_cache");
     name_cache_id = ident_get("name_cache");
     object_cache_id = ident_get("object_cache");
+    compression_id = ident_get("compression");
 
     left_id = ident_get("left");
     right_id = ident_get("right");
@@ -52,31 +52,15 @@ static const uLong RESET_SEARCH_AT = ~0;
         cache_search = START_SEARCH_AT; \
     cache_search++
 #define END_SEARCH()
-#define RETRIEVE_ONCE_OR_RETURN(_obj__, _objnum__) \
-    _obj__ = cache_retrieve(_objnum__); \
-    if (SEARCHED(_obj__)) { \
-        cache_discard(_obj__); \
-        return; \
-    } \
-    HAVE_SEARCHED(_obj__)
 
 
 /* ..................................................................... */
 /* types and structures */
 
-/* cData for method searches. */
-typedef struct search_params Search_params;
-
-struct search_params {
-    uLong name;
-    Long stop_at;
-    Int done;
-    IsFrob is_frob;
-    Method * last_method_found;
-};
-
 struct {
     Long stamp;
+    Long name_stamp;
+    Long obj_stamp;
     cObjnum objnum;
     Ident name;
     IsFrob is_frob;
@@ -85,6 +69,17 @@ struct {
     cObjnum loc;
 } method_cache[METHOD_CACHE_SIZE];
 
+/* An entry is only valid while the stamps for its name and object are
+ * unchanged, see method_cache_invalidate_name() and
+ * method_cache_invalidate_object(). */
+static Long method_name_stamps[METHOD_CACHE_STAMPS];
+static Long method_obj_stamps[METHOD_CACHE_STAMPS];
+
+#define NAME_STAMP(_name_) \
+    method_name_stamps[(uLong) (_name_) % METHOD_CACHE_STAMPS]
+#define OBJ_STAMP(_objnum_) \
+    method_obj_stamps[(uLong) (_objnum_) % METHOD_CACHE_STAMPS]
+
 struct {
     Long stamp;
     cObjnum objnum;
@@ -99,16 +94,20 @@ static int object_extras_count       = 0;
 /* function prototypes */
 static void    object_update_parents(Obj *object,
                                      cList *(*list_op)(cList *, cData *));
-static Int     object_has_ancestor_aux(cObjnum objnum, cObjnum ancestor);
+static cList * object_get_ancestors(Obj * object);
+static void    object_invalidate_ancestors(Obj * object);
 static Var    *object_create_var(Obj *object, cObjnum cclass, Ident name);
 static Var    *object_find_var(Obj *object, cObjnum cclass, Ident name);
 static Bool    method_cache_check(cObjnum objnum, Ident name, cObjnum after,
                                   IsFrob is_frob, Method **method);
 static void    method_cache_set(cObjnum objnum, Ident name, cObjnum after,
                                 Long loc, IsFrob is_frob, Bool failed);
-static void    method_cache_invalidate(cObjnum objnum);
+static void    method_cache_invalidate_name(Ident name);
+static void    method_cache_invalidate_object(cObjnum objnum);
 static void    method_cache_invalidate_all(void);
-static void    search_object(cObjnum objnum, Search_params *params);
+static void    object_free_methods(Obj *object);
+static void    object_free_vars(Obj *object);
+static void    object_alloc_vars(Obj *object);
 static void    method_delete_code_refs(Method * method);
 static Bool    ancestor_cache_check(cObjnum objnum, cObjnum ancestor,
                                     Bool *is_ancestor);
@@ -208,7 +207,6 @@ static inline void ancestor_cache_invalidate()
 
 Obj * object_new(cObjnum objnum, cList * parents) {
     Obj   * cnew;
-    Int     i;
 #ifdef USE_PARENT_OBJS
     cData * d, cthis;
 #endif
@@ -222,6 +220,8 @@ Obj * object_new(cObjnum objnum, cList * parents) {
 
     cnew->objname  = -1;
     cnew->children = NULL;
+    cnew->ancestors = NULL;
+    cnew->anc_epoch = 0;
     cnew->methods  = NULL;
     cnew->extras   = NULL;
     cnew->search   = START_SEARCH_AT;
@@ -238,16 +238,7 @@ Obj * object_new(cObjnum objnum, cList * parents) {
 #endif
 
     /* Initialize variables table and hash table. */
-    cnew->vars.tab = EMALLOC(Var, VAR_STARTING_SIZE);
-    cnew->vars.hashtab = EMALLOC(Int, VAR_STARTING_SIZE);
-    cnew->vars.blanks = 0;
-    cnew->vars.size = VAR_STARTING_SIZE;
-    for (i = 0; i < VAR_STARTING_SIZE; i++) {
-        cnew->vars.hashtab[i] = -1;
-        cnew->vars.tab[i].name = -1;
-        cnew->vars.tab[i].next = i + 1;
-    }
-    cnew->vars.tab[VAR_STARTING_SIZE - 1].next = -1;
+    object_alloc_vars(cnew);
 
     /* Add this object to the children list of parents. */
     object_update_parents(cnew, list_add);
@@ -260,6 +251,21 @@ Obj * object_new(cObjnum objnum, cList * parents) {
     return cnew;
 }
 
+static void object_alloc_vars(Obj *object) {
+    Int i;
+
+    object->vars.tab = EMALLOC(Var, VAR_STARTING_SIZE);
+    object->vars.hashtab = EMALLOC(Int, VAR_STARTING_SIZE);
+    object->vars.blanks = 0;
+    object->vars.size = VAR_STARTING_SIZE;
+    for (i = 0; i < VAR_STARTING_SIZE; i++) {
+        object->vars.hashtab[i] = -1;
+        object->vars.tab[i].name = -1;
+        object->vars.tab[i].next = i + 1;
+    }
+    object->vars.tab[VAR_STARTING_SIZE - 1].next = -1;
+}
+
 void object_alloc_methods(Obj *object) {
     int i;
 
@@ -296,8 +302,6 @@ void object_alloc_methods(Obj *object) {
 //
 */
 void object_free(Obj *object) {
-    Int i;
-
     /* Free parents and children list. */
     list_discard(object->parents);
     object->parents = NULL;
@@ -309,8 +313,22 @@ void object_free(Obj *object) {
         list_discard(object->children);
         object->children = NULL;
     }
+    if (object->ancestors) {
+        list_discard(object->ancestors);
+        object->ancestors = NULL;
+    }
 
     /* Free variable names and contents. */
+    object_free_vars(object);
+
+    /* Free methods. */
+    object_free_methods(object);
+}
+
+/* Free the variables table. */
+static void object_free_vars(Obj *object) {
+    Int i;
+
     for (i = 0; i < object->vars.size; i++) {
         if (object->vars.tab[i].name != -1) {
             ident_discard(object->vars.tab[i].name);
@@ -319,8 +337,12 @@ void object_free(Obj *object) {
     }
     efree(object->vars.tab);
     efree(object->vars.hashtab);
+}
+
+/* Free the method table, along with its strings and identifiers. */
+static void object_free_methods(Obj *object) {
+    Int i;
 
-    /* Free methods. */
     if (object->methods) {
         for (i = 0; i < object->methods->size; i++) {
             if (object->methods->tab[i].m)
@@ -450,6 +472,9 @@ void object_destroy(Obj *object) {
 
         /* Invalidate the ancestor cache if the object has any children */
         ancestor_cache_invalidate();
+
+        /* and the ancestor lists of everything below it */
+        object_invalidate_ancestors(object);
     }
 
     /* remove the object name, if it has one */
@@ -543,52 +568,84 @@ static void object_update_parents(Obj * object,
 // -----------------------------------------------------------------
 */
 
-static Hash * object_ancestors_depth_aux(cObjnum objnum, Hash * h) {
-    Obj    * obj;
-    cData  * d;
-    cData    this;
-    cList  * parents;
+/*
+// Each object keeps its ancestors linearized in the same order as the
+// old reverse depth-first method search (the object first, then back
+// towards $root).  The list is built from the parents' lists, so finding
+// it never has to look past the direct parents.
+//
+// The list is a cache: building it doesn't dirty the object, it is only
+// stored when the object is written anyway.  A list is good for the
+// ancestry_epoch it was built in.  Changing the parents of an object
+// with children bumps the epoch, which drops every list in memory and on
+// disk at once, rather than faulting in each descendant to forget its
+// list.  The epoch is kept in the binary db's clean file.
+*/
+Long ancestry_epoch = 1;
 
-    obj = cache_retrieve(objnum);
-    if (SEARCHED(obj)) {
-        cache_discard(obj);
-        return h;
+static cList * object_get_ancestors(Obj * object) {
+    Obj    * parent;
+    cList  * list;
+    cData  * d,
+           * a,
+             this;
+    Hash   * h;
+
+    if (object->ancestors) {
+        if (object->anc_epoch == ancestry_epoch)
+            return object->ancestors;
+        list_discard(object->ancestors);
+        object->ancestors = NULL;
     }
-    HAVE_SEARCHED(obj);
 
-    parents = list_dup(obj->parents);
-    cache_discard(obj);
+    this.type = OBJNUM;
+    this.u.objnum = object->objnum;
+
+    /* Visiting the parents right to left, the search order of each
+       parent is its own list reversed, skipping objects already seen. */
+    h = hash_new(0);
+    for (d = list_last(object->parents); d; d = list_prev(object->parents, d)) {
+        parent = cache_retrieve(d->u.objnum);
+        if (!parent)
+            continue;
+        list = object_get_ancestors(parent);
+        for (a = list_last(list); a; a = list_prev(list, a)) {
+            if (hash_find(h, a) == F_FAILURE)
+                h = hash_add(h, a);
+        }
+        cache_discard(parent);
+    }
+    h = hash_add(h, &this);
 
-    for (d = list_last(parents); d; d = list_prev(parents, d))
-        h = object_ancestors_depth_aux(d->u.objnum, h);
+    object->ancestors = list_reverse(list_dup(h->keys));
+    object->anc_epoch = ancestry_epoch;
+    hash_discard(h);
 
-    list_discard(parents);
+    return object->ancestors;
+}
 
-    this.type = OBJNUM;
-    this.u.objnum = objnum;
-    return hash_add(h, &this);
+/* Forget the ancestor list of an object whose parents change, and if it
+   has descendants, theirs too by moving on to a new epoch.  The caller
+   dirties the object for the change itself. */
+static void object_invalidate_ancestors(Obj * object) {
+    if (object->ancestors) {
+        list_discard(object->ancestors);
+        object->ancestors = NULL;
+    }
+
+    if (object->children && list_length(object->children) != 0)
+        ancestry_epoch++;
 }
 
 cList * object_ancestors_depth(cObjnum objnum) {
-    Hash   * h;
+    Obj    * obj;
     cList  * list;
-    cData    d;
 
-    /* short circuit root */
-    if (objnum == ROOT_OBJNUM) {
-        list = list_new(1);
-        d.type = OBJNUM;
-        d.u.objnum = ROOT_OBJNUM;
-        return list_add(list, &d);
-    } else {
-        h = hash_new(0);
-        START_SEARCH();
-        h = object_ancestors_depth_aux(objnum, h);
-        END_SEARCH();
-        list = list_dup(h->keys);
-        hash_discard(h);
-        return list_reverse(list);
-    }
+    obj = cache_retrieve(objnum);
+    list = list_dup(object_get_ancestors(obj));
+    cache_discard(obj);
+
+    return list;
 }
 
 cList * object_ancestors_breadth(cObjnum objnum) {
@@ -680,6 +737,8 @@ Int object_has_ancestor(cObjnum objnum, cObjnum ancestor)
 {
     Int retv;
     Bool anc_cache_check;
+    Obj *object;
+    cData d;
 
     if (objnum == ancestor)
         return 1;
@@ -687,59 +746,16 @@ Int object_has_ancestor(cObjnum objnum, cObjnum ancestor)
     if (ancestor_cache_check(objnum, ancestor, &anc_cache_check))
         return anc_cache_check;
 
-    START_SEARCH();
-    retv = object_has_ancestor_aux(objnum, ancestor);
-    ancestor_cache_set(objnum, ancestor, retv);
-    END_SEARCH();
-    return retv;
-}
-
-static Int object_has_ancestor_aux(cObjnum objnum, cObjnum ancestor)
-{
-    Obj *object;
-    cList *parents;
-    cData *d;
-    Bool anc_cache_check;
-
-    /* Don't search an object twice. */
     object = cache_retrieve(objnum);
-    if (SEARCHED(object)) {
-        cache_discard(object);
+    if (!object)
         return 0;
-    }
-    HAVE_SEARCHED(object);
-
-    parents = list_dup(object->parents);
+    d.type = OBJNUM;
+    d.u.objnum = ancestor;
+    retv = (list_search(object_get_ancestors(object), &d) != -1);
     cache_discard(object);
 
-    for (d = list_first(parents); d; d = list_next(parents, d)) {
-        /* Do this check first since it is trivial
-         * The result of this will be cached in the
-         * caller. */
-        if (d->u.objnum == ancestor) {
-            list_discard(parents);
-            return 1;
-        }
-        /* Only fall out if the test is true, since other parents may
-           have a true result. */
-        if (ancestor_cache_check(d->u.objnum, ancestor, &anc_cache_check) &&
-            anc_cache_check) {
-            list_discard(parents);
-            return anc_cache_check;
-        }
-    }
-
-    for (d = list_first(parents); d; d = list_next(parents, d)) {
-        if (object_has_ancestor_aux(d->u.objnum, ancestor)) {
-            ancestor_cache_set(d->u.objnum, ancestor, true);
-            list_discard(parents);
-            return 1;
-        }
-    }
-
-    ancestor_cache_set(objnum, ancestor, false);
-    list_discard(parents);
-    return 0;
+    ancestor_cache_set(objnum, ancestor, retv);
+    return retv;
 }
 
 Int object_change_parents(Obj *object, cList *parents)
@@ -765,16 +781,18 @@ Int object_change_parents(Obj *object, cList *parents)
             return d - list_first(parents);
     }
 
-    /* Invalidate the method cache. */
-    /* NOTE:  is there a better way to invalidate this? */
+    /* Invalidate the method cache.  Only the object's own lookups depend
+       on its parents unless it has descendants. */
     if (object->children && list_length(object->children) != 0) {
         method_cache_invalidate_all();
     } else {
-        method_cache_invalidate(object->objnum);
+        method_cache_invalidate_object(object->objnum);
     }
 
-    /* Invalidate the ancestor cache */
+    /* Invalidate the ancestor cache, and the ancestor lists of this
+       object and its descendants */
     ancestor_cache_invalidate();
+    object_invalidate_ancestors(object);
 
     cache_dirty_object(object);
 
@@ -1172,69 +1190,66 @@ static Var *object_find_var(Obj *object, cObjnum cclass, Ident name)
     return NULL;
 }
 
+/* Walk an ancestor list in search order, from the far end back to the
+ * object itself, taking the last method we find.  The search stops early
+ * at a non-overridable method, or on reaching stop_at if we are looking
+ * for the next method after a given one; skip is never visited. */
+static Method * search_ancestors(cList * ancestors, Ident name,
+                                 IsFrob is_frob, cObjnum stop_at,
+                                 cObjnum skip)
+{
+    Obj    * object;
+    Method * method,
+           * found = NULL;
+    cData  * d;
+
+    for (d = list_last(ancestors); d; d = list_prev(ancestors, d)) {
+        if (d->u.objnum == skip)
+            continue;
+        if (d->u.objnum == stop_at)
+            break;
+
+        object = cache_retrieve(d->u.objnum);
+        if (!object)
+            continue;
+        method = object_find_method_local(object, name, is_frob);
+        if (method) {
+            /* Discard the reference count on the last method found's
+             * object, if we have one, and keep this object's so it doesn't
+             * get swapped out. */
+            if (found)
+                cache_discard(found->object);
+            found = method;
+
+            /* If this method is non-overridable, the search is done. */
+            if (method->m_flags & MF_NOOVER)
+                break;
+        } else {
+            cache_discard(object);
+        }
+    }
+
+    return found;
+}
+
 /* Reference-counting kludge: on return, the method's object field has an
    extra reference count, in order to keep it in cache.  objnum must be
    valid. */
-/* object_find_method is now a front end that increments the
-   cache_search variable and calls object_find_message_recurse,
-   the recursive routine.  This is necessary to make single-
-   inheritance lineage object re-entrant.  It fixes a bug in
-   the circular-definition catching logic that caused it to
-   fail when a parent's method sent a message to the child as
-   a result of a message to the child handled by the parent
-   (whew.) added 5/7/1995 Jeffrey P. kesselman */
 Method *object_find_method(cObjnum objnum, Ident name, IsFrob is_frob) {
-    Search_params   params;
-    Obj           * object;
-    Method        * method, *local_method;
-    cList         * parents;
-    cData         * d;
-    Bool            method_cache_hit;
+    Obj     * object;
+    Method  * method;
+    cList   * ancestors;
 
     /* Look for cached value. */
-    method_cache_hit = method_cache_check(objnum, name, -1, is_frob, &method);
-    if (method_cache_hit)
+    if (method_cache_check(objnum, name, -1, is_frob, &method))
         return method;
 
     object = cache_retrieve(objnum);
-    parents = list_dup(object->parents);
+    ancestors = list_dup(object_get_ancestors(object));
     cache_discard(object);
 
-    if (list_length(parents) != 0) {
-        /* If the object has parents */
-        if (list_length(parents) == 1) {
-            /* If it has only one parent, call this function recursively. */
-            method = object_find_method(list_elem(parents, 0)->u.objnum, name, is_frob);
-        } else {
-            /* We've hit a bulge; resort to the reverse depth-first search. */
-            START_SEARCH();
-            params.name = name;
-            params.stop_at = -1;
-            params.done = 0;
-            params.last_method_found = NULL;
-            params.is_frob = is_frob;
-            for (d = list_last(parents); d; d = list_prev(parents, d))
-                search_object(d->u.objnum, &params);
-            method = params.last_method_found;
-            END_SEARCH();
-        }
-    }
-
-    list_discard(parents);
-
-    /* If we have not found a method defined above, or the top method we
-       have found is overridable */
-    if (!method || !(method->m_flags & MF_NOOVER)) {
-        object = cache_retrieve(objnum);
-        local_method = object_find_method_local(object, name, is_frob);
-        if (local_method) {
-            if (method)
-                cache_discard(method->object);
-            method = local_method;
-        } else {
-            cache_discard(object);
-        }
-    }
+    method = search_ancestors(ancestors, name, is_frob, -1, -1);
+    list_discard(ancestors);
 
     method_cache_set(objnum, name, -1, (method ? method->object->objnum : -2), is_frob, (method ? false : true));
     return method;
@@ -1245,103 +1260,26 @@ Method *object_find_method(cObjnum objnum, Ident name, IsFrob is_frob) {
 Method *object_find_next_method(cObjnum objnum, Ident name,
                                 cObjnum after, IsFrob is_frob)
 {
-    Search_params params;
-    Obj *object;
-    Method *method;
-    cList *parents;
-    cData *d;
-    cObjnum parent;
-    Bool method_cache_hit;
+    Obj     * object;
+    Method  * method;
+    cList   * ancestors;
 
     /* Check cache. */
-    method_cache_hit = method_cache_check(objnum, name, after, is_frob, &method);
-    if (method_cache_hit)
+    if (method_cache_check(objnum, name, after, is_frob, &method))
         return method;
 
     object = cache_retrieve(objnum);
-    parents = object->parents;
+    ancestors = list_dup(object_get_ancestors(object));
+    cache_discard(object);
 
-    if (list_length(parents) == 1) {
-        /* Object has only one parent; search recursively. */
-        parent = list_elem(parents, 0)->u.objnum;
-        cache_discard(object);
-        if (objnum == after)
-            method = object_find_method(parent, name, is_frob);
-        else
-            method = object_find_next_method(parent, name, after, is_frob);
-    } else {
-        /* Object has more than one parent; use complicated search. */
-        START_SEARCH();
-        params.name = name;
-        params.stop_at = (objnum == after) ? -1 : after;
-        params.done = 0;
-        params.last_method_found = NULL;
-        params.is_frob = is_frob;
-        for (d = list_last(parents); d; d = list_prev(parents, d))
-            search_object(d->u.objnum, &params);
-        cache_discard(object);
-        method = params.last_method_found;
-        END_SEARCH();
-    }
+    method = search_ancestors(ancestors, name, is_frob,
+                              (objnum == after) ? -1 : after, objnum);
+    list_discard(ancestors);
 
     method_cache_set(objnum, name, after, (method ? method->object->objnum : -2), is_frob, (method ? false : true));
     return method;
 }
 
-/* Perform a reverse depth-first traversal of this object and its ancestors
- * with no repeat visits, thus searching ancestors before children and
- * searching parents right-to-left.  We will take the last method we find,
- * possibly stopping at a method if we were looking for the next method after
- * a given method. */
-static void search_object(cObjnum objnum, Search_params *params)
-{
-    Obj *object;
-    Method *method;
-    cList *parents;
-    cData *d;
-
-    RETRIEVE_ONCE_OR_RETURN(object, objnum);
-
-    /* Grab the parents list and discard the object. */
-    parents = list_dup(object->parents);
-    cache_discard(object);
-
-    /* Traverse the parents list backwards. */
-    for (d = list_last(parents); d; d = list_prev(parents, d))
-        search_object(d->u.objnum, params);
-    list_discard(parents);
-
-    /* If the search is done, don't visit this object. */
-    if (params->done)
-        return;
-
-    /* If we were searching for a next method after a given object, then this
-     * might be the given object, in which case we should stop. */
-    if (objnum == params->stop_at) {
-        params->done = 1;
-        return;
-    }
-
-    /* Visit this object.  First, get it back from the cache. */
-    object = cache_retrieve(objnum);
-    method = object_find_method_local(object, params->name, params->is_frob);
-    if (method) {
-        /* We found a method on this object.  Discard the reference count on
-         * the last method found's object, if we have one, and set this method
-         * as the last one found.  Leave object's reference count there, since
-         * we don't want it to get swapped out. */
-        if (params->last_method_found)
-            cache_discard(params->last_method_found->object);
-        params->last_method_found = method;
-
-        /* If this method is non-overridable, the search is done. */
-        if (method->m_flags & MF_NOOVER)
-            params->done = 1;
-    } else {
-        cache_discard(object);
-    }
-}
-
 /* Look for a method on an object. */
 Method *object_find_method_local(Obj *object, Ident name, IsFrob is_frob)
 {
@@ -1388,7 +1326,9 @@ static Bool method_cache_check(cObjnum objnum, Ident name,
     i = (10 + objnum + (name << 4) + (is_frob << 8) + after) % METHOD_CACHE_SIZE;
     if (method_cache[i].stamp == cur_stamp && method_cache[i].objnum == objnum &&
         method_cache[i].name == name && method_cache[i].after == after &&
-        method_cache[i].loc != -1 && method_cache[i].is_frob==is_frob) {
+        method_cache[i].loc != -1 && method_cache[i].is_frob==is_frob &&
+        method_cache[i].name_stamp == NAME_STAMP(name) &&
+        method_cache[i].obj_stamp == OBJ_STAMP(objnum)) {
         method_cache_hits++;
         if (!method_cache[i].failed) {
             object = cache_retrieve(method_cache[i].loc);
@@ -1417,6 +1357,8 @@ static void method_cache_set(cObjnum objnum, Ident name, cObjnum after,
           method_cache_collisions++;
     }
     method_cache[i].stamp = cur_stamp;
+    method_cache[i].name_stamp = NAME_STAMP(name);
+    method_cache[i].obj_stamp = OBJ_STAMP(objnum);
     method_cache[i].objnum = objnum;
     method_cache[i].name = ident_dup(name);
     method_cache[i].after = after;
@@ -1435,7 +1377,9 @@ cList * method_cache_info() {
 
     used_buckets = 0;
     for (i = 0; i < METHOD_CACHE_SIZE; i++) {
-        if (method_cache[i].stamp == cur_stamp)
+        if (method_cache[i].stamp == cur_stamp &&
+            method_cache[i].name_stamp == NAME_STAMP(method_cache[i].name) &&
+            method_cache[i].obj_stamp == OBJ_STAMP(method_cache[i].objnum))
             used_buckets++;
     }
 
@@ -1462,35 +1406,33 @@ cList * method_cache_info() {
     return entry;
 }
 
-static void method_cache_invalidate(cObjnum objnum) {
-#ifdef BUILDING_COLDCC
-    method_cache_invalidate_all();
-#else
-    uLong i;
+/*
+ * Invalidate every entry for a method name, for when a method of that
+ * name is added, removed or has its lookup behaviour changed on any
+ * object.  Entries notice the new stamp when they are next checked.
+ */
+static void method_cache_invalidate_name(Ident name) {
+    NAME_STAMP(name)++;
+    method_cache_partials++;
 
-    /*
-     * Invalidate cache entries by decrementing the stamp.
-     * Don't set it to 0, that way method_cache_set() can handle
-     * the ident_discard() properly
-     * Make sure that the stamp is already greater than 0
-     * to avoid false invalidations where objnum == 0, so
-     * it will catch all of the uninitialized entries in the
-     * cache, who will have objnum == 0, but also stamp == 0.
-     */
-    for (i = 0; i < METHOD_CACHE_SIZE; i++) {
-        if ((method_cache[i].objnum == objnum) &&
-            (method_cache[i].stamp > 0)) {
-            method_cache[i].stamp = 1;
-        }
+    if (log_method_cache == 2) {
+        write_err("Method cache invalidated for method %s", ident_name(name));
+        log_current_task_stack(false, write_err);
     }
+}
 
+/*
+ * Invalidate every entry looked up on objnum, for when the parents of an
+ * object without descendants change.
+ */
+static void method_cache_invalidate_object(cObjnum objnum) {
+    OBJ_STAMP(objnum)++;
     method_cache_partials++;
 
     if (log_method_cache == 2) {
         write_err("Method cache partially invalidated for obj #%l", objnum);
         log_current_task_stack(false, write_err);
     }
-#endif
 }
 
 static void method_cache_invalidate_all(void) {
@@ -1552,6 +1494,48 @@ Int object_rename_method(Obj * object, Ident oname, Ident nname) {
     return 1;
 }
 
+/*
+ * Drop an object's variables and methods, leaving its place in the
+ * hierarchy, as when coldcc replays an object from an incremental dump.
+ * Only this object's own table is cleared; the variables it defines are
+ * not removed from its descendants.
+ */
+void object_reset(Obj *object) {
+    cache_dirty_object(object);
+    object_set_methods(object, NULL);
+    object_free_vars(object);
+    object_alloc_vars(object);
+}
+
+/*
+ * Replace the whole method table, as when coldcc brings in methods that a
+ * worker process compiled.  Lookups of names in either table are
+ * invalidated.
+ */
+void object_set_methods(Obj *object, ObjMethods *methods) {
+    Int i;
+
+    cache_dirty_object(object);
+
+    if (object->methods) {
+        for (i = 0; i < object->methods->size; i++) {
+            if (object->methods->tab[i].m)
+                method_cache_invalidate_name(object->methods->tab[i].m->name);
+        }
+        object_free_methods(object);
+    }
+
+    object->methods = methods;
+    if (methods) {
+        for (i = 0; i < methods->size; i++) {
+            if (methods->tab[i].m) {
+                methods->tab[i].m->object = object;
+                method_cache_invalidate_name(methods->tab[i].m->name);
+            }
+        }
+    }
+}
+
 void object_add_method(Obj *object, Ident name, Method *method) {
     Int ind, hval;
 
@@ -1563,14 +1547,11 @@ void object_add_method(Obj *object, Ident name, Method *method) {
     /* Delete the method if it previous existed, calling this on a
        locked method WILL CAUSE PROBLEMS, make sure you check before
        calling this. */
-    if (object_del_method(object, name, true) != 1) {
-        /* Invalidate the method cache. */
-        if (object->children && list_length(object->children) != 0) {
-            method_cache_invalidate_all();
-        } else {
-            method_cache_invalidate(object->objnum);
-        }
-    }
+    object_del_method(object, name, true);
+
+    /* Invalidate the method cache, even when replacing, as the flags or
+       access of the new method may change what a lookup finds. */
+    method_cache_invalidate_name(name);
 
     /* If the method table is full, expand it and its corresponding hash
      * table. */
@@ -1653,11 +1634,7 @@ Int object_del_method(Obj *object, Ident name, Bool replacing) {
 
             if (replacing == false) {
                 /* Invalidate the method cache. */
-                if (object->children && list_length(object->children) != 0) {
-                    method_cache_invalidate_all();
-                } else {
-                    method_cache_invalidate(object->objnum);
-                }
+                method_cache_invalidate_name(name);
             }
 
             /* Return one, meaning the method was successfully deleted. */
@@ -1695,7 +1672,7 @@ Int object_set_method_flags(Obj * object, Ident name, Int flags) {
 
     if ((!(method->m_flags & MF_NOOVER) && (flags & MF_NOOVER)) ||
         ((method->m_flags & MF_NOOVER) && !(flags & MF_NOOVER))) {
-        method_cache_invalidate_all();
+        method_cache_invalidate_name(name);
     }
 
     method->m_flags = flags;
@@ -1723,7 +1700,7 @@ Int object_set_method_access(Obj * object, Ident name, Int access) {
         /*
          * only invalidate when changing access to or from 'frob' access.
          */
-        method_cache_invalidate_all();
+        method_cache_invalidate_name(name);
     }
     cache_dirty_object(object);
 
@@ -1737,6 +1714,7 @@ Method * method_new(void) {
     method->m_flags  = MF_NONE;
     method->m_access = MS_PUBLIC;
     method->native   = -1;
+    method->stats    = NULL;
 
     /* usually everything else is initialized elsewhere */
     return method;
@@ -1833,6 +1811,7 @@ Int object_del_objname(Obj * object) {
     if (object->objname != -1) {
         result = lookup_remove_name(object->objname);
         ident_discard(object->objname);
+        data_type_handlers_reset();
     }
 
     object->objname = -1;
@@ -1853,6 +1832,7 @@ Int object_set_objname(Obj * obj, Ident name) {
 
     /* ok, index the new name */
     lookup_store_name(name, obj->objnum);
+    data_type_handlers_reset();
 
     /* and for our own purposes, lets remember it */
     obj->objname = ident_dup(name);
@@ -613,6 +613,7 @@ static Method *unpack_method(cBuf *buf, Long *buf_pos)
     method->m_flags = read_long(buf, buf_pos);
     method->native = read_long(buf, buf_pos);
     method->refs = 1;
+    method->stats = NULL;
 
     method->num_args = read_long(buf, buf_pos);
     if (method->num_args) {
@@ -699,7 +700,7 @@ static Int size_method(Method *method, int memory_size)
     return size;
 }
 
-static cBuf * pack_methods(cBuf *buf, Obj *obj)
+cBuf * pack_methods(cBuf *buf, Obj *obj)
 {
     Int i;
 
@@ -730,7 +731,7 @@ static cBuf * pack_methods(cBuf *buf, Obj *obj)
 
 #define METHOD_STARTING_SIZE 7
 
-static void unpack_methods(cBuf *buf, Long *buf_pos, Obj *obj)
+void unpack_methods(cBuf *buf, Long *buf_pos, Obj *obj)
 {
     Int i, size;
 
@@ -1035,36 +1036,78 @@ Int size_data(cData *data, int memory_size)
     return size;
 }
 
+/* After the object name comes a tail: the OBJECT_TAIL byte, a version,
+   and for version 1 the ancestry_epoch the cached ancestor list was
+   built in followed by the list, or 0 and no list when the object has
+   no current one.  Older records end at the name, followed by nothing
+   or by the zero padding simble_put() adds, and so have no cached list. */
+#define OBJECT_TAIL          0xA5
+#define OBJECT_TAIL_VERSION  1
+
 cBuf * pack_object(cBuf *buf, Obj *obj)
 {
+    Bool ancestors = obj->ancestors && obj->anc_epoch == ancestry_epoch;
+
     buf = pack_list(buf, obj->parents);
     buf = pack_list(buf, obj->children);
     buf = pack_vars(buf, obj);
     buf = pack_methods(buf, obj);
     buf = write_ident(buf, obj->objname);
+    buf = buffer_add(buf, OBJECT_TAIL);
+    buf = write_long(buf, OBJECT_TAIL_VERSION);
+    buf = write_long(buf, ancestors ? obj->anc_epoch : 0);
+    buf = pack_list(buf, ancestors ? obj->ancestors : NULL);
     return buf;
 }
 
 void unpack_object(cBuf *buf, Long *buf_pos, Obj *obj)
 {
+    Long version;
+
     obj->parents = unpack_list(buf, buf_pos);
     obj->children = unpack_list(buf, buf_pos);
     unpack_vars(buf, buf_pos, obj);
     unpack_methods(buf, buf_pos, obj);
     obj->objname = read_ident(buf, buf_pos);
+
+    obj->ancestors = NULL;
+    obj->anc_epoch = 0;
+    if (*buf_pos >= buf->len || buf->s[*buf_pos] != OBJECT_TAIL)
+        return;
+    (*buf_pos)++;
+
+    version = read_long(buf, buf_pos);
+    if (version >= 1) {
+        obj->anc_epoch = read_long(buf, buf_pos);
+        obj->ancestors = unpack_list(buf, buf_pos);
+
+        /* built before the hierarchy last changed */
+        if (obj->ancestors && obj->anc_epoch != ancestry_epoch) {
+            list_discard(obj->ancestors);
+            obj->ancestors = NULL;
+        }
+    }
 }
 
 Int size_object(Obj *obj, int memory_size)
 {
-    Int size = 0;
+    Int  size = 0;
+    Bool ancestors;
 
     size = size_list(obj->parents, memory_size);
     size += size_list(obj->children, memory_size);
     size += size_vars(obj, memory_size);
     size += size_methods(obj, memory_size);
 
-    if (!memory_size)
+    if (!memory_size) {
+        ancestors = obj->ancestors && obj->anc_epoch == ancestry_epoch;
         size += size_ident(obj->objname, memory_size);
+        size += 1 + size_long(OBJECT_TAIL_VERSION, memory_size) +
+                size_long(ancestors ? obj->anc_epoch : 0, memory_size) +
+                size_list(ancestors ? obj->ancestors : NULL, memory_size);
+    } else {
+        size += size_list(obj->ancestors, memory_size);
+    }
 
     if (memory_size) {
         size += sizeof(Obj);
@@ -51,6 +51,14 @@ Int  cache_watch_count;
 cObjnum cache_watch_object;
 Int  log_malloc_size;
 Int  log_method_cache;
+Int  sched_tick_budget;
+Int  sched_time_budget;
+Int  method_stats_flag;
+Int  file_workers;
+Int  file_async_threshold;
+Int  compress_threshold;
+Int  accept_budget;
+Int  metrics_log;
 
 #ifdef USE_CACHE_HISTORY
 /* cache stats stuff */
@@ -105,6 +113,14 @@ void init_defs(void) {
 
     log_malloc_size = 0;
     log_method_cache = 0;
+    sched_tick_budget = SCHED_TICK_BUDGET;
+    sched_time_budget = SCHED_TIME_BUDGET;
+    method_stats_flag = 0;
+    file_workers = FILE_WORKERS;
+    file_async_threshold = FILE_ASYNC_THRESHOLD;
+    compress_threshold = COMPRESS_THRESHOLD;
+    accept_budget = ACCEPT_BUDGET;
+    metrics_log = METRICS_LOG;
 
 #ifdef USE_CACHE_HISTORY
     ancestor_cache_history = list_new(0);
@@ -16,6 +16,12 @@
 #define STACK_STARTING_SIZE                (256 - STACK_MALLOC_DELTA)
 #define ARG_STACK_STARTING_SIZE            (32 - ARG_STACK_MALLOC_DELTA)
 
+#ifdef USE_BIG_NUMBERS
+#define MAX_NUM 2147483647
+#else
+#define MAX_NUM 2147483647
+#endif
+
 extern Bool running;
 
 static void execute(void);
@@ -38,6 +44,7 @@ Long task_id=1;
 Long next_task_id=2;
 Long call_environ=1;
 Long tick;
+Int task_class = TASK_CLASS_BACKGROUND;
 
 #define DEBUG_VM DISABLED
 #define DEBUG_EXECUTE DISABLED
@@ -111,6 +118,12 @@ VMState * vm_current(void) {
     }
 
     vm->preempted = false;
+    vm->task_class = task_class;
+    vm->sched_deferred = 0;
+    vm->paused_at = 0;
+    vm->waiter = NULL;
+    vm->saved_tick = tick;
+    vm->saved_faults = cache_faults;
     vm->cur_frame = cur_frame;
     vm->stack = stack;
     vm->stack_pos = stack_pos;
@@ -138,7 +151,20 @@ VMState * vm_current(void) {
 // ---------------------------------------------------------------
 */
 static void restore_vm(VMState *vm) {
+    Frame * f;
+
+    /* Don't charge methods being counted for other tasks' work. */
+    if (method_stats_flag) {
+        for (f = vm->cur_frame; f; f = f->caller_frame) {
+            if (f->stats) {
+                f->stats_tick += tick - vm->saved_tick;
+                f->stats_faults += cache_faults - vm->saved_faults;
+            }
+        }
+    }
+
     task_id = vm->task_id;
+    task_class = vm->task_class;
     frame_depth = vm->frame_depth;
     cur_frame = vm->cur_frame;
     stack = vm->stack;
@@ -297,6 +323,7 @@ void vm_resume(Long tid, cData *ret) {
     old_vm = vm_current();
     restore_vm(vm);
     REMOVE_VM_TASK(suspended, vm);
+    vm->waiter = NULL;
     ADD_VM_TASK(vmstore, vm);
     if (ret) {
         check_stack(1);
@@ -313,6 +340,31 @@ void vm_resume(Long tid, cData *ret) {
     ADD_VM_TASK(vmstore, old_vm);
 }
 
+/*
+// ---------------------------------------------------------------
+// Resume a suspended task by throwing error in it, as though the
+// function it suspended in had thrown it.
+*/
+void vm_resume_error(Long tid, Ident error, cStr *explanation) {
+    VMState * vm = vm_lookup(tid),
+            * old_vm;
+
+    if (vm->task_id == task_id)
+        return;
+    old_vm = vm_current();
+    restore_vm(vm);
+    REMOVE_VM_TASK(suspended, vm);
+    vm->waiter = NULL;
+    ADD_VM_TASK(vmstore, vm);
+    if (cur_frame->ticks < PAUSED_METHOD_TICKS)
+        cur_frame->ticks = PAUSED_METHOD_TICKS;
+    interp_error(error, explanation);
+    execute();
+    store_stack();
+    restore_vm(old_vm);
+    ADD_VM_TASK(vmstore, old_vm);
+}
+
 /*
 // ---------------------------------------------------------------
 */
@@ -332,6 +384,7 @@ static Int fork_method(Obj * obj,
     init_execute();
     cur_frame = NULL;
     task_id = next_task_id++;
+    task_class = TASK_CLASS_BACKGROUND;
     cache_grab(obj);
     cache_grab(method->object);
     method_dup(method);
@@ -377,13 +430,40 @@ static Int fork_method(Obj * obj,
 // ---------------------------------------------------------------
 */
 void vm_suspend(void) {
+    vm_suspend_on(NULL);
+}
+
+/*
+// ---------------------------------------------------------------
+// Suspend the current task until whatever waiter is (a spawned process,
+// a file job) is done with it.  The link only lasts for this suspension,
+// so if the task is resumed or cancelled by hand in the meantime,
+// vm_waiting() no longer matches and the late result is dropped.
+*/
+void vm_suspend_on(void * waiter) {
     VMState * vm = vm_current();
 
+    vm->waiter = waiter;
     ADD_VM_TASK(suspended, vm);
     init_execute();
     cur_frame = NULL;
 }
 
+/*
+// ---------------------------------------------------------------
+// Is task tid still suspended on waiter?  Only then may the waiter
+// vm_resume() it.
+*/
+Bool vm_waiting(Long tid, void * waiter) {
+    VMState * vm;
+
+    for (vm = suspended;  vm;  vm = vm->next)
+        if (vm->task_id == tid)
+            return (waiter && vm->waiter == waiter);
+
+    return false;
+}
+
 #ifdef REF_COUNT_DEBUG
 void dump_stack (void) {
     Frame *f = cur_frame;
@@ -463,6 +543,7 @@ void vm_cancel(Long tid) {
         else
             REMOVE_VM_TASK(suspended, vm)
         store_stack();
+        vm->waiter = NULL;
         ADD_VM_TASK(vmstore, vm);
         restore_vm(old_vm);
         ADD_VM_TASK(vmstore, old_vm);
@@ -476,36 +557,696 @@ void vm_pause(void) {
     VMState * vm = vm_current();
 
     vm->preempted = true;
+    vm->paused_at = usec_time();
     ADD_VM_TASK(preempted, vm);
     init_execute();
     cur_frame = NULL;
 }
 
+/*
+// ---------------------------------------------------------------
+//
+// Scheduling of preempted tasks.
+//
+// Each pass of the main loop runs preempted tasks in priority order:
+// tasks which have been passed over SCHED_STARVATION_LIMIT times, then
+// interactive tasks, then heartbeat tasks, then everything else.  Within
+// a class tasks are taken round-robin by user, oldest first, so a user
+// with a hundred forked tasks does not hold up a user with one.  The
+// pass stops when the tick or time budget is spent and the rest are
+// left on the preempted list for the next pass.
+//
+*/
+
+typedef struct sched_entry {
+    VMState * vm;
+    Int       rank;
+    cObjnum   user;
+    Int       turn;
+} SchedEntry;
+
+typedef struct sched_class_stats {
+    uLong     run;
+    uLong     deferred;
+    Int       max_depth;
+    int64_t   latency_total;
+    int64_t   latency_max;
+} SchedStats;
+
+static SchedEntry * sched_queue = NULL;
+static Int          sched_queue_size = 0;
+static SchedStats   sched_stats[TASK_CLASSES];
+static uLong        sched_passes = 0;
+static uLong        sched_exhausted = 0;
+
+static int sched_cmp_user(const void * a, const void * b) {
+    const SchedEntry * x = a, * y = b;
+
+    if (x->rank != y->rank)
+        return x->rank - y->rank;
+    if (x->user != y->user)
+        return (x->user < y->user) ? -1 : 1;
+    if (x->vm->paused_at != y->vm->paused_at)
+        return (x->vm->paused_at < y->vm->paused_at) ? -1 : 1;
+    return (x->vm->task_id < y->vm->task_id) ? -1 : 1;
+}
+
+static int sched_cmp_turn(const void * a, const void * b) {
+    const SchedEntry * x = a, * y = b;
+
+    if (x->rank != y->rank)
+        return x->rank - y->rank;
+    if (x->turn != y->turn)
+        return x->turn - y->turn;
+    if (x->vm->paused_at != y->vm->paused_at)
+        return (x->vm->paused_at < y->vm->paused_at) ? -1 : 1;
+    return (x->vm->task_id < y->vm->task_id) ? -1 : 1;
+}
+
+/* pull everything off the preempted list into sched_queue, in the
+   order it should be run */
+static Int sched_order_tasks(void) {
+    VMState * task;
+    Int       count, x, depth[TASK_CLASSES];
+
+    count = 0;
+    for (x = 0; x < TASK_CLASSES; x++)
+        depth[x] = 0;
+    for (task = preempted; task; task = task->next) {
+        count++;
+        depth[task->task_class]++;
+    }
+    for (x = 0; x < TASK_CLASSES; x++) {
+        if (depth[x] > sched_stats[x].max_depth)
+            sched_stats[x].max_depth = depth[x];
+    }
+
+    if (count > sched_queue_size) {
+        sched_queue_size = count * 2;
+        sched_queue = EREALLOC(sched_queue, SchedEntry, sched_queue_size);
+    }
+
+    for (x = 0, task = preempted; task; task = task->next, x++) {
+        sched_queue[x].vm = task;
+        sched_queue[x].user = task->cur_frame->user;
+        if (task->sched_deferred >= SCHED_STARVATION_LIMIT)
+            sched_queue[x].rank = -1;
+        else
+            sched_queue[x].rank = task->task_class;
+    }
+    preempted = NULL;
+
+    /* number each user's tasks within their rank, then interleave */
+    qsort(sched_queue, count, sizeof(SchedEntry), sched_cmp_user);
+    for (x = 0; x < count; x++) {
+        if (x && sched_queue[x].rank == sched_queue[x-1].rank &&
+                 sched_queue[x].user == sched_queue[x-1].user)
+            sched_queue[x].turn = sched_queue[x-1].turn + 1;
+        else
+            sched_queue[x].turn = 0;
+    }
+    qsort(sched_queue, count, sizeof(SchedEntry), sched_cmp_turn);
+
+    return count;
+}
+
 /*
 // ---------------------------------------------------------------
 */
 void run_paused_tasks(void) {
     VMState * vm = vm_current(),
-            * task = preempted,
-            * last_task;
+            * task,
+            * deferred = NULL;
+    Int       count, x;
+    Long      start_tick = tick;
+    int64_t   start, now, latency;
+    SchedStats * stats;
 
     /* tasks preempting again will be on a new list */
-    preempted = NULL;
+    count = sched_order_tasks();
+    sched_passes++;
+
+    start = now = usec_time();
+    for (x = 0; x < count; x++) {
+        task = sched_queue[x].vm;
+
+        if (x && ((sched_tick_budget > 0 &&
+                   tick - start_tick >= sched_tick_budget) ||
+                  (sched_time_budget > 0 &&
+                   now - start >= sched_time_budget)))
+        {
+            sched_exhausted++;
+            break;
+        }
+
+        stats = &sched_stats[task->task_class];
+        stats->run++;
+        latency = now - task->paused_at;
+        stats->latency_total += latency;
+        if (latency > stats->latency_max)
+            stats->latency_max = latency;
 
-    while (task) {
         restore_vm(task);
         cur_frame->ticks = PAUSED_METHOD_TICKS;
-        last_task = task;
-        task = task->next;
-        ADD_VM_TASK(vmstore, last_task);
+        ADD_VM_TASK(vmstore, task);
         execute();
         store_stack();
+        now = usec_time();
+    }
+
+    /* whatever we didn't get to goes back on the list, ahead of the
+       tasks which were preempted during this pass */
+    while (count-- > x) {
+        task = sched_queue[count].vm;
+        task->sched_deferred++;
+        sched_stats[task->task_class].deferred++;
+        ADD_VM_TASK(deferred, task);
+    }
+    if (deferred) {
+        for (task = deferred; task->next; task = task->next);
+        task->next = preempted;
+        preempted = deferred;
     }
 
     restore_vm(vm);
     ADD_VM_TASK(vmstore, vm);
 }
 
+/*
+// ---------------------------------------------------------------
+//
+// Scheduler statistics, returned as:
+//
+//    [passes, exhausted, [[class, queued, max queued, run, deferred,
+//                          avg latency, max latency], ...]]
+//
+// Latencies are in microseconds, from when the task was preempted
+// until it was next run.
+//
+*/
+cList * vm_sched_stats(void) {
+    cList      * out, * classes;
+    cData      * d, * cd;
+    VMState    * vm;
+    SchedStats * stats;
+    Int          x, depth[TASK_CLASSES];
+    Ident        names[TASK_CLASSES];
+
+    names[TASK_CLASS_INTERACTIVE] = interactive_id;
+    names[TASK_CLASS_HEARTBEAT] = heartbeat_id;
+    names[TASK_CLASS_BACKGROUND] = background_id;
+
+    for (x = 0; x < TASK_CLASSES; x++)
+        depth[x] = 0;
+    for (vm = preempted; vm; vm = vm->next)
+        depth[vm->task_class]++;
+
+    classes = list_new(TASK_CLASSES);
+    cd = list_empty_spaces(classes, TASK_CLASSES);
+    for (x = 0; x < TASK_CLASSES; x++) {
+        stats = &sched_stats[x];
+        cd[x].type = LIST;
+        cd[x].u.list = list_new(7);
+        d = list_empty_spaces(cd[x].u.list, 7);
+        d[0].type = SYMBOL;
+        d[0].u.symbol = ident_dup(names[x]);
+        d[1].type = INTEGER;
+        d[1].u.val = depth[x];
+        d[2].type = INTEGER;
+        d[2].u.val = stats->max_depth;
+        d[3].type = INTEGER;
+        d[3].u.val = stats->run;
+        d[4].type = INTEGER;
+        d[4].u.val = stats->deferred;
+        d[5].type = INTEGER;
+        d[5].u.val = stats->run ? (Long) (stats->latency_total / stats->run) : 0;
+        d[6].type = INTEGER;
+        d[6].u.val = (Long) stats->latency_max;
+    }
+
+    out = list_new(3);
+    d = list_empty_spaces(out, 3);
+    d[0].type = INTEGER;
+    d[0].u.val = sched_passes;
+    d[1].type = INTEGER;
+    d[1].u.val = sched_exhausted;
+    d[2].type = LIST;
+    d[2].u.list = classes;
+
+    return out;
+}
+
+/*
+// ---------------------------------------------------------------
+//
+// Sampling profiler.  When enabled with profile(), execute() calls
+// profile_sample() every profile_interval ticks, which copies the
+// method and line of each frame on the ColdC stack into a fixed ring
+// buffer.  Once the buffer is full the oldest samples are overwritten.
+// profile_report() aggregates whatever is in the buffer.
+//
+*/
+typedef struct prof_frame_s {
+    cObjnum definer;
+    Ident   name;
+    Int     line;
+} ProfFrame;
+
+typedef struct prof_sample_s {
+    Int       depth;
+    Bool      truncated;
+    ProfFrame frames[PROFILE_DEPTH];   /* top of the stack first */
+} ProfSample;
+
+Long profile_countdown = 0;
+static Long profile_interval = 0;
+static ProfSample * prof_samples = NULL;
+static Int prof_next = 0;
+static Int prof_count = 0;
+
+static void profile_clear(void) {
+    Int x, y;
+
+    for (x = 0; x < prof_count; x++) {
+        for (y = 0; y < prof_samples[x].depth; y++) {
+            if (prof_samples[x].frames[y].name != NOT_AN_IDENT)
+                ident_discard(prof_samples[x].frames[y].name);
+        }
+    }
+    prof_next = 0;
+    prof_count = 0;
+}
+
+void profile_sample(void) {
+    ProfSample * sample;
+    ProfFrame  * pf;
+    Frame      * f;
+    Int          y;
+
+    profile_countdown = profile_interval;
+
+    sample = &prof_samples[prof_next];
+    if (prof_count == PROFILE_SAMPLES) {
+        for (y = 0; y < sample->depth; y++) {
+            if (sample->frames[y].name != NOT_AN_IDENT)
+                ident_discard(sample->frames[y].name);
+        }
+    } else {
+        prof_count++;
+    }
+    prof_next = (prof_next + 1) % PROFILE_SAMPLES;
+
+    sample->depth = 0;
+    for (f = cur_frame; f && sample->depth < PROFILE_DEPTH; f = f->caller_frame) {
+        pf = &sample->frames[sample->depth++];
+        pf->definer = f->method->object->objnum;
+        if (f->method->name != NOT_AN_IDENT)
+            pf->name = ident_dup(f->method->name);
+        else
+            pf->name = NOT_AN_IDENT;
+        pf->line = line_number(f->method, f->pc - 1);
+    }
+    sample->truncated = (f != NULL);
+}
+
+/* Start sampling every <interval> ticks, or stop if it is zero.  The
+   buffer is cleared when sampling starts, and kept when it stops so it
+   can still be reported on. */
+Int profile_set(Long interval) {
+    if (interval && !profile_interval) {
+        if (!prof_samples)
+            prof_samples = EMALLOC(ProfSample, PROFILE_SAMPLES);
+        profile_clear();
+    }
+    profile_interval = interval;
+    profile_countdown = interval;
+
+    return prof_count;
+}
+
+Int profile_samples(void) {
+    return prof_count;
+}
+
+static cStr * prof_frame_name(ProfFrame * pf) {
+    if (pf->name == NOT_AN_IDENT)
+        return format("%O.<eval>", pf->definer);
+    return format("%O.%I", pf->definer, pf->name);
+}
+
+static int prof_cmp_str(const void * a, const void * b) {
+    cStr * sa = *(cStr **) a, * sb = *(cStr **) b;
+
+    return strcmp(string_chars(sa), string_chars(sb));
+}
+
+static int prof_cmp_frame(const void * a, const void * b) {
+    const ProfFrame * fa = a, * fb = b;
+
+    if (fa->definer != fb->definer)
+        return (fa->definer < fb->definer) ? -1 : 1;
+    if (fa->name != fb->name)
+        return (fa->name < fb->name) ? -1 : 1;
+    return fa->line - fb->line;
+}
+
+/* [definer, name, x, count] rows are sorted by count, highest first */
+static int prof_cmp_count(const void * a, const void * b) {
+    Long ca = list_elem(((cData *) a)->u.list, 3)->u.val,
+         cb = list_elem(((cData *) b)->u.list, 3)->u.val;
+
+    return (ca < cb) ? 1 : (ca > cb) ? -1 : 0;
+}
+
+static cList * prof_row(ProfFrame * pf, Long count, Long extra) {
+    cList * row;
+    cData * d;
+
+    row = list_new(4);
+    d = list_empty_spaces(row, 4);
+    d[0].type = OBJNUM;
+    d[0].u.objnum = pf->definer;
+    if (pf->name != NOT_AN_IDENT) {
+        d[1].type = SYMBOL;
+        d[1].u.symbol = ident_dup(pf->name);
+    } else {
+        d[1].type = INTEGER;
+        d[1].u.val = 0;
+    }
+    d[2].type = INTEGER;
+    d[2].u.val = extra;
+    d[3].type = INTEGER;
+    d[3].u.val = count;
+
+    return row;
+}
+
+/*
+// 'folded:  ["$a.m1;$b.m2;... count", ...] root of the stack first, one
+//           string per distinct stack, as used by flamegraph.pl
+// 'lines:   [[definer, method, line, samples], ...] for the top frame
+// 'methods: [[definer, method, self samples, total samples], ...]
+//
+// The lines and methods reports are ordered by samples, highest first.
+*/
+cList * profile_report(Ident type) {
+    cList      * out;
+    cData        d;
+    ProfSample * sample;
+    ProfFrame  * keys;
+    Int          x, y, z, n, run;
+
+    out = list_new(0);
+    if (!prof_count)
+        return out;
+
+    if (type == folded_id) {
+        cStr ** stacks = EMALLOC(cStr *, prof_count), * str;
+        char    nbuf[32];
+
+        for (x = 0; x < prof_count; x++) {
+            sample = &prof_samples[x];
+            stacks[x] = string_new(0);
+            if (sample->truncated)
+                stacks[x] = string_add_chars(stacks[x], "...;", 4);
+            for (y = sample->depth - 1; y >= 0; y--) {
+                str = prof_frame_name(&sample->frames[y]);
+                stacks[x] = string_add(stacks[x], str);
+                string_discard(str);
+                if (y)
+                    stacks[x] = string_addc(stacks[x], ';');
+            }
+        }
+        qsort(stacks, prof_count, sizeof(cStr *), prof_cmp_str);
+        for (x = 0; x < prof_count; x = y) {
+            for (y = x + 1; y < prof_count &&
+                 !strcmp(string_chars(stacks[x]), string_chars(stacks[y])); y++)
+                string_discard(stacks[y]);
+            sprintf(nbuf, " %d", (int) (y - x));
+            d.type = STRING;
+            d.u.str = string_add_chars(stacks[x], nbuf, strlen(nbuf));
+            out = list_add(out, &d);
+            string_discard(d.u.str);
+        }
+        efree(stacks);
+    } else if (type == lines_id) {
+        keys = EMALLOC(ProfFrame, prof_count);
+        for (x = 0, n = 0; x < prof_count; x++) {
+            if (prof_samples[x].depth)
+                keys[n++] = prof_samples[x].frames[0];
+        }
+        qsort(keys, n, sizeof(ProfFrame), prof_cmp_frame);
+        for (x = 0; x < n; x = y) {
+            for (y = x + 1; y < n && !prof_cmp_frame(&keys[x], &keys[y]); y++);
+            d.type = LIST;
+            d.u.list = prof_row(&keys[x], y - x, keys[x].line);
+            out = list_add(out, &d);
+            list_discard(d.u.list);
+        }
+        efree(keys);
+    } else if (type == methods_id) {
+        /* one key per method per sample, with line used as a flag for
+           whether it was the top frame of that sample */
+        keys = EMALLOC(ProfFrame, prof_count * PROFILE_DEPTH);
+        for (x = 0, n = 0; x < prof_count; x++) {
+            sample = &prof_samples[x];
+            for (y = 0; y < sample->depth; y++) {
+                for (z = 0; z < y; z++) {
+                    if (sample->frames[z].definer == sample->frames[y].definer &&
+                        sample->frames[z].name == sample->frames[y].name)
+                        break;
+                }
+                if (z < y)
+                    continue;
+                keys[n] = sample->frames[y];
+                keys[n++].line = (y == 0);
+            }
+        }
+        qsort(keys, n, sizeof(ProfFrame), prof_cmp_frame);
+        for (x = 0; x < n; x = y) {
+            run = 0;
+            for (y = x; y < n && keys[y].definer == keys[x].definer &&
+                 keys[y].name == keys[x].name; y++)
+                run += keys[y].line;
+            d.type = LIST;
+            d.u.list = prof_row(&keys[x], y - x, run);
+            out = list_add(out, &d);
+            list_discard(d.u.list);
+        }
+        efree(keys);
+    }
+
+    if (type != folded_id && list_length(out))
+        qsort(list_elem(out, 0), list_length(out), sizeof(cData),
+              prof_cmp_count);
+
+    return out;
+}
+
+/*
+// ---------------------------------------------------------------
+//
+// Per-method execution counters, kept while config('method_stats) is
+// set.  Records are kept in a table keyed by the definer and method
+// name, so they outlive the method itself being dropped from the cache
+// or recompiled; a method caches a pointer to its record the first time
+// it is called with counting on.  Records are never freed, only reset.
+// Ticks, time and faults are measured from frame_start() to
+// frame_return(), so they include callees.  Work done by other tasks
+// while this one is paused is taken back out in restore_vm(), but wall
+// clock time is not.
+//
+*/
+#define METHOD_STATS_INIT_SIZE 256
+
+static MethodStats ** method_stats_table = NULL;
+static Int            method_stats_size = 0;
+static Int            method_stats_count = 0;
+
+#define METHOD_STATS_HASH(objnum, name) \
+    ((uLong) ((objnum) * 31 + (name)) & (uLong) (method_stats_size - 1))
+
+static MethodStats * method_stats_find(cObjnum objnum, Ident name) {
+    MethodStats * stats;
+
+    if (!method_stats_table)
+        return NULL;
+    stats = method_stats_table[METHOD_STATS_HASH(objnum, name)];
+    for (; stats; stats = stats->next) {
+        if (stats->objnum == objnum && stats->name == name)
+            return stats;
+    }
+    return NULL;
+}
+
+static void method_stats_grow(void) {
+    MethodStats ** old = method_stats_table, * stats, * next;
+    Int            old_size = method_stats_size, x;
+    uLong          h;
+
+    method_stats_size = old_size ? old_size * 2 : METHOD_STATS_INIT_SIZE;
+    method_stats_table = EMALLOC(MethodStats *, method_stats_size);
+    for (x = 0; x < method_stats_size; x++)
+        method_stats_table[x] = NULL;
+    for (x = 0; x < old_size; x++) {
+        for (stats = old[x]; stats; stats = next) {
+            next = stats->next;
+            h = METHOD_STATS_HASH(stats->objnum, stats->name);
+            stats->next = method_stats_table[h];
+            method_stats_table[h] = stats;
+        }
+    }
+    if (old)
+        efree(old);
+}
+
+static void method_stats_start(Frame * frame, Method * method) {
+    MethodStats * stats = method->stats;
+    cObjnum       objnum = method->object->objnum;
+    uLong         h;
+
+    if (!stats)
+        stats = method_stats_find(objnum, method->name);
+    if (!stats) {
+        if (method_stats_count >= method_stats_size)
+            method_stats_grow();
+        stats = EMALLOC(MethodStats, 1);
+        stats->objnum = objnum;
+        stats->name = (method->name != NOT_AN_IDENT) ?
+                      ident_dup(method->name) : NOT_AN_IDENT;
+        stats->calls = stats->ticks = stats->faults = 0;
+        stats->time = stats->max_time = 0;
+        h = METHOD_STATS_HASH(objnum, stats->name);
+        stats->next = method_stats_table[h];
+        method_stats_table[h] = stats;
+        method_stats_count++;
+    }
+    method->stats = stats;
+
+    stats->calls++;
+    frame->stats = stats;
+    frame->stats_tick = tick;
+    frame->stats_faults = cache_faults;
+    frame->stats_time = usec_time();
+}
+
+static void method_stats_end(Frame * frame) {
+    MethodStats * stats = frame->stats;
+    int64_t       elapsed = usec_time() - frame->stats_time;
+
+    stats->ticks += (tick >= frame->stats_tick) ?
+                    tick - frame->stats_tick :
+                    tick + (MAX_NUM - frame->stats_tick) + 1;
+    stats->faults += cache_faults - frame->stats_faults;
+    stats->time += elapsed;
+    if (elapsed > stats->max_time)
+        stats->max_time = elapsed;
+}
+
+void method_stats_reset(void) {
+    MethodStats * stats;
+    Int           x;
+
+    for (x = 0; x < method_stats_size; x++) {
+        for (stats = method_stats_table[x]; stats; stats = stats->next) {
+            stats->calls = stats->ticks = stats->faults = 0;
+            stats->time = stats->max_time = 0;
+        }
+    }
+}
+
+static cList * method_stats_list(MethodStats * stats) {
+    cList * list;
+    cData * d;
+    Int     x;
+
+    list = list_new(5);
+    d = list_empty_spaces(list, 5);
+    for (x = 0; x < 5; x++) {
+        d[x].type = INTEGER;
+        d[x].u.val = 0;
+    }
+    if (stats) {
+        d[0].u.val = stats->calls;
+        d[1].u.val = stats->ticks;
+        d[2].u.val = (Long) stats->time;
+        d[3].u.val = (Long) stats->max_time;
+        d[4].u.val = stats->faults;
+    }
+
+    return list;
+}
+
+/* [calls, ticks, time, max time, faults], times are in microseconds */
+cList * method_stats_info(cObjnum objnum, Ident name) {
+    return method_stats_list(method_stats_find(objnum, name));
+}
+
+static Long method_stats_key(MethodStats * stats, Ident key) {
+    if (key == calls_id)
+        return stats->calls;
+    if (key == time_id)
+        return (Long) stats->time;
+    if (key == faults_id)
+        return stats->faults;
+    return stats->ticks;
+}
+
+/*
+// The <count> methods with the highest <key> ('calls, 'ticks, 'time or
+// 'faults), as [[definer, name, calls, ticks, time, max time, faults], ...]
+*/
+cList * method_stats_top(Int count, Ident key) {
+    MethodStats ** top, * stats;
+    cList        * out, * info;
+    cData          d, * row;
+    Int            n = 0, x, h;
+    Long           val;
+
+    out = list_new(0);
+    if (count <= 0)
+        return out;
+
+    /* keep the best <count> in an insertion-sorted array */
+    top = EMALLOC(MethodStats *, count);
+    for (h = 0; h < method_stats_size; h++) {
+        for (stats = method_stats_table[h]; stats; stats = stats->next) {
+            if (!stats->calls)
+                continue;
+            val = method_stats_key(stats, key);
+            if (n == count && val <= method_stats_key(top[n - 1], key))
+                continue;
+            x = (n < count) ? n++ : n - 1;
+            for (; x > 0 && method_stats_key(top[x - 1], key) < val; x--)
+                top[x] = top[x - 1];
+            top[x] = stats;
+        }
+    }
+
+    for (x = 0; x < n; x++) {
+        info = method_stats_list(top[x]);
+        d.type = LIST;
+        d.u.list = list_new(7);
+        row = list_empty_spaces(d.u.list, 2);
+        row[0].type = OBJNUM;
+        row[0].u.objnum = top[x]->objnum;
+        if (top[x]->name != NOT_AN_IDENT) {
+            row[1].type = SYMBOL;
+            row[1].u.symbol = ident_dup(top[x]->name);
+        } else {
+            row[1].type = INTEGER;
+            row[1].u.val = 0;
+        }
+        d.u.list = list_append(d.u.list, info);
+        list_discard(info);
+        out = list_add(out, &d);
+        list_discard(d.u.list);
+    }
+    efree(top);
+
+    return out;
+}
+
 /*
 // ---------------------------------------------------------------
 //
@@ -695,6 +1436,14 @@ void uninit_execute(void) {
     efree(stack);
     efree(arg_starts);
 
+    if (sched_queue)
+        efree(sched_queue);
+
+    if (prof_samples) {
+        profile_clear();
+        efree(prof_samples);
+    }
+
     while (frame_store) {
         Frame *tmp = frame_store;
         frame_store = frame_store->caller_frame;
@@ -725,6 +1474,13 @@ void vm_task(cObjnum objnum, Long name, Int num_args, ...) {
     /* Set global variables. */
     frame_depth = 0;
     clear_debug();
+    if (name == parse_id || name == connect_id || name == disconnect_id ||
+        name == failed_id)
+        task_class = TASK_CLASS_INTERACTIVE;
+    else if (name == heartbeat_id)
+        task_class = TASK_CLASS_HEARTBEAT;
+    else
+        task_class = TASK_CLASS_BACKGROUND;
 
     va_start(arg, num_args);
     check_stack(num_args);
@@ -850,6 +1606,11 @@ Int frame_start(Obj    * obj,
     frame->handler_info = NULL;
     frame->is_frob=is_frob;
 
+    if (method_stats_flag)
+        method_stats_start(frame, method);
+    else
+        frame->stats = NULL;
+
     /* Set up stack indices. */
     frame->stack_start = stack_start;
     frame->var_start = arg_start;
@@ -938,6 +1699,9 @@ void frame_return(void) {
     }
 #endif
 
+    if (cur_frame->stats)
+        method_stats_end(cur_frame);
+
     /* Free old data on stack. */
     for (i = cur_frame->stack_start; i < stack_pos; i++)
         data_discard(&stack[i]);
@@ -1060,15 +1824,6 @@ void dump_execute_profile(void) {
 
 #endif
 
-/*
-// ---------------------------------------------------------------
-*/
-#ifdef USE_BIG_NUMBERS
-#define MAX_NUM 2147483647
-#else
-#define MAX_NUM 2147483647
-#endif
-
 static void execute(void) {
     Int opcode;
 
@@ -1096,6 +1851,9 @@ static void execute(void) {
             cur_frame->last_opcode = opcode;
             cur_frame->pc++;
 
+            if (profile_countdown && !--profile_countdown)
+                profile_sample();
+
 #ifdef PROFILE_EXECUTE
             update_execute_opcode(opcode);
 #endif
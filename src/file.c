@@ -11,9 +11,20 @@
 
 #include <ctype.h>
 #include <string.h>
+#include <fcntl.h>
+#include <dirent.h>
+#ifdef __UNIX__
+#include <sys/mman.h>
+#include <setjmp.h>
+#include <signal.h>
+#endif
+#ifdef USE_FILE_WORKERS
+#include <pthread.h>
+#endif
 #include "file.h"
 #include "cdc_pcode.h"
 #include "cache.h"
+#include "execute.h"
 #include "util.h"
 
 #define THROWN(_args_) do { \
@@ -29,6 +40,8 @@
 static int object_extra_initialized = 0;
 static int object_extra_file = -1;
 
+static Bool file_job_detach(filec_t * file);
+
 /*
 // --------------------------------------------------------------------
 // The first routines deal with file controllers, and should be system
@@ -42,8 +55,10 @@ filec_t * files = NULL;
 void flush_files(void) {
     filec_t * file;
 
-    for (file = files; file; file = file->next)
-        flush_file(file);
+    for (file = files; file; file = file->next) {
+        if (!file->f.busy)
+            flush_file(file);
+    }
 }
 
 /* called only from coldcc.c:shutdown_coldcc() and genesis.c:main() */
@@ -53,6 +68,8 @@ void close_files(void) {
 
     file = files;
     while (file) {
+        /* we're going down, so don't leave the close to a worker */
+        file_job_wait(file);
         close_file(file);
         old = file;
         file = file->next;
@@ -119,7 +136,14 @@ filec_t * file_new(void) {
     fnew->f.writable = 0;
     fnew->f.closed = 0;
     fnew->f.binary = 0;
+    fnew->f.busy = 0;
+    fnew->f.mapped = 0;
+    fnew->f.truncated = 0;
     fnew->path = NULL;
+    fnew->map = NULL;
+    fnew->map_len = 0;
+    fnew->map_pos = 0;
+    fnew->job = NULL;
     fnew->next = NULL;
 
     return fnew;
@@ -154,6 +178,14 @@ filec_t * find_file_controller(Obj * obj) {
 
 Int close_file(filec_t * file) {
     file->f.closed = 1;
+    if (file->f.busy && file_job_detach(file))
+        return 0;
+#ifdef __UNIX__
+    if (file->map) {
+        munmap(file->map, file->map_len);
+        file->map = NULL;
+    }
+#endif
     if (fclose(file->fp) == EOF)
         return GETERR();
     return 0;
@@ -169,8 +201,103 @@ Int flush_file(filec_t * file) {
     return -1;
 }
 
+/*
+// --------------------------------------------------------------------
+// Mapped files.
+//
+// A file opened with "=" may be truncated while it is mapped, by a
+// copytruncate log rotation for one, and touching the pages past its
+// new end raises SIGBUS.  Every access to a mapping goes through
+// map_memchr() or map_memcpy(), which jump back out of a SIGBUS; the
+// mapping is then dropped and reads from the file throw ~file.
+// --------------------------------------------------------------------
+*/
+
+#ifdef __UNIX__
+static sigjmp_buf            map_jmp;
+static volatile sig_atomic_t map_guarded = 0;
+
+static void catch_SIGBUS(int sig) {
+    if (map_guarded) {
+        map_guarded = 0;
+        siglongjmp(map_jmp, 1);
+    }
+
+    /* not ours, die as we would have */
+    signal(SIGBUS, SIG_DFL);
+    raise(SIGBUS);
+}
+
+static Bool map_sigbus = false;   /* catch_SIGBUS() is installed */
+
+/* after a SIGBUS; sigsetjmp() doesn't save the signal mask, which would
+   cost a system call on every access, so unblock SIGBUS again here */
+static void map_lost(filec_t * file) {
+    sigset_t set;
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGBUS);
+    sigprocmask(SIG_UNBLOCK, &set, NULL);
+
+    munmap(file->map, file->map_len);
+    file->map = NULL;
+    file->map_len = 0;
+    file->f.truncated = 1;
+}
+#endif
+
+static Bool map_memchr(filec_t * file, size_t offset, size_t len,
+                       uChar ** found)
+{
+#ifdef __UNIX__
+    if (sigsetjmp(map_jmp, 0)) {
+        map_lost(file);
+        return false;
+    }
+    map_guarded = 1;
+#endif
+    *found = (uChar *) memchr(file->map + offset, '\n', len);
+#ifdef __UNIX__
+    map_guarded = 0;
+#endif
+    return true;
+}
+
+static Bool map_memcpy(filec_t * file, uChar * dest, size_t offset,
+                       size_t len)
+{
+#ifdef __UNIX__
+    if (sigsetjmp(map_jmp, 0)) {
+        map_lost(file);
+        return false;
+    }
+    map_guarded = 1;
+#endif
+    MEMCPY(dest, file->map + offset, len);
+#ifdef __UNIX__
+    map_guarded = 0;
+#endif
+    return true;
+}
+
 cBuf * read_binary_file(filec_t * file, Int block) {
-    cBuf * buf = buffer_new(block);
+    cBuf * buf;
+
+    if (file->f.mapped) {
+        if (file->f.truncated)
+            THROWN((file_id, "File \"%s\" was truncated while mapped.",
+                    file->path->s));
+        if (file->map_pos >= file->map_len)
+            THROWN((eof_id, "End of file."));
+        if (block > file->map_len - file->map_pos)
+            block = file->map_len - file->map_pos;
+        if (!(buf = file_slice(file, file->map_pos, block)))
+            return NULL;
+        file->map_pos += block;
+        return buf;
+    }
+
+    buf = buffer_new(block);
 
     /* Patch #6 -- Bruce Mitchener */
     if (feof(file->fp)) {
@@ -184,19 +311,50 @@ cBuf * read_binary_file(filec_t * file, Int block) {
     return buf;
 }
 
-/* slower, but we get clean output */
-cStr * read_file(filec_t * file) {
+/* the next line of a mapped file, like fgetstring(); NULL at the end,
+   or if the file was truncated */
+static cStr * map_getline(filec_t * file) {
+    uChar * nl;
+    cStr  * str;
+    Int     len;
+
+    if (file->map_pos >= file->map_len)
+        return NULL;
+
+    len = file->map_len - file->map_pos;
+    if (!map_memchr(file, file->map_pos, len, &nl))
+        return NULL;
+    if (nl)
+        len = nl - (file->map + file->map_pos);
+
+    str = string_new(len);
+    if (!map_memcpy(file, (uChar *) str->s, file->map_pos, len)) {
+        string_discard(str);
+        return NULL;
+    }
+    str->s[len] = '\0';
+    str->len = len;
+    file->map_pos += nl ? len + 1 : len;
+
+    return str;
+}
+
+/* slower, but we get clean output; NULL at the end of the file */
+cStr * file_getline(filec_t * file) {
     register char * p, * s;
     register int len;
     cStr * str;
 
-    if (feof(file->fp))
-        THROWN((eof_id, "End of file."));
-
-    str = fgetstring(file->fp);
+    if (file->f.mapped) {
+        str = map_getline(file);
+    } else if (feof(file->fp)) {
+        str = NULL;
+    } else {
+        str = fgetstring(file->fp);
+    }
 
     if (!str)
-        THROWN((eof_id, "End of file."));
+        return NULL;
 
     /* ok, munch meta-characters */
     p = s = string_chars(str);
@@ -219,6 +377,46 @@ cStr * read_file(filec_t * file) {
     return str;
 }
 
+cStr * read_file(filec_t * file) {
+    cStr * str = file_getline(file);
+
+    if (!str && file->f.truncated)
+        THROWN((file_id, "File \"%s\" was truncated while mapped.",
+                file->path->s));
+    if (!str)
+        THROWN((eof_id, "End of file."));
+
+    return str;
+}
+
+Bool file_eof(filec_t * file) {
+    if (file->f.mapped)
+        return file->map_pos >= file->map_len;
+    return feof(file->fp) ? true : false;
+}
+
+Long file_tell(filec_t * file) {
+    if (file->f.mapped)
+        return (Long) file->map_pos;
+    return (Long) ftell(file->fp);
+}
+
+/* copy len bytes at offset out of a mapped file, without moving the
+   cursor; the range must already be checked.  Throws ~file if the file
+   was truncated under the mapping. */
+cBuf * file_slice(filec_t * file, Long offset, Long len) {
+    cBuf * buf = buffer_new(len);
+
+    if (!map_memcpy(file, buf->s, offset, len)) {
+        buffer_discard(buf);
+        THROWN((file_id, "File \"%s\" was truncated while mapped.",
+                file->path->s));
+    }
+    buf->len = len;
+
+    return buf;
+}
+
 Int abort_file(Obj * object, void * ptr) {
     filec_t * file = ptr ? (filec_t*)ptr : find_file_controller(object);
 
@@ -340,6 +538,12 @@ cList * open_file(cStr * name, cStr * smode, Obj * obj) {
                 mode[0] = 'w';
             }
             fnew->f.writable = 1;
+        } else if (*s == '=' && !rw) {
+            /* read-only, through a memory mapping of the whole file */
+            s++;
+            mode[0] = 'r';
+            fnew->f.readable = 1;
+            fnew->f.mapped = 1;
         } else {
             if (*s == '<' )
                 s++;
@@ -395,9 +599,452 @@ cList * open_file(cStr * name, cStr * smode, Obj * obj) {
         return NULL;
     }
 
+    if (fnew->f.mapped) {
+#ifdef __UNIX__
+        if (fstat(fileno(fnew->fp), &sbuf) == F_FAILURE) {
+            cthrow(file_id, "%s (%s)", strerror(GETERR()), name->s);
+            close_file(fnew);
+            file_discard(fnew, NULL);
+            return NULL;
+        }
+        fnew->map_len = sbuf.st_size;
+        if (fnew->map_len) {
+            fnew->map = mmap(NULL, fnew->map_len, PROT_READ, MAP_PRIVATE,
+                             fileno(fnew->fp), 0);
+            if (fnew->map == MAP_FAILED) {
+                fnew->map = NULL;
+                fnew->map_len = 0;
+                fnew->f.mapped = 0;
+            } else {
+#ifdef MADV_SEQUENTIAL
+                madvise(fnew->map, fnew->map_len, MADV_SEQUENTIAL);
+#endif
+                if (!map_sigbus) {
+                    map_sigbus = true;
+                    signal(SIGBUS, catch_SIGBUS);
+                }
+            }
+        }
+#else
+        /* no mmap(), just read it through stdio */
+        fnew->f.mapped = 0;
+#endif
+    }
+
     file_add(fnew);
     object_extra_register(obj, object_extra_file, fnew);
     fnew->objnum = obj->objnum;
 
     return statbuf_to_list(&sbuf);
 }
+
+/*
+// --------------------------------------------------------------------
+// File workers.
+//
+// Large reads and writes, fstat() and files() may block for a long
+// time on a slow disk or network filesystem.  Rather than stall the
+// whole server, the builtin hands the operation to a pool of worker
+// threads with file_job_start() and suspends the calling task.  The
+// workers touch nothing but the FILE and memory set aside for the job;
+// finished jobs are queued for the main loop, which is woken through a
+// pipe and resumes each task with its result in handle_file_jobs().
+//
+// While a job is outstanding the file is marked busy, and the file
+// builtins refuse to work on it.  close_file() does not wait for the
+// job: the worker closes the FILE once it is done with it, and any
+// error from that fclose() is lost.  Only close_files(), on the way
+// down, blocks in file_job_wait() until the jobs are done.
+// --------------------------------------------------------------------
+*/
+
+#ifdef USE_FILE_WORKERS
+typedef struct file_job_s file_job_t;
+
+struct file_job_s {
+    Int          op;
+    filec_t    * file;      /* NULL once the file has been closed */
+    FILE       * fp;
+    cBuf       * buf;       /* READ: filled in, WRITE: data to write */
+    cStr       * path;      /* STAT, DIR */
+    Bool         newline;   /* WRITE: add a newline after the data */
+    Long         task_id;
+    Int          result;    /* WRITE: bytes not written */
+    Int          error;     /* errno, or -1 if a directory is not one */
+    Bool         close_fp;  /* the file was closed, fclose() when done */
+    Bool         finished;  /* on file_job_done */
+    struct stat  sbuf;
+    char       * names;     /* DIR: entries, each NUL terminated */
+    Int          names_len;
+    file_job_t * next;
+};
+
+static pthread_mutex_t file_job_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  file_job_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t  file_job_finished = PTHREAD_COND_INITIALIZER;
+static file_job_t    * file_job_queue = NULL;
+static file_job_t   ** file_job_tail = &file_job_queue;
+static file_job_t    * file_job_done = NULL;
+static Int             file_workers_running = 0;
+static int             file_job_pipe[2] = { -1, -1 };
+
+/* runs on a worker thread; no interpreter data may be touched here */
+static void file_job_run(file_job_t * job) {
+    DIR           * dp;
+    struct dirent * dent;
+    Int             len;
+    char          * names;
+
+    switch (job->op) {
+      case FILE_JOB_READ:
+        job->buf->len = fread(job->buf->s, sizeof(unsigned char),
+                              job->buf->len, job->fp);
+        break;
+      case FILE_JOB_WRITE:
+        job->result = fwrite(job->buf->s, sizeof(unsigned char),
+                             job->buf->len, job->fp);
+        job->result -= job->buf->len;
+        if (!job->result && job->newline)
+            fputc((char) 10, job->fp);
+        break;
+      case FILE_JOB_STAT:
+        if (stat(job->path->s, &job->sbuf) < 0)
+            job->error = errno;
+        break;
+      case FILE_JOB_DIR:
+        if (stat(job->path->s, &job->sbuf) < 0) {
+            job->error = errno;
+            break;
+        }
+        if (!S_ISDIR(job->sbuf.st_mode)) {
+            job->error = -1;
+            break;
+        }
+        if ((dp = opendir(job->path->s)) == NULL) {
+            job->error = errno;
+            break;
+        }
+        while ((dent = readdir(dp)) != NULL) {
+            if (strncmp(dent->d_name, ".", 1) == F_SUCCESS ||
+                strncmp(dent->d_name, "..", 2) == F_SUCCESS)
+                continue;
+            len = strlen(dent->d_name) + 1;
+            names = realloc(job->names, job->names_len + len);
+            if (!names) {
+                /* no panic() off the main thread, report it instead */
+                job->error = ENOMEM;
+                break;
+            }
+            job->names = names;
+            memcpy(job->names + job->names_len, dent->d_name, len);
+            job->names_len += len;
+        }
+        closedir(dp);
+        break;
+    }
+}
+
+static void * file_worker(void * arg) {
+    file_job_t * job;
+    char         c = 0;
+
+    pthread_mutex_lock(&file_job_lock);
+    for (;;) {
+        while (!file_job_queue)
+            pthread_cond_wait(&file_job_ready, &file_job_lock);
+
+        job = file_job_queue;
+        file_job_queue = job->next;
+        if (!file_job_queue)
+            file_job_tail = &file_job_queue;
+
+        pthread_mutex_unlock(&file_job_lock);
+        file_job_run(job);
+        pthread_mutex_lock(&file_job_lock);
+
+        if (job->close_fp) {
+            /* close_file() handed the file over while the job ran */
+            pthread_mutex_unlock(&file_job_lock);
+            fclose(job->fp);
+            pthread_mutex_lock(&file_job_lock);
+        }
+
+        job->finished = true;
+        job->next = file_job_done;
+        file_job_done = job;
+        pthread_cond_broadcast(&file_job_finished);
+        write(file_job_pipe[1], &c, 1);
+    }
+
+    return NULL;
+}
+
+/* start workers on demand, up to config('file_workers) */
+static Bool file_workers_start(void) {
+    pthread_t thread;
+    Int       i;
+
+    if (file_job_pipe[0] == -1) {
+        if (pipe(file_job_pipe) == -1)
+            return false;
+        for (i = 0; i < 2; i++) {
+            fcntl(file_job_pipe[i], F_SETFL,
+                  fcntl(file_job_pipe[i], F_GETFL) | O_NONBLOCK);
+#ifdef FD_CLOEXEC
+            fcntl(file_job_pipe[i], F_SETFD,
+                  fcntl(file_job_pipe[i], F_GETFD) | FD_CLOEXEC);
+#endif
+        }
+    }
+
+    while (file_workers_running < file_workers) {
+        if (pthread_create(&thread, NULL, file_worker, NULL))
+            break;
+        pthread_detach(thread);
+        file_workers_running++;
+    }
+
+    return file_workers_running > 0;
+}
+#endif
+
+/*
+// --------------------------------------------------------------------
+// Queue op for the file workers on behalf of the current task, which
+// the caller should then vm_suspend_on() the returned job.  For
+// FILE_JOB_READ buf's length is the block to read, and is set to what
+// was read; for FILE_JOB_WRITE buf holds the data.  path is the full
+// path for FILE_JOB_STAT and FILE_JOB_DIR.  Returns NULL if no worker
+// could be started, in which case the caller should do the work itself.
+*/
+void * file_job_start(Int op, filec_t * file, cBuf * buf, cStr * path,
+                      Bool newline)
+{
+#ifdef USE_FILE_WORKERS
+    file_job_t * job;
+
+    if (!file_workers_start())
+        return NULL;
+
+    job = EMALLOC(file_job_t, 1);
+    job->op = op;
+    job->file = file;
+    job->fp = file ? file->fp : NULL;
+    job->buf = buf ? buffer_dup(buf) : NULL;
+    job->path = path ? string_dup(path) : NULL;
+    job->newline = newline;
+    job->task_id = task_id;
+    job->result = 0;
+    job->error = 0;
+    job->close_fp = false;
+    job->finished = false;
+    job->names = NULL;
+    job->names_len = 0;
+    job->next = NULL;
+
+    if (file) {
+        file->f.busy = 1;
+        file->job = job;
+    }
+
+    pthread_mutex_lock(&file_job_lock);
+    *file_job_tail = job;
+    file_job_tail = &job->next;
+    pthread_cond_signal(&file_job_ready);
+    pthread_mutex_unlock(&file_job_lock);
+
+    return job;
+#else
+    return NULL;
+#endif
+}
+
+/*
+// --------------------------------------------------------------------
+// Wait for the job using file to finish, and detach it from the file.
+*/
+void file_job_wait(filec_t * file) {
+#ifdef USE_FILE_WORKERS
+    file_job_t * job;
+
+    if (!file->f.busy)
+        return;
+
+    pthread_mutex_lock(&file_job_lock);
+    for (;;) {
+        for (job = file_job_done; job && job->file != file; job = job->next);
+        if (job)
+            break;
+        pthread_cond_wait(&file_job_finished, &file_job_lock);
+    }
+    job->file = NULL;
+    pthread_mutex_unlock(&file_job_lock);
+
+    file->f.busy = 0;
+    file->job = NULL;
+#endif
+}
+
+/*
+// --------------------------------------------------------------------
+// close_file() on a busy file: detach its job, and if the job is still
+// queued or running, leave closing the FILE to the worker.  Returns
+// true if the worker will close it, false if the job is already done
+// and the caller should.
+*/
+static Bool file_job_detach(filec_t * file) {
+#ifdef USE_FILE_WORKERS
+    file_job_t * job = (file_job_t *) file->job;
+    Bool         handed;
+
+    pthread_mutex_lock(&file_job_lock);
+    job->file = NULL;
+    handed = !job->finished;
+    if (handed)
+        job->close_fp = true;
+    pthread_mutex_unlock(&file_job_lock);
+
+    file->f.busy = 0;
+    file->job = NULL;
+    return handed;
+#else
+    return false;
+#endif
+}
+
+/*
+// --------------------------------------------------------------------
+// The descriptor io_event_wait() should watch for finished jobs, or -1.
+*/
+Int file_jobs_fd(void) {
+#ifdef USE_FILE_WORKERS
+    return file_job_pipe[0];
+#else
+    return -1;
+#endif
+}
+
+#ifdef USE_FILE_WORKERS
+/*
+// --------------------------------------------------------------------
+// Resume the task behind a finished job with its result, or with the
+// error the builtin would have thrown.
+*/
+static void file_job_finish(file_job_t * job) {
+    cData   d;
+    cList * list;
+    cStr  * str;
+    char  * s, * end;
+
+    /* the task may have been cancelled or resumed by hand, and be
+       running or suspended on something else by now */
+    if (!vm_waiting(job->task_id, job))
+        goto done;
+
+    switch (job->op) {
+      case FILE_JOB_READ:
+        d.type = BUFFER;
+        d.u.buffer = job->buf;
+        vm_resume(job->task_id, &d);
+        break;
+      case FILE_JOB_WRITE:
+        d.type = INTEGER;
+        d.u.val = job->result;
+        vm_resume(job->task_id, &d);
+        break;
+      case FILE_JOB_STAT:
+        if (job->error) {
+            str = format("Cannot find file \"%s\".", job->path->s);
+            vm_resume_error(job->task_id, file_id, str);
+            string_discard(str);
+            break;
+        }
+        d.type = LIST;
+        d.u.list = statbuf_to_list(&job->sbuf);
+        vm_resume(job->task_id, &d);
+        list_discard(d.u.list);
+        break;
+      case FILE_JOB_DIR:
+        if (job->error) {
+            if (job->error == -1)
+                str = format("File \"%s\" is not a directory.",
+                             job->path->s);
+            else if (job->error == ENOENT)
+                str = format("Unable to find directory \"%s\".",
+                             job->path->s);
+            else if (job->error == ENOMEM)
+                str = format("Out of memory reading directory \"%s\".",
+                             job->path->s);
+            else
+                str = format("opendir(%s): %s", job->path->s,
+                             strerror(job->error));
+            vm_resume_error(job->task_id, directory_id, str);
+            string_discard(str);
+            break;
+        }
+        list = list_new(0);
+        d.type = STRING;
+        end = job->names + job->names_len;
+        for (s = job->names; s < end; s += strlen(s) + 1) {
+            d.u.str = string_from_chars(s, strlen(s));
+            list = list_add(list, &d);
+            string_discard(d.u.str);
+        }
+        d.type = LIST;
+        d.u.list = list;
+        vm_resume(job->task_id, &d);
+        list_discard(list);
+        break;
+    }
+
+  done:
+    if (job->buf)
+        buffer_discard(job->buf);
+    if (job->path)
+        string_discard(job->path);
+    if (job->names)
+        free(job->names);
+    efree(job);
+}
+#endif
+
+/*
+// --------------------------------------------------------------------
+// Called from the main loop: hand finished jobs back to their tasks,
+// in the order they finished.
+*/
+void handle_file_jobs(void) {
+#ifdef USE_FILE_WORKERS
+    file_job_t * done, * job, * next;
+    char         junk[64];
+
+    if (file_job_pipe[0] == -1)
+        return;
+
+    while (read(file_job_pipe[0], junk, sizeof(junk)) > 0);
+
+    pthread_mutex_lock(&file_job_lock);
+    done = file_job_done;
+    file_job_done = NULL;
+    pthread_mutex_unlock(&file_job_lock);
+
+    /* Reverse, the done list is newest first.  Free the files before
+     * resuming anything, as a resumed task may close any of them. */
+    for (job = NULL; done; done = next) {
+        next = done->next;
+        if (done->file) {
+            done->file->f.busy = 0;
+            done->file->job = NULL;
+            done->file = NULL;
+        }
+        done->next = job;
+        job = done;
+    }
+
+    while (job) {
+        next = job->next;
+        file_job_finish(job);
+        job = next;
+    }
+#endif
+}
@@ -30,6 +30,7 @@ extern pthread_t cleaner;
 #include "file.h"
 #include "net.h"
 #include "sig.h"
+#include "metrics.h"
 
 #ifdef __MSVC__
 #include <direct.h>
@@ -559,6 +560,9 @@ static void initialize(Int argc, char **argv) {
 static void main_loop(void) {
     register Int     seconds;
     register time_t  next, last;
+    int64_t          start, now, wake;
+    Long             tasks;
+    Int              dump, compact;
 
 #ifdef __Win32__
     time_t           tm;
@@ -580,6 +584,7 @@ static void main_loop(void) {
     next = last = 0;
 
     while (running) {
+        tasks = next_task_id;
         flush_defunct();
 
 #ifdef DRIVER_DEBUG
@@ -601,7 +606,8 @@ static void main_loop(void) {
         }
 
         /* push our dump along, diddle with the wait if we need to */
-        switch (simble_dump_some_blocks(DUMP_BLOCK_SIZE)) {
+        start = usec_time();
+        switch (dump = simble_dump_some_blocks(DUMP_BLOCK_SIZE)) {
             case DUMP_FINISHED:
                 simble_dump_finish();
                 vm_task(SYSTEM_OBJNUM, backup_done_id, 0);
@@ -611,9 +617,39 @@ static void main_loop(void) {
                 break;
         }
 
-        handle_io_event_wait(seconds);
+        /* likewise compaction, which waits for any dump to finish */
+        switch (compact = simble_compact_some_blocks(COMPACT_BLOCK_SIZE)) {
+            case COMPACT_FINISHED:
+                vm_task(SYSTEM_OBJNUM, compact_done_id, 0);
+                break;
+            case COMPACT_MOVED_BLOCKS:
+                seconds = 0;
+                break;
+        }
+        now = usec_time();
+        if (dump != DUMP_NOT_IN_PROGRESS ||
+            compact != COMPACT_NOT_IN_PROGRESS)
+            metrics_phase(PHASE_DUMP, start, now);
+
+        seconds = handle_io_event_wait(seconds);
+        start = usec_time();
+
+        /* we meant to wake after the wait io_event_wait() was actually
+           given, or at once for an overdue heartbeat, in which case any
+           lag is counted from when it was due */
+        wake = (seconds < 0) ? start : now + (int64_t) seconds * 1000000;
+        if (heartbeat_freq != -1 && last && (int64_t) next * 1000000 < now)
+            wake = (int64_t) next * 1000000;
+
+        metrics_phase(PHASE_IO_WAIT, now, start);
+        metrics_phase(PHASE_LAG, wake, start);
+
         handle_connection_input();
         handle_new_and_pending_connections();
+        handle_process_events();
+        handle_file_jobs();
+        now = usec_time();
+        metrics_phase(PHASE_INPUT, start, now);
 
         if (heartbeat_freq != -1) {
             GETTIME();
@@ -623,12 +659,25 @@ static void main_loop(void) {
 #ifdef CLEAN_CACHE
                 cache_cleanup();
 #endif
+                start = now;
+                now = usec_time();
+                metrics_phase(PHASE_HEARTBEAT, start, now);
             }
         }
 
         handle_connection_output();
-        if (preempted)
+        start = now;
+        now = usec_time();
+        metrics_phase(PHASE_OUTPUT, start, now);
+
+        if (preempted) {
             run_paused_tasks();
+            start = now;
+            now = usec_time();
+            metrics_phase(PHASE_PAUSED, start, now);
+        }
+
+        metrics_iteration(next_task_id - tasks, now);
     }
 }
 
@@ -156,7 +156,10 @@ extern Pile *compiler_pile;        /* We free this pile after compilation. */
 %token F_ATOMIC F_METHOD_INFO F_ENCODE F_DECODE F_SIN F_EXP F_LOG F_COS
 %token F_TAN F_SQRT F_ASIN F_ACOS F_ATAN F_POW F_ATAN2 F_CONFIG F_ROUND
 %token F_ANTICIPATE_ASSIGNMENT OP_HANDLED_FROB F_FROB_VALUE F_FROB_HANDLER F_SYNC F_CALLING_METHOD
-%token F_EXPLODE_QUOTED F_HAS_METHOD
+%token F_EXPLODE_QUOTED F_HAS_METHOD F_TASK_STATS F_PROFILE F_PROFILE_REPORT
+%token F_METHOD_STATS F_METHOD_STATS_RESET F_METHOD_STATS_TOP F_SPAWN
+%token F_FREADLINES F_FSLICE F_FTELL F_COMPACT F_NET_STATS F_SET_FRAMING
+%token F_CWRITETO F_DRIVER_METRICS
 
 /* Reserved for future use. */
 /*%token FORK*/
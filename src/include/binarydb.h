@@ -19,6 +19,17 @@
 #define DUMP_FINISHED        1
 #define DUMP_DUMPED_BLOCKS   0
 
+#define COMPACT_BLOCK_SIZE      256
+#define COMPACT_IN_PROGRESS     -3
+#define COMPACT_NOT_IN_PROGRESS -2
+#define COMPACT_WAITING         -1
+#define COMPACT_FINISHED        1
+#define COMPACT_MOVED_BLOCKS    0
+
+/* change journal entries, see simble_journal_read() */
+#define JOURNAL_CHANGED      1
+#define JOURNAL_DESTROYED    2
+
 void   init_binary_db(void);
 void   init_new_db(void);
 void   init_core_objects(void);
@@ -28,7 +39,15 @@ Int    simble_check(cObjnum objnum);
 Int    simble_del(cObjnum objnum);
 void   simble_close(void);
 void   simble_flush(void);
+void   simble_detach(void);
+void   simble_attach(Bool readonly);
+Long   simble_journal_read(char **kinds);
+void   simble_journal_checkpoint(void);
 Float  simble_fragmentation(void);
+Int    simble_compact_start(void);
+Int    simble_compact_some_blocks(Int maxblocks);
+cList * simble_compress_info(void);
+void   simble_compress_reset(void);
 Int    simble_dump_start(char *dump_objects_filename);
 Int    simble_dump_some_blocks (Int maxblocks);
 void   simble_dump_finish(void);
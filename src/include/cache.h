@@ -32,6 +32,15 @@ void cache_sanity_check(void);
 void cache_cleanup(void);
 #endif
 cList * cache_info(int level);
+cList * cache_stats_info(void);
+void cache_stats_reset(void);
+
+/* number of buckets in the cache_stats() read and write latency
+   histograms, the last is for anything 2^(n-2) microseconds or slower */
+#define CACHE_LATENCY_BUCKETS 20
+
+/* number of times cache_retrieve() has gone to disk */
+extern Long cache_faults;
 
 #endif
 
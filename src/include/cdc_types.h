@@ -21,6 +21,7 @@ typedef        Long       Ident;
 typedef        Long       cObjnum;
 typedef struct Obj        Obj;
 typedef struct Method     Method;
+typedef struct MethodStats MethodStats;
 
 typedef struct ident_entry  Ident_entry;
 typedef struct string_entry String_entry;
@@ -19,6 +19,8 @@
 #cmakedefine SYSTEM_TYPE "@SYSTEM_TYPE@"
 
 #cmakedefine HAVE_UNISTD_H
+#cmakedefine HAVE_SYS_EPOLL_H
+#cmakedefine HAVE_SYS_SENDFILE_H
 
 #cmakedefine DBM_H_FILE @DBM_H_FILE@
 
@@ -32,15 +34,21 @@
 #cmakedefine HAVE_STRCSPN
 #cmakedefine HAVE_STRERROR
 #cmakedefine HAVE_STRFTIME
+#cmakedefine HAVE_ACCEPT4
+#cmakedefine HAVE_RECVMMSG
+#cmakedefine HAVE_SENDMMSG
 
 #cmakedefine __UNIX__
 #cmakedefine __Win32__
 
 #cmakedefine USE_CLEANER_THREAD
+#cmakedefine USE_FILE_WORKERS
+#cmakedefine USE_COMPRESSION
 #cmakedefine DEBUG_DB_LOCK
 #cmakedefine DEBUG_LOOKUP_LOCK
 #cmakedefine DEBUG_BUCKET_LOCK
 #cmakedefine DEBUG_CLEANER_LOCK
+#cmakedefine DEBUG_OBJECT_LOCK
 
 #cmakedefine USE_PARENT_OBJS
 
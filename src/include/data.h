@@ -23,6 +23,8 @@ cStr  * data_to_literal(cData * data, int flags);
 cStr  * data_add_list_literal_to_str(cStr * str, cList * list, int flags);
 cStr  * data_add_literal_to_str(cStr * str, cData * data, int flags);
 Long    data_type_id(Int type);
+Bool    data_type_handler(Int type, cObjnum * objnum);
+void    data_type_handlers_reset(void);
 void    init_instances(void);
 
 #define DF_NO_OPTS              0
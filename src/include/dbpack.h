@@ -7,12 +7,14 @@
 
 cBuf * pack_object (cBuf * buf, Obj * obj);
 cBuf * pack_data   (cBuf * buf, cData * data);
+cBuf * pack_methods(cBuf * buf, Obj * obj);
 cBuf * write_ident (cBuf * buf, Ident id);
 cBuf * write_long  (cBuf * buf, Long n);
 cBuf * write_float (cBuf * buf, Float f);
 
 void  unpack_object (cBuf * buf, Long * buf_pos, Obj * obj);
 void  unpack_data   (cBuf * buf, Long * buf_pos, cData * data);
+void  unpack_methods(cBuf * buf, Long * buf_pos, Obj * obj);
 Ident read_ident    (cBuf * buf, Long * buf_pos);
 Long  read_long     (cBuf * buf, Long * buf_pos);
 Float read_float    (cBuf * buf, Long * buf_pos);
@@ -34,6 +34,7 @@
 
 #ifdef BUILDING_COLDCC
 #undef USE_CLEANER_THREAD
+#undef USE_FILE_WORKERS
 #undef USE_DIRTY_LIST
 #undef USE_CACHE_HISTORY
 #else
@@ -135,6 +136,72 @@
 */
 #define PAUSED_METHOD_TICKS        5000
 
+/*
+// ---------------------------------------------------------------------
+// How much work run_paused_tasks() may do in a single pass of the main
+// loop before going back to service I/O.  The tick budget is a total of
+// ticks across all preempted tasks run in that pass, the time budget is
+// in microseconds.  At least one task is always run.  Both can be
+// changed at runtime with config('sched_ticks) and config('sched_time),
+// setting either to 0 disables that limit.
+*/
+#define SCHED_TICK_BUDGET          200000
+#define SCHED_TIME_BUDGET          50000
+
+/*
+// ---------------------------------------------------------------------
+// A preempted task which has been passed over this many times in a row
+// is run ahead of every other priority class, so background work cannot
+// be starved by a steady stream of interactive tasks.
+*/
+#define SCHED_STARVATION_LIMIT     8
+
+/*
+// ---------------------------------------------------------------------
+// File workers, see file.c.  Binary fread()s and fwrite()s of at least
+// FILE_ASYNC_THRESHOLD bytes, fstat() and files() are run on one of up
+// to FILE_WORKERS threads while the calling task is suspended; smaller
+// reads and writes, and anything in an atomic task, are done directly.
+// Change with config('file_workers) and config('file_async_threshold),
+// 0 workers keeps all file I/O synchronous.
+*/
+#define FILE_WORKERS               2
+#define FILE_ASYNC_THRESHOLD       65536
+
+/*
+// ---------------------------------------------------------------------
+// Object images in the binary db which pack to at least this many bytes
+// are stored deflated when the result saves at least one block; smaller
+// objects are written raw.  Change with config('compress_threshold),
+// 0 stores everything raw.  Only used when built with USE_COMPRESSION.
+*/
+#define COMPRESS_THRESHOLD         1024
+
+/*
+// ---------------------------------------------------------------------
+// Connections accepted from one listening socket each time through the
+// main loop; the rest of a burst waits in the kernel's backlog for the
+// next pass.  Change with config('accept_budget).
+*/
+#define ACCEPT_BUDGET              64
+
+/*
+// ---------------------------------------------------------------------
+// Seconds between the main loop timing summaries written to the error
+// log, see driver_metrics().  Change with config('metrics_log), 0 never
+// writes them.
+*/
+#define METRICS_LOG                0
+
+/*
+// ---------------------------------------------------------------------
+// Sampling profiler, see profile() and profile_report().  The ring
+// buffer holds this many samples, each recording at most PROFILE_DEPTH
+// frames of the ColdC stack (the frames nearest the top are kept).
+*/
+#define PROFILE_SAMPLES            4096
+#define PROFILE_DEPTH              32
+
 /*
 // ---------------------------------------------------------------------
 // How much of a threshold refresh() should decide to pause on
@@ -149,13 +216,15 @@
 
 /*
 // ---------------------------------------------------------------------
-// size of name cache, this number is total magic--although primes make
-// for better magic, lower for less memory usage but more lookups to
-// disk; raise for vise-versa, other primes:
+// size of name cache, in sets of NAME_CACHE_WAYS names each.  This
+// number is total magic--although primes make for better magic, lower
+// for less memory usage but more lookups to disk; raise for vise-versa,
+// other primes:
 //
 //     71, 173, 281, 409, 541, 659, 809
 */
-#define NAME_CACHE_SIZE 25601
+#define NAME_CACHE_SIZE 6421
+#define NAME_CACHE_WAYS 4
 
 /*
 // ---------------------------------------------------------------------
@@ -164,6 +233,15 @@
 */
 #define METHOD_CACHE_SIZE 1000003
 
+/*
+// ---------------------------------------------------------------------
+// method cache entries are validated against version stamps kept per
+// method name and per object, hashed into tables of this size.  Editing
+// a method only bumps the stamp for its name; a collision just means an
+// unrelated name or object loses its entries too.
+*/
+#define METHOD_CACHE_STAMPS 65536
+
 /*
 // ---------------------------------------------------------------------
 // size of ancestor cache. use prime numbers and follow guidelines as
@@ -365,6 +443,14 @@ extern Int  cache_watch_count;
 extern cObjnum cache_watch_object;
 extern Int  log_malloc_size;
 extern Int  log_method_cache;
+extern Int  sched_tick_budget;
+extern Int  sched_time_budget;
+extern Int  method_stats_flag;
+extern Int  file_workers;
+extern Int  file_async_threshold;
+extern Int  compress_threshold;
+extern Int  accept_budget;
+extern Int  metrics_log;
 
 #ifdef USE_CACHE_HISTORY
 /* cache stats stuff */
@@ -375,6 +461,7 @@ extern Int cache_history_size;
 
 extern Int name_cache_hits;
 extern Int name_cache_misses;
+extern Int name_cache_negative;
 
 #endif
 
@@ -40,6 +40,13 @@ struct vmstate {
     Int       task_id;
     Int       frame_depth;
     Int       preempted;
+    Int       task_class;       /* TASK_CLASS_*, for run_paused_tasks() */
+    Int       sched_deferred;   /* passes skipped since it was preempted */
+    int64_t   paused_at;        /* usec_time() when it was preempted */
+    Long      saved_tick;       /* tick and cache_faults when saved, */
+    Long      saved_faults;     /* for method stats */
+    void    * waiter;           /* what a suspended task waits on, see
+                                   vm_suspend_on() */
 #ifdef DRIVER_DEBUG
     cData     debug;
 #endif
@@ -75,6 +82,12 @@ struct frame {
     Error_action_specifier *specifiers;
     Handler_info *handler_info;
     Frame *caller_frame;
+
+    /* set when the method is being counted, see method_stats_start() */
+    MethodStats *stats;
+    Long stats_tick;
+    Long stats_faults;
+    int64_t stats_time;
 };
 
 struct error_action_specifier {
@@ -133,6 +146,12 @@ struct handler_info {
 #define MF_UNDF3     64   /* undefined */
 #define MF_UNDF4     128  /* undefined */
 
+/* scheduling classes of preempted tasks, in order of priority */
+#define TASK_CLASS_INTERACTIVE  0    /* started by connection activity */
+#define TASK_CLASS_HEARTBEAT    1    /* started by $sys.heartbeat() */
+#define TASK_CLASS_BACKGROUND   2    /* forks and everything else */
+#define TASK_CLASSES            3
+
 /* define these separately, so we can switch the result of 'call_method' */
 #define    CALL_OK       0
 #define    CALL_NATIVE   1
@@ -155,6 +174,9 @@ extern Int stack_pos, stack_size;
 extern Int *arg_starts, arg_pos, arg_size;
 extern cStr *numargs_str;
 extern Long task_id;
+extern Long next_task_id;
+extern Int task_class;
+extern Long profile_countdown;
 extern Long call_environ;
 extern Long tick;
 extern VMState * preempted;
@@ -235,8 +257,11 @@ void pop_handler_info(void);
 cList *generate_traceback(Traceback_info *traceback);
 
 void      vm_suspend(void);
+void      vm_suspend_on(void * waiter);
+Bool      vm_waiting(Long tid, void * waiter);
 cList   * vm_info(Long tid);
 void      vm_resume(Long tid, cData *ret);
+void      vm_resume_error(Long tid, Ident error, cStr *explanation);
 void      vm_cancel(Long tid);
 void      vm_pause(void);
 VMState * vm_lookup(Long tid);
@@ -245,6 +270,14 @@ cList   * vm_stack(Frame * frame_to_trace, Bool calculate_line_numbers);
 void      log_task_stack(Long taskid, cList * stack,
                          void (logroutine)(char*,...));
 void      run_paused_tasks(void);
+cList   * vm_sched_stats(void);
+void      profile_sample(void);
+Int       profile_set(Long interval);
+Int       profile_samples(void);
+cList   * profile_report(Ident type);
+void      method_stats_reset(void);
+cList   * method_stats_info(cObjnum objnum, Ident name);
+cList   * method_stats_top(Int count, Ident key);
 void      bind_opcode(Int opcode, cObjnum objnum);
 VMState * vm_current(void);
 
@@ -18,14 +18,32 @@ struct filec_s {
     cObjnum   objnum;
     filec_t  * next;
     cStr * path;
+    uChar    * map;       /* the file's contents, when mapped */
+    size_t     map_len;
+    size_t     map_pos;   /* read cursor into map */
+    void     * job;       /* the file worker job using fp, while busy */
     struct {
         unsigned int readable : 1;
         unsigned int writable : 1;
         unsigned int closed   : 1;
         unsigned int binary   : 1; /* use fread instead of fgetstr */
+        unsigned int busy     : 1; /* a file worker is using fp */
+        unsigned int mapped   : 1; /* read from map instead of fp */
+        unsigned int truncated: 1; /* the mapped file shrank under us */
     } f;
 };
 
+/* operations which can be handed to the file workers */
+#define FILE_JOB_READ   1
+#define FILE_JOB_WRITE  2
+#define FILE_JOB_STAT   3
+#define FILE_JOB_DIR    4
+
+/* can the current task hand work to the file workers, and should a
+   read or write of len bytes be handed over? */
+#define FILE_WORKERS_OK    (file_workers > 0 && !atomic)
+#define FILE_ASYNC(_len_)  (FILE_WORKERS_OK && (_len_) >= file_async_threshold)
+
 void file_discard(filec_t * file, Obj * obj);
 filec_t * file_new(void);
 void file_add(filec_t * file);
@@ -33,7 +51,11 @@ filec_t * find_file_controller(Obj * obj);
 Int close_file(filec_t * file);
 Int flush_file(filec_t * file);
 cBuf * read_binary_file(filec_t * file, Int block);
+cStr * file_getline(filec_t * file);
 cStr * read_file(filec_t * file);
+Bool file_eof(filec_t * file);
+Long file_tell(filec_t * file);
+cBuf * file_slice(filec_t * file, Long offset, Long len);
 Int abort_file(Obj * object, void * ptr);
 Int stat_file(filec_t * file, struct stat * sbuf);
 cStr * build_path(char * fname, struct stat * sbuf, Int nodir);
@@ -41,6 +63,11 @@ cList * statbuf_to_list(struct stat * sbuf);
 cList * open_file(cStr * name, cStr * smode, Obj * obj);
 void flush_files(void);
 void close_files(void);
+void * file_job_start(Int op, filec_t * file, cBuf * buf, cStr * path,
+                      Bool newline);
+void file_job_wait(filec_t * file);
+Int  file_jobs_fd(void);
+void handle_file_jobs(void);
 
 #endif
 
@@ -58,9 +58,13 @@ COLDC_FUNC(frename);
 COLDC_FUNC(fflush);
 COLDC_FUNC(feof);
 COLDC_FUNC(fread);
+COLDC_FUNC(freadlines);
 COLDC_FUNC(fwrite);
 COLDC_FUNC(fstat);
+COLDC_FUNC(fslice);
+COLDC_FUNC(ftell);
 COLDC_FUNC(execute);
+COLDC_FUNC(spawn);
 COLDC_FUNC(listlen);
 COLDC_FUNC(listgraft);
 COLDC_FUNC(sublist);
@@ -92,7 +96,10 @@ COLDC_FUNC(open_connection);
 COLDC_FUNC(close_connection);
 COLDC_FUNC(cwrite);
 COLDC_FUNC(cwritef);
+COLDC_FUNC(cwriteto);
 COLDC_FUNC(connection);
+COLDC_FUNC(net_stats);
+COLDC_FUNC(set_framing);
 COLDC_FUNC(add_var);
 COLDC_FUNC(del_var);
 COLDC_FUNC(variables);
@@ -151,11 +158,13 @@ COLDC_FUNC(strcmp);
 COLDC_FUNC(strfmt);
 COLDC_FUNC(dblog);
 COLDC_FUNC(backup);
+COLDC_FUNC(compact);
 COLDC_FUNC(sync);
 COLDC_FUNC(shutdown);
 COLDC_FUNC(set_heartbeat);
 COLDC_FUNC(cache_info);
 COLDC_FUNC(cache_stats);
+COLDC_FUNC(driver_metrics);
 COLDC_FUNC(cancel);
 COLDC_FUNC(suspend);
 COLDC_FUNC(resume);
@@ -163,6 +172,12 @@ COLDC_FUNC(pause);
 COLDC_FUNC(atomic);
 COLDC_FUNC(refresh);
 COLDC_FUNC(tasks);
+COLDC_FUNC(task_stats);
+COLDC_FUNC(profile);
+COLDC_FUNC(profile_report);
+COLDC_FUNC(method_stats);
+COLDC_FUNC(method_stats_reset);
+COLDC_FUNC(method_stats_top);
 COLDC_FUNC(tick);
 COLDC_FUNC(stack);
 COLDC_FUNC(calling_method);
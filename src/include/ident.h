@@ -19,7 +19,7 @@ extern Ident servnf_id, varexists_id, dictionary_id, keynf_id, address_id;
 extern Ident refused_id, net_id, timeout_id, other_id, failed_id;
 extern Ident heartbeat_id, regexp_id, buffer_id, object_id, namenf_id, salt_id;
 extern Ident function_id, opcode_id, method_id, interpreter_id;
-extern Ident directory_id, eof_id, backup_done_id;
+extern Ident directory_id, eof_id, backup_done_id, compact_done_id;
 
 extern Ident public_id, protected_id, private_id, root_id, driver_id;
 extern Ident noover_id, sync_id, locked_id, native_id, forked_id, atomic_id;
@@ -34,9 +34,31 @@ extern Ident datasize_id, forkdepth_id, calldepth_id, recursion_id, objswap_id;
 /* driver config idents */
 extern Ident cachelog_id, cachewatch_id, cachewatchcount_id, cleanerwait_id, cleanerignore_id;
 extern Ident log_malloc_size_id, log_method_cache_id, cache_history_size_id;
+extern Ident sched_ticks_id, sched_time_id, method_stats_id;
+extern Ident file_workers_id, file_async_threshold_id, compress_threshold_id,
+      accept_budget_id, metrics_log_id;
+
+/* task scheduler classes */
+extern Ident interactive_id, background_id;
+
+/* profile_report() formats */
+extern Ident folded_id, lines_id, methods_id;
+
+/* method_stats_top() keys */
+extern Ident calls_id, time_id, faults_id;
+
+/* spawn() stream events */
+extern Ident stdout_id, stderr_id, exit_id;
+
+/* set_framing() modes */
+extern Ident raw_id, line_id, length_id, datagram_id;
+
+/* driver_metrics() phases */
+extern Ident io_wait_id, input_id, output_id, paused_id, dump_id, lag_id;
 
 /* cache stats options */
-extern Ident ancestor_cache_id, method_cache_id, name_cache_id, object_cache_id;
+extern Ident ancestor_cache_id, method_cache_id, name_cache_id, object_cache_id,
+      compression_id;
 
 /* method id's */
 extern Ident signal_id;
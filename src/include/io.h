@@ -7,10 +7,35 @@
 
 typedef struct Conn Conn;
 typedef struct server_s     server_t;
+typedef struct accepted_s   accepted_t;
+typedef struct conn_queue_s conn_queue_t;
+typedef struct conn_set_s   conn_set_t;
+typedef struct conn_file_s  conn_file_t;
+typedef struct conn_dgram_s conn_dgram_t;
 typedef struct pending_s    pending_t;
+typedef struct process_s    process_t;
 
 #include "net.h"
 
+/* How input is handed to a connection's parse method, see set_framing().
+ * In the framed modes the driver holds partial frames, and parse gets a
+ * list of the complete ones from each read. */
+#define FRAME_RAW          0    /* each read as a buffer */
+#define FRAME_LINE         1    /* lines, as strings */
+#define FRAME_LENGTH       2    /* length-prefixed frames, as buffers */
+#define FRAME_DATAGRAM     3    /* datagrams with their senders */
+
+#define FRAME_LINE_MAX     4096
+#define FRAME_LENGTH_MAX   1048576
+#define FRAME_DATAGRAM_MAX 256  /* datagrams handed to one parse */
+
+/* file ranges queued by cwritef() across all connections; each holds a
+   descriptor open until it is sent */
+#define CONN_FILES_MAX     256
+
+/* datagrams cwriteto() may have waiting on one connection */
+#define CONN_DGRAMS_MAX    4096
+
 struct Conn {
     SOCKET fd;                /* File descriptor for input and output. */
     cBuf * write_buf;     /* Buffer for network output. */
@@ -20,7 +45,69 @@ struct Conn {
         char writable;        /* Connection can be written to. */
         char dead;            /* Connection is defunct. */
     } flags;
-    Conn * next;
+    Int    frame_mode;        /* FRAME_RAW, FRAME_LINE, ... */
+    Int    frame_max;         /* longest line or frame, or datagrams */
+    Int    frame_width;       /* bytes in a length prefix */
+    cBuf * frame_buf;         /* input not yet making a whole frame */
+    conn_file_t * files;      /* File ranges to send after write_buf. */
+    conn_file_t * files_last;
+    conn_dgram_t * dgrams;    /* Datagrams queued by cwriteto(). */
+    conn_dgram_t * dgrams_last;
+    Int    ndgrams;           /* on the queue, see CONN_DGRAMS_MAX */
+    Int    output_slot;       /* Place on the output queue, or -1. */
+    Int    events;            /* What the event backend is watching for. */
+    Conn * hash_next;         /* Next connection in the objnum hash. */
+};
+
+/* A range of a file queued by cwritef(), sent straight from the file once
+ * write_buf has gone out.  Output told after it was queued waits in
+ * after, which becomes the write buffer when the range is done. */
+struct conn_file_s {
+    int           fd;
+    off_t         offset;
+    off_t         len;            /* bytes left to send */
+    cBuf        * after;
+    conn_file_t * next;
+};
+
+/* A datagram queued by cwriteto() on a datagram socket, for addr (in
+ * network byte order) and port. */
+struct conn_dgram_s {
+    cBuf         * buf;
+    unsigned long  addr;
+    unsigned short port;
+    conn_dgram_t * next;
+};
+
+struct conn_queue_s {
+    Conn ** conns;
+    Int     len;
+    Int     size;
+};
+
+/*
+// Every connection by descriptor, with queues of the ones needing
+// attention (see io.c).  io_event_wait() watches live connections for
+// input and those on the output queue for room to write, and puts each
+// one with an event on the readable or writable queue, so the main loop
+// only ever looks at connections which have something to do.
+*/
+struct conn_set_s {
+    Conn       ** by_fd;
+    Int           size;           /* slots in by_fd */
+    Int           max_fd;         /* highest descriptor in use, or -1 */
+    conn_queue_t  readable;
+    conn_queue_t  writable;
+    conn_queue_t  output;         /* connections with buffered output */
+    conn_queue_t  dead;           /* waiting for flush_defunct() */
+};
+
+/* a client accepted by io_event_wait(), waiting for its connect task */
+struct accepted_s {
+    SOCKET         fd;
+    char           addr[20];
+    unsigned short port;
+    accepted_t   * next;
 };
 
 struct server_s {
@@ -29,9 +116,8 @@ struct server_s {
     cStr         * addr;
     cObjnum        objnum;
     Int            dead;
-    SOCKET         client_socket;
-    char           client_addr[20];
-    unsigned short client_port;
+    accepted_t   * accepted;      /* in the order they were accepted */
+    accepted_t  ** accepted_tail;
     server_t     * next;
 };
 
@@ -44,13 +130,47 @@ struct pending_s {
     pending_t *next;
 };
 
+/* A child started with spawn().  The driver holds the parent ends of its
+ * stdin, stdout and stderr pipes (-1 once closed).  With no callback
+ * method, output is collected and handed to the suspended task when the
+ * child exits; otherwise each read is delivered to objnum.method(). */
+struct process_s {
+    pid_t     pid;
+    SOCKET    in_fd;
+    SOCKET    out_fd;
+    SOCKET    err_fd;
+    cBuf    * in_buf;         /* stdin data not yet written */
+    cBuf    * out_buf;        /* collected stdout */
+    cBuf    * err_buf;        /* collected stderr */
+    Long      task_id;        /* suspended task, or -1 when streaming */
+    cObjnum   objnum;
+    Ident     method;         /* streaming callback, or NOT_AN_IDENT */
+    time_t    deadline;       /* kill the child after this, 0 for never */
+    int       status;         /* waitpid() status, once exited */
+    struct {
+        char out_readable;
+        char err_readable;
+        char in_writable;
+        char exited;
+        char timed_out;
+    } flags;
+    process_t * next;
+};
+
 void flush_defunct(void);
 void handle_new_and_pending_connections(void);
-void handle_io_event_wait(Int seconds);
+Int  handle_io_event_wait(Int seconds);
 void handle_connection_input(void);
 void handle_connection_output(void);
 Conn * find_connection(Obj * obj);
+void connection_reassign(Conn * conn, cObjnum objnum);
+void conn_queue_add(conn_queue_t * queue, Conn * conn);
 Conn * ctell(Obj * obj, cBuf *buf);
+Conn * ctell_file(Obj * obj, int fd, off_t len);
+Conn * ctell_datagram(Obj * obj, unsigned long addr, unsigned short port,
+                      cBuf * buf);
+Int  connection_framing(Obj * obj, Int mode, Int max, Int width);
+Int  connection_datagram_room(Obj * obj, Int n);
 Int  boot(Obj * obj, void * ptr);
 Int  tcp_server(unsigned short port, char * addr, Long objnum);
 Int  udp_server(unsigned short port, char * addr, Long objnum);
@@ -58,9 +178,13 @@ Int  remove_server(unsigned short port);
 Long make_connection(char *addr, unsigned short port, cObjnum receiver);
 Long make_udp_connection(char *addr, unsigned short port, cObjnum receiver);
 void flush_output(void);
+process_t * spawn_process(char *fname, char **argv, cBuf *input,
+                          Int timeout, cObjnum objnum, Ident method);
+void handle_process_events(void);
 Long udp_connect(char *addr, unsigned short port, Int *socket_return);
 
 extern int object_extra_connection;
+extern Int conn_files_queued;
 
 #endif
 
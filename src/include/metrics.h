@@ -0,0 +1,31 @@
+/*
+// Full copyright information is available in the file ../doc/CREDITS
+*/
+
+#ifndef cdc_metrics_h
+#define cdc_metrics_h
+
+/* The parts of a pass through main_loop() which are timed, see
+ * driver_metrics(). */
+#define PHASE_IO_WAIT      0    /* waiting for I/O events */
+#define PHASE_INPUT        1    /* input, new connections, children, files */
+#define PHASE_HEARTBEAT    2
+#define PHASE_OUTPUT       3
+#define PHASE_PAUSED       4    /* run_paused_tasks() */
+#define PHASE_DUMP         5    /* a step of a backup dump or compaction */
+#define PHASE_LAG          6    /* waking later than intended */
+#define PHASES             7
+
+/* Histogram bucket n counts times from 2^(n-1) up to 2^n microseconds,
+ * bucket 0 those of 0us; the last one takes everything longer. */
+#define METRIC_BUCKETS     24
+
+void    metrics_phase(Int phase, int64_t start, int64_t end);
+void    metrics_iteration(Long tasks, int64_t now);
+cList * metrics_info(void);
+void    metrics_reset(void);
+
+extern Long metrics_bytes_in, metrics_bytes_out;
+
+#endif
+
@@ -21,8 +21,27 @@ typedef Int SOCKET;
 
 #endif
 
-Int io_event_wait(Int sec, Conn *connections, server_t *servers,
-                  pending_t *pendings);
+/* Datagrams are read into a pool of DGRAM_BATCH slots of DGRAM_MAX
+ * bytes, room for any UDP payload, and sent up to DGRAM_BATCH at once. */
+#define DGRAM_MAX    65536
+#define DGRAM_BATCH  32
+
+typedef struct net_dgram_s {
+    uChar        * s;
+    Int            len;
+    char           addr[20];
+    unsigned short port;
+} net_dgram_t;
+
+Int io_event_wait(Int sec, conn_set_t *conns, server_t *servers,
+                  pending_t *pendings, process_t *processes, Int wake_fd);
+Long net_sendfile(SOCKET sock, int fd, off_t *offset, Long len);
+Int net_recv_datagrams(SOCKET sock, net_dgram_t *dgrams, Int n);
+Int net_send_datagrams(SOCKET sock, conn_dgram_t *dgrams);
+Bool net_is_datagram(SOCKET sock);
+Bool net_inet_addr(char *addr, unsigned long *inaddr);
+void net_watch(Conn *conn);
+void net_unwatch(Conn *conn);
 Long non_blocking_connect(char *addr, unsigned short port, Int *socket_return);
 void init_net(void);
 void uninit_net(void);
@@ -32,8 +51,18 @@ SOCKET get_udp_socket(unsigned short port, char * addr);
 
 Bool prebind_port(unsigned short port, char * addr, int tcp);
 
+/* see net_stats() */
+typedef struct net_stats_s {
+    Long accepted;            /* connections accepted */
+    Long accept_deferred;     /* wakeups which used up accept_budget */
+    Long accept_errors;       /* accepts which failed, eg. out of fds */
+    Long datagrams_in;        /* datagrams read in 'datagram framing */
+    Long datagrams_out;       /* datagrams sent by cwriteto() */
+} net_stats_t;
+
 extern cBuf * socket_buffer;
 extern Long server_failure_reason;
+extern net_stats_t net_stats;
 
 #endif
 
@@ -57,6 +57,9 @@ struct Obj {
     /* object connectivity data */
     cList      *parents;
     cList      *children;
+    cList      *ancestors;  /* linearized, this object first; NULL if it
+                               has to be recomputed */
+    Long        anc_epoch;  /* ancestry_epoch the list was built in */
 #ifdef USE_PARENT_OBJS
     cList      *parent_objs;
 #endif
@@ -88,6 +91,12 @@ struct Obj {
     Obj        *prev_dirty;
 #endif
 
+#ifdef USE_CLEANER_THREAD
+    /* Held for writing by the interpreter while the object is active,
+       so the cleaner thread leaves it alone. */
+    pthread_rwlock_t lock;
+#endif
+
     /* extra data for objects, ex: connection(s), files(s) */
     ObjExtras  *extras;
 };
@@ -146,6 +155,21 @@ struct Method {
     Int m_access;       /* public, protected, private */
     Int m_flags;       /* overridable, synchronized, locked */
     Int refs;
+
+    /* cached pointer into the method stats table, NULL until the method
+       is called while config('method_stats) is set */
+    MethodStats *stats;
+};
+
+struct MethodStats {
+    cObjnum      objnum;        /* definer */
+    Ident        name;
+    Long         calls;
+    Long         ticks;         /* including callees */
+    int64_t      time;          /* wall clock usec, including callees */
+    int64_t      max_time;
+    Long         faults;        /* objects read from disk */
+    MethodStats *next;          /* hash chain */
 };
 
 /* access: only one at a time */
@@ -189,6 +213,7 @@ extern void    object_free(Obj *object);
 extern void    object_destroy(Obj *object);
 extern void    object_construct_ancprec(Obj *object);
 extern Int     object_change_parents(Obj *object, cList *parents);
+extern Long    ancestry_epoch;
 extern cList  *object_ancestors_breadth(cObjnum objnum);
 extern cList  *object_ancestors_depth(cObjnum objnum);
 extern cList  *object_descendants(cObjnum objnum);
@@ -219,6 +244,8 @@ extern Method *object_find_next_method(cObjnum objnum, Ident name,
                                        cObjnum after, IsFrob is_frob);
 extern Int     object_rename_method(Obj * object, Ident oname, Ident nname);
 extern void    object_add_method(Obj *object, Ident name, Method *method);
+extern void    object_set_methods(Obj *object, ObjMethods *methods);
+extern void    object_reset(Obj *object);
 extern Int     object_del_method(Obj *object, Ident name, Bool replacing);
 extern cList  *object_list_method(Obj *object, Ident name, Int indent,
                                   int fflags);
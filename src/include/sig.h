@@ -5,9 +5,12 @@
 #ifndef cdc_signal_h
 #define cdc_signal_h
 
+#include <signal.h>
+
 void init_sig(void);
 
 extern short caught_fpe;   /* if we catch SIGFPE */
+extern volatile sig_atomic_t caught_chld;  /* if we catch SIGCHLD */
 
 /* void catch_signal(int sig, int code, struct sigcontext *scp); */
 void catch_signal(int sig);
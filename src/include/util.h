@@ -42,6 +42,7 @@ Long       random_number(Long n);
 cStr     * vformat(char * fmt, va_list arg);
 cStr     * format(char * fmt, ...);
 char     * timestamp(char * str);
+int64_t    usec_time(void);
 void       fformat(FILE *fp, char *fmt, ...);
 cStr     * fgetstring(FILE *fp);
 char     * english_type(Int type);
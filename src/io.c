@@ -6,21 +6,39 @@
 
 #include <ctype.h>
 #include <string.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#ifdef __UNIX__
+#include <sys/wait.h>
+#endif
 #include "cdc_pcode.h"
 #include "util.h"
 #include "cache.h"
 #include "net.h"
+#include "sig.h"
+#include "file.h"
+#include "metrics.h"
 
 static void connection_read(Conn *conn);
+static void connection_frames(Conn *conn, uChar *s, Int len);
+static void connection_datagrams(Conn *conn);
 static void connection_write(Conn *conn);
 static Conn *connection_add(Int fd, Long objnum);
+static void connection_kill(Conn *conn);
+static void connection_drop_output(Conn *conn);
 static void connection_discard(Conn *conn);
 static void pend_discard(pending_t *pend);
 static void server_discard(server_t *serv);
+static void process_finish(process_t *proc);
 
-static Conn * connections;  /* List of client connections. */
+static conn_set_t     conns = { NULL, 0, -1 };  /* Client connections. */
+static Conn        ** conn_hash;    /* Connections by objnum. */
+static Int            conn_hash_size;
+static Int            conn_count;
 static server_t     * servers;      /* List of server sockets. */
 static pending_t    * pendings;     /* List of pending connections. */
+static process_t    * processes;    /* List of spawned processes. */
 
 /* it's safe to only initialize obj_extra_file in connection_add since
  * before then, no obj->extra's will contain a connection, and a extra
@@ -38,20 +56,21 @@ int object_extra_connection = -1;
 */
 
 void flush_defunct(void) {
-    Conn **connp, *conn;
+    Conn          *conn;
     server_t     **servp, *serv;
     pending_t    **pendp, *pend;
+    Int            i, kept;
 
-    connp = &connections;
-    while (*connp) {
-        conn = *connp;
-        if (conn->flags.dead && conn->write_buf->len == 0) {
-            *connp = conn->next;
+    /* dead connections are kept until their output is written; a
+       disconnect task may kill more, which are appended and seen here */
+    for (i = kept = 0; i < conns.dead.len; i++) {
+        conn = conns.dead.conns[i];
+        if (conn->write_buf->len == 0 && !conn->files && !conn->dgrams)
             connection_discard(conn);
-        } else {
-            connp = &conn->next;
-        }
+        else
+            conns.dead.conns[kept++] = conn;
     }
+    conns.dead.len = kept;
 
     servp = &servers;
     while (*servp) {
@@ -78,14 +97,19 @@ void flush_defunct(void) {
 
 /*
 // --------------------------------------------------------------------
-// Call io_event_wait() to wait for something to happen.  The return
-// value is nonzero if an I/O event occurred.  If there is a new
-// connection, then *fd will be set to the descriptor of the new
-// connection; otherwise, it is set to -1.
+// Call io_event_wait() to wait for something to happen, for up to
+// seconds (-1 for no limit).  Returns the timeout it was actually
+// given, which is shorter while spawned processes are outstanding.
 */
 
-void handle_io_event_wait(Int seconds) {
-    io_event_wait(seconds, connections, servers, pendings);
+Int handle_io_event_wait(Int seconds) {
+    /* A child can exit between handle_process_events() and select(), so
+     * don't sleep for long while any are outstanding. */
+    if (processes && (seconds == -1 || seconds > 1))
+        seconds = 1;
+    io_event_wait(seconds, &conns, servers, pendings, processes,
+                  file_jobs_fd());
+    return seconds;
 }
 
 /*
@@ -94,23 +118,26 @@ void handle_io_event_wait(Int seconds) {
 
 void handle_connection_input(void) {
     Conn * conn;
+    Int    i;
 
-    for (conn = connections; conn; conn = conn->next) {
-        if (conn->flags.readable && !conn->flags.dead)
+    for (i = 0; i < conns.readable.len; i++) {
+        conn = conns.readable.conns[i];
+        if (!conn->flags.dead)
             connection_read(conn);
+        conn->flags.readable = 0;
     }
+    conns.readable.len = 0;
 }
 
 /*
 // --------------------------------------------------------------------
 */
 void handle_connection_output(void) {
-    Conn * conn;
+    Int i;
 
-    for (conn = connections; conn; conn = conn->next) {
-        if (conn->flags.writable)
-            connection_write(conn);
-    }
+    for (i = 0; i < conns.writable.len; i++)
+        connection_write(conns.writable.conns[i]);
+    conns.writable.len = 0;
 }
 
 /*
@@ -120,26 +147,38 @@ void handle_new_and_pending_connections(void) {
     Conn *conn;
     server_t *serv;
     pending_t *pend;
+    accepted_t *acc, *batch;
     cStr *str;
     cData d1, d2, d3, d4;
 
-    /* Look for new connections on the server sockets. */
+    /* Start a connect task for each client accepted on the server
+     * sockets; the tasks may bind or unbind ports, so take each batch
+     * off its server first. */
     for (serv = servers; serv; serv = serv->next) {
-        if (serv->client_socket == -1)
+        if (!serv->accepted)
             continue;
-        conn = connection_add(serv->client_socket, serv->objnum);
-        serv->client_socket = -1;
-        str = string_from_chars(serv->client_addr, strlen(serv->client_addr));
-        d1.type = STRING;
-        d1.u.str = str;
+        batch = serv->accepted;
+        serv->accepted = NULL;
+        serv->accepted_tail = &serv->accepted;
+
         d2.type = STRING;
-        d2.u.str = serv->addr; /* don't dup, vm_task() will */
-        d3.type = INTEGER;
-        d3.u.val = serv->client_port;
+        d2.u.str = string_dup(serv->addr);
         d4.type = INTEGER;
         d4.u.val = serv->port;
-        vm_task(conn->objnum, connect_id, 4, &d1, &d2, &d3, &d4);
-        string_discard(str);
+        while (batch) {
+            acc = batch;
+            batch = batch->next;
+            conn = connection_add(acc->fd, serv->objnum);
+            str = string_from_chars(acc->addr, strlen(acc->addr));
+            d1.type = STRING;
+            d1.u.str = str;
+            d3.type = INTEGER;
+            d3.u.val = acc->port;
+            vm_task(conn->objnum, connect_id, 4, &d1, &d2, &d3, &d4);
+            string_discard(str);
+            efree(acc);
+        }
+        string_discard(d2.u.str);
     }
 
     /* Look for pending connections succeeding or failing. */
@@ -180,28 +219,118 @@ void handle_new_and_pending_connections(void) {
 //
 // Once new connections bump old connections, this problem will go
 // away.
+//
+// New connections do now bump old ones (see connection_add()), and the
+// fallback is a lookup in the objnum hash rather than a walk of every
+// connection.
 */
 
+#define CONN_HASH(objnum) ((uLong) (objnum) & (conn_hash_size - 1))
+
+static void conn_hash_insert(Conn * conn) {
+    Conn ** table, * c, * next;
+    Int     i, size, h;
+
+    if (conn_count >= conn_hash_size) {
+        size = conn_hash_size ? conn_hash_size * 2 : 64;
+        table = EMALLOC(Conn *, size);
+        memset(table, 0, size * sizeof(Conn *));
+        for (i = 0; i < conn_hash_size; i++) {
+            for (c = conn_hash[i]; c; c = next) {
+                next = c->hash_next;
+                h = (uLong) c->objnum & (size - 1);
+                c->hash_next = table[h];
+                table[h] = c;
+            }
+        }
+        if (conn_hash)
+            efree(conn_hash);
+        conn_hash = table;
+        conn_hash_size = size;
+    }
+
+    h = CONN_HASH(conn->objnum);
+    conn->hash_next = conn_hash[h];
+    conn_hash[h] = conn;
+    conn_count++;
+}
+
+static void conn_hash_remove(Conn * conn) {
+    Conn ** cp = &conn_hash[CONN_HASH(conn->objnum)];
+
+    while (*cp != conn)
+        cp = &(*cp)->hash_next;
+    *cp = conn->hash_next;
+    conn_count--;
+}
+
+static Conn * conn_hash_find(cObjnum objnum) {
+    Conn * conn;
+
+    if (!conn_hash_size)
+        return NULL;
+    for (conn = conn_hash[CONN_HASH(objnum)]; conn; conn = conn->hash_next) {
+        if (conn->objnum == objnum && !conn->flags.dead)
+            return conn;
+    }
+    return NULL;
+}
+
 Conn * find_connection(Obj * obj) {
     Conn *tmp;
 
     if ((tmp = (Conn*)object_extra_find(obj, object_extra_connection)) == NULL) {
-        Conn * conn;
-
         /* lets try and find the conn */
-        for (conn = connections; conn; conn = conn->next) {
-            if (conn->objnum == obj->objnum && !conn->flags.dead) {
-                object_extra_register(obj, object_extra_connection, conn);
-                tmp = conn;
-                break;
-            }
-        }
+        if ((tmp = conn_hash_find(obj->objnum)) != NULL)
+            object_extra_register(obj, object_extra_connection, tmp);
     }
 
     /* it may still be NULL */
     return tmp;
 }
 
+/* Hand a connection over to another object, see reassign_connection(). */
+void connection_reassign(Conn * conn, cObjnum objnum) {
+    conn_hash_remove(conn);
+    conn->objnum = objnum;
+    conn_hash_insert(conn);
+}
+
+/*
+// --------------------------------------------------------------------
+// The queues of connections needing attention.  A connection is on the
+// output queue while it has buffered output, and the event backend is
+// told to watch it for room to write only while it is there.
+*/
+
+void conn_queue_add(conn_queue_t * queue, Conn * conn) {
+    if (queue->len == queue->size) {
+        queue->size = queue->size ? queue->size * 2 : 16;
+        queue->conns = EREALLOC(queue->conns, Conn *, queue->size);
+    }
+    queue->conns[queue->len++] = conn;
+}
+
+static void output_queue(Conn * conn) {
+    if (conn->output_slot == -1) {
+        conn->output_slot = conns.output.len;
+        conn_queue_add(&conns.output, conn);
+        net_watch(conn);
+    }
+}
+
+static void output_dequeue(Conn * conn) {
+    Conn * last;
+
+    if (conn->output_slot != -1) {
+        last = conns.output.conns[--conns.output.len];
+        conns.output.conns[conn->output_slot] = last;
+        last->output_slot = conn->output_slot;
+        conn->output_slot = -1;
+        net_watch(conn);
+    }
+}
+
 /*
 // --------------------------------------------------------------------
 // returning the connection is what we are using as a status report, if
@@ -211,12 +340,122 @@ Conn * find_connection(Obj * obj) {
 Conn * ctell(Obj * obj, cBuf * buf) {
     Conn * conn = find_connection(obj);
 
-    if (conn != NULL)
-        conn->write_buf = buffer_append(conn->write_buf, buf);
+    if (conn != NULL && buf->len) {
+        /* output goes out in order, so after any file being sent */
+        if (conn->files_last)
+            conn->files_last->after = buffer_append(conn->files_last->after,
+                                                    buf);
+        else
+            conn->write_buf = buffer_append(conn->write_buf, buf);
+        output_queue(conn);
+    }
+
+    return conn;
+}
+
+/*
+// --------------------------------------------------------------------
+// Queue the first len bytes of the open file fd for output, for
+// cwritef().  The connection takes the descriptor and closes it when
+// the range has been sent; it is closed here if there is no connection.
+*/
+
+Conn * ctell_file(Obj * obj, int fd, off_t len) {
+    Conn        * conn = find_connection(obj);
+    conn_file_t * file;
+
+    if (conn == NULL || len <= 0) {
+        close(fd);
+        return conn;
+    }
+
+    file = EMALLOC(conn_file_t, 1);
+    file->fd = fd;
+    file->offset = 0;
+    file->len = len;
+    file->after = buffer_new(0);
+    file->next = NULL;
+    conn_files_queued++;
+    if (conn->files_last)
+        conn->files_last->next = file;
+    else
+        conn->files = file;
+    conn->files_last = file;
+    output_queue(conn);
+
+    return conn;
+}
+
+/*
+// --------------------------------------------------------------------
+// Queue a datagram for addr and port on obj's connection, for
+// cwriteto().  They are sent in batches as the socket has room.
+*/
+
+Conn * ctell_datagram(Obj * obj, unsigned long addr, unsigned short port,
+                      cBuf * buf) {
+    Conn         * conn = find_connection(obj);
+    conn_dgram_t * dgram;
+
+    if (conn == NULL)
+        return NULL;
+
+    dgram = EMALLOC(conn_dgram_t, 1);
+    dgram->buf = buffer_dup(buf);
+    dgram->addr = addr;
+    dgram->port = port;
+    dgram->next = NULL;
+    if (conn->dgrams_last)
+        conn->dgrams_last->next = dgram;
+    else
+        conn->dgrams = dgram;
+    conn->dgrams_last = dgram;
+    conn->ndgrams++;
+    output_queue(conn);
 
     return conn;
 }
 
+/* Drop the first n datagrams on the queue, or all of them for -1. */
+static void connection_dgrams_done(Conn * conn, Int n) {
+    conn_dgram_t * dgram;
+
+    while (n-- && (dgram = conn->dgrams)) {
+        if (!(conn->dgrams = dgram->next))
+            conn->dgrams_last = NULL;
+        conn->ndgrams--;
+        buffer_discard(dgram->buf);
+        efree(dgram);
+    }
+}
+
+/* file ranges queued on all connections, see CONN_FILES_MAX */
+Int conn_files_queued = 0;
+
+/* the most handed to one sendfile(), the socket takes far less anyway */
+#define SENDFILE_MAX (1L << 30)
+
+/* The first file range is done; what was told after it is up next. */
+static void connection_file_done(Conn * conn) {
+    conn_file_t * file = conn->files;
+
+    close(file->fd);
+    conn_files_queued--;
+    buffer_discard(conn->write_buf);
+    conn->write_buf = file->after;
+    if (!(conn->files = file->next))
+        conn->files_last = NULL;
+    efree(file);
+}
+
+static void connection_drop_output(Conn * conn) {
+    conn->write_buf = buffer_resize(conn->write_buf, 0);
+    while (conn->files)
+        connection_file_done(conn);
+    conn->write_buf = buffer_resize(conn->write_buf, 0);
+    connection_dgrams_done(conn, -1);
+}
+
 /*
 // --------------------------------------------------------------------
 */
@@ -225,7 +464,7 @@ Int boot(Obj * obj, void * ptr) {
     Conn * conn = ptr ? (Conn*)ptr : find_connection(obj);
 
     if (conn != NULL) {
-        conn->flags.dead = 1;
+        connection_kill(conn);
         return 1;
     }
 
@@ -258,7 +497,8 @@ Int tcp_server(unsigned short port, char * ipaddr, Long objnum) {
 
     cnew = EMALLOC(server_t, 1);
     cnew->server_socket = server_socket;
-    cnew->client_socket = -1;
+    cnew->accepted = NULL;
+    cnew->accepted_tail = &cnew->accepted;
     cnew->port = port;
     if (ipaddr)
         cnew->addr = string_from_chars(ipaddr, strlen(ipaddr));
@@ -309,6 +549,11 @@ static void connection_read(Conn *conn) {
     Int len;
     cData d;
 
+    if (conn->frame_mode == FRAME_DATAGRAM) {
+        connection_datagrams(conn);
+        return;
+    }
+
     /* DOH, something is still using out buffer, lets let
        it keep it and we'll get a new sandbox to play in */
     if (socket_buffer->refs > 1) {
@@ -324,17 +569,34 @@ static void connection_read(Conn *conn) {
         if (GETERR() != ERR_AGAIN) {
             /* The connection closed. */
             conn->flags.readable = 0;
-            conn->flags.dead = 1;
+            connection_kill(conn);
             return;
         }
         /* hrm.. we got ERR_AGAIN, do nothing this time */
         return;
     } else if (len == 0) {
         conn->flags.readable = 0;
-        conn->flags.dead = 1;
+        connection_kill(conn);
     }
 
     conn->flags.readable = 0;
+    metrics_bytes_in += len;
+
+    if (conn->frame_mode != FRAME_RAW) {
+        connection_frames(conn, socket_buffer->s, len);
+        return;
+    }
+
+    /* anything left over from a framed mode goes first */
+    if (conn->frame_buf->len) {
+        d.type = BUFFER;
+        d.u.buffer = buffer_append_uchars(conn->frame_buf, socket_buffer->s,
+                                          len);
+        conn->frame_buf = buffer_new(0);
+        vm_task(conn->objnum, parse_id, 1, &d);
+        buffer_discard(d.u.buffer);
+        return;
+    }
 
     /* We successfully read some data.  Handle it. */
     socket_buffer->refs++;
@@ -345,26 +607,300 @@ static void connection_read(Conn *conn) {
     socket_buffer->refs--;
 }
 
+/*
+// --------------------------------------------------------------------
+// Split what was read into frames, keeping any incomplete one in
+// frame_buf for the next read, and hand the complete ones to parse in a
+// list.  len is 0 at the end of the connection, when a last unterminated
+// line is delivered too.
+*/
+
+static cList * frame_add_line(cList * frames, uChar * s, Int len) {
+    cData   d;
+    cStr  * str;
+    char  * p;
+    uChar * end = s + len;
+
+    /* as buf_to_strings() does, keep the printable characters */
+    str = string_new(len);
+    for (p = str->s; s < end; s++) {
+        if (ISPRINT(*s))
+            *p++ = *s;
+        else if (*s == '\t')
+            *p++ = ' ';
+    }
+    *p = '\0';
+    str->len = p - str->s;
+
+    d.type = STRING;
+    d.u.str = str;
+    frames = list_add(frames, &d);
+    string_discard(str);
+    return frames;
+}
+
+static void connection_frames(Conn * conn, uChar * s, Int len) {
+    cList * frames = list_new(0);
+    cBuf  * fb = conn->frame_buf,
+          * held = NULL;
+    cData   d;
+    uChar * nl;
+    Int     n, i, size, eof = !len;
+
+    if (conn->frame_mode == FRAME_LINE) {
+        /* Split what is held along with the new input.  It may be longer
+           than frame_max, or hold newlines, if set_framing() lowered the
+           maximum or switched from 'length since it was read. */
+        if (fb->len) {
+            held = buffer_append_uchars(fb, s, len);
+            fb = buffer_new(0);
+            s = held->s;
+            len = held->len;
+        }
+
+        while (len) {
+            nl = (uChar *) memchr(s, '\n', len);
+            n = nl ? nl - s : len;
+
+            /* overlong lines are cut at frame_max */
+            if (fb->len + n > conn->frame_max) {
+                n = conn->frame_max - fb->len;
+                if (n < 0)
+                    n = 0;
+                fb = buffer_append_uchars(fb, s, n);
+                s += n;
+                len -= n;
+            } else if (nl) {
+                fb = buffer_append_uchars(fb, s, n);
+                s += n + 1;
+                len -= n + 1;
+            } else {
+                fb = buffer_append_uchars(fb, s, n);
+                break;
+            }
+
+            frames = frame_add_line(frames, fb->s, fb->len);
+            fb->len = 0;
+        }
+        if (eof && fb->len) {
+            frames = frame_add_line(frames, fb->s, fb->len);
+            fb->len = 0;
+        }
+        if (held)
+            buffer_discard(held);
+    } else {
+        /* work straight from what was read unless a frame is pending */
+        if (fb->len) {
+            fb = buffer_append_uchars(fb, s, len);
+            s = fb->s;
+            len = fb->len;
+        }
+
+        d.type = BUFFER;
+        while (len >= conn->frame_width) {
+            for (size = i = 0; i < conn->frame_width; i++)
+                size = (size << 8) | s[i];
+
+            if (size < 0 || size > conn->frame_max) {
+                /* the other end is not speaking our protocol */
+                connection_kill(conn);
+                len = 0;
+                break;
+            }
+            if (len - conn->frame_width < size)
+                break;
+            d.u.buffer = buffer_new(size);
+            MEMCPY(d.u.buffer->s, s + conn->frame_width, size);
+            d.u.buffer->len = size;
+            frames = list_add(frames, &d);
+            buffer_discard(d.u.buffer);
+            s += conn->frame_width + size;
+            len -= conn->frame_width + size;
+        }
+
+        /* keep the partial frame */
+        if (fb->len) {
+            MEMMOVE(fb->s, s, len);
+            fb->len = len;
+        } else {
+            fb = buffer_append_uchars(fb, s, len);
+        }
+    }
+    conn->frame_buf = fb;
+
+    if (frames->len) {
+        d.type = LIST;
+        d.u.list = frames;
+        vm_task(conn->objnum, parse_id, 1, &d);
+    }
+    list_discard(frames);
+}
+
+/*
+// --------------------------------------------------------------------
+// Drain a datagram socket through the receive pool, up to frame_max
+// datagrams, and hand them to parse in one list of [addr, port, buffer].
+// The socket stays readable if more are waiting.
+*/
+
+static net_dgram_t * dgram_pool = NULL;
+
+static void connection_datagrams(Conn * conn) {
+    cList * dgrams = list_new(0);
+    cList * dgram;
+    cData   d, * e;
+    Int     i, n, want, count = 0;
+
+    if (dgram_pool == NULL) {
+        dgram_pool = EMALLOC(net_dgram_t, DGRAM_BATCH);
+        dgram_pool[0].s = EMALLOC(uChar, DGRAM_BATCH * DGRAM_MAX);
+        for (i = 1; i < DGRAM_BATCH; i++)
+            dgram_pool[i].s = dgram_pool[0].s + i * DGRAM_MAX;
+    }
+
+    while (count < conn->frame_max) {
+        want = conn->frame_max - count;
+        if (want > DGRAM_BATCH)
+            want = DGRAM_BATCH;
+        n = net_recv_datagrams(conn->fd, dgram_pool, want);
+        if (n == SOCKET_ERROR) {
+            if (GETERR() == ERR_INTR)
+                continue;
+            if (GETERR() != ERR_AGAIN)
+                connection_kill(conn);
+            break;
+        }
+
+        for (i = 0; i < n; i++) {
+            dgram = list_new(3);
+            e = list_empty_spaces(dgram, 3);
+            e[0].type = STRING;
+            e[0].u.str = string_from_chars(dgram_pool[i].addr,
+                                           strlen(dgram_pool[i].addr));
+            e[1].type = INTEGER;
+            e[1].u.val = dgram_pool[i].port;
+            e[2].type = BUFFER;
+            e[2].u.buffer = buffer_new(dgram_pool[i].len);
+            MEMCPY(e[2].u.buffer->s, dgram_pool[i].s, dgram_pool[i].len);
+            e[2].u.buffer->len = dgram_pool[i].len;
+            metrics_bytes_in += dgram_pool[i].len;
+
+            d.type = LIST;
+            d.u.list = dgram;
+            dgrams = list_add(dgrams, &d);
+            list_discard(dgram);
+        }
+        count += n;
+
+        /* a short batch means the socket has been drained */
+        if (n < want)
+            break;
+    }
+    net_stats.datagrams_in += count;
+
+    if (dgrams->len) {
+        d.type = LIST;
+        d.u.list = dgrams;
+        vm_task(conn->objnum, parse_id, 1, &d);
+    }
+    list_discard(dgrams);
+}
+
+/*
+// --------------------------------------------------------------------
+// Set how input on obj's connection is framed.  Input already held for a
+// partial frame is kept and framed by the new mode.  Returns 0 without a
+// connection, and -1 asking for datagrams on a stream.
+*/
+
+Int connection_framing(Obj * obj, Int mode, Int max, Int width) {
+    Conn * conn = find_connection(obj);
+
+    if (conn == NULL)
+        return 0;
+    if (mode == FRAME_DATAGRAM && !net_is_datagram(conn->fd))
+        return -1;
+    conn->frame_mode = mode;
+    conn->frame_max = max;
+    conn->frame_width = width;
+    return 1;
+}
+
+/*
+// --------------------------------------------------------------------
+// Whether n more datagrams can be queued on obj's connection, for
+// cwriteto().  Returns 1 if so, 0 without a connection, -1 if it is not
+// a datagram socket and -2 if the queue would pass CONN_DGRAMS_MAX.
+*/
+
+Int connection_datagram_room(Obj * obj, Int n) {
+    Conn * conn = find_connection(obj);
+
+    if (conn == NULL)
+        return 0;
+    if (!net_is_datagram(conn->fd))
+        return -1;
+    if (conn->ndgrams + n > CONN_DGRAMS_MAX)
+        return -2;
+    return 1;
+}
+
 /*
 // --------------------------------------------------------------------
 */
 static void connection_write(Conn *conn) {
     cBuf *buf = conn->write_buf;
-    Int r;
+    conn_file_t *file;
+    conn_dgram_t *dgram;
+    Long r = 0, i;
 
-    r = SOCK_WRITE(conn->fd, buf->s, buf->len);
     conn->flags.writable = 0;
 
+    if (buf->len) {
+        r = SOCK_WRITE(conn->fd, buf->s, buf->len);
+        if (r != SOCKET_ERROR) {
+            metrics_bytes_out += r;
+            MEMMOVE(buf->s, buf->s + r, buf->len - r);
+            conn->write_buf = buffer_resize(buf, buf->len - r);
+        }
+    }
+
+    /* then any file range, which ends early if the file got shorter */
+    if (r != SOCKET_ERROR && !conn->write_buf->len && conn->files) {
+        file = conn->files;
+        r = net_sendfile(conn->fd, file->fd, &file->offset,
+                         (Long) (file->len > SENDFILE_MAX ? SENDFILE_MAX
+                                                          : file->len));
+        if (r != SOCKET_ERROR) {
+            metrics_bytes_out += r;
+            file->len -= r;
+            if (!r || !file->len)
+                connection_file_done(conn);
+        }
+    }
+
     /* We lost the connection. */
-    if ((r == SOCKET_ERROR) && (GETERR() != ERR_AGAIN)) {
-       conn->flags.dead = 1;
-       buf = buffer_resize(buf, 0);
-    } else {
-       MEMMOVE(buf->s, buf->s + r, buf->len - r);
-       buf = buffer_resize(buf, buf->len - r);
+    if (r == SOCKET_ERROR && GETERR() != ERR_AGAIN) {
+        connection_kill(conn);
+        connection_drop_output(conn);
+    }
+
+    /* a datagram which can't be sent (to a bad address, or too big) is
+       dropped, the socket itself is fine */
+    if (conn->dgrams) {
+        r = net_send_datagrams(conn->fd, conn->dgrams);
+        if (r != SOCKET_ERROR) {
+            net_stats.datagrams_out += r;
+            for (dgram = conn->dgrams, i = 0; i < r; dgram = dgram->next, i++)
+                metrics_bytes_out += dgram->buf->len;
+            connection_dgrams_done(conn, r);
+        } else if (GETERR() != ERR_AGAIN && GETERR() != ERR_INTR) {
+            connection_dgrams_done(conn, 1);
+        }
     }
 
-    conn->write_buf = buf;
+    if (!conn->write_buf->len && !conn->files && !conn->dgrams)
+        output_dequeue(conn);
 }
 
 /*
@@ -372,6 +908,7 @@ static void connection_write(Conn *conn) {
 */
 static Conn * connection_add(Int fd, Long objnum) {
     Conn * conn;
+    Int    size;
 
     if (!object_extra_initialized) {
         object_extra_initialized = 1;
@@ -379,10 +916,8 @@ static Conn * connection_add(Int fd, Long objnum) {
     }
 
     /* clear old connections to this objnum */
-    for (conn = connections; conn; conn = conn->next) {
-        if (conn->objnum == objnum && !conn->flags.dead)
-            conn->flags.dead = 1;
-    }
+    if ((conn = conn_hash_find(objnum)) != NULL)
+        connection_kill(conn);
 
     /* initialize new connection */
     conn = EMALLOC(Conn, 1);
@@ -392,12 +927,48 @@ static Conn * connection_add(Int fd, Long objnum) {
     conn->flags.readable = 0;
     conn->flags.writable = 0;
     conn->flags.dead = 0;
-    conn->next = connections;
-    connections = conn;
+    conn->frame_mode = FRAME_RAW;
+    conn->frame_max = 0;
+    conn->frame_width = 0;
+    conn->frame_buf = buffer_new(0);
+    conn->files = conn->files_last = NULL;
+    conn->dgrams = conn->dgrams_last = NULL;
+    conn->ndgrams = 0;
+    conn->output_slot = -1;
+    conn->events = 0;
+    conn_hash_insert(conn);
+
+    if (fd >= conns.size) {
+        size = conns.size ? conns.size * 2 : 64;
+        while (fd >= size)
+            size *= 2;
+        conns.by_fd = EREALLOC(conns.by_fd, Conn *, size);
+        memset(conns.by_fd + conns.size, 0,
+               (size - conns.size) * sizeof(Conn *));
+        conns.size = size;
+    }
+    conns.by_fd[fd] = conn;
+    if (fd > conns.max_fd)
+        conns.max_fd = fd;
+
+    net_watch(conn);
 
     return conn;
 }
 
+/*
+// --------------------------------------------------------------------
+// Mark a connection defunct; flush_defunct() discards it once its
+// output has been written.
+*/
+static void connection_kill(Conn *conn) {
+    if (!conn->flags.dead) {
+        conn->flags.dead = 1;
+        conn_queue_add(&conns.dead, conn);
+        net_watch(conn);
+    }
+}
+
 /*
 // --------------------------------------------------------------------
 */
@@ -414,9 +985,19 @@ static void connection_discard(Conn *conn) {
         cache_discard(obj);
     }
 
+    /* Take it out of the table and the event backend. */
+    connection_drop_output(conn);
+    output_dequeue(conn);
+    conn_hash_remove(conn);
+    conns.by_fd[conn->fd] = NULL;
+    while (conns.max_fd >= 0 && !conns.by_fd[conns.max_fd])
+        conns.max_fd--;
+    net_unwatch(conn);
+
     /* Free the data associated with the connection. */
     SOCK_CLOSE(conn->fd);
     buffer_discard(conn->write_buf);
+    buffer_discard(conn->frame_buf);
     efree(conn);
 
     /* Notify connection object that the connection is gone */
@@ -434,6 +1015,13 @@ static void pend_discard(pending_t *pend) {
 // --------------------------------------------------------------------
 */
 static void server_discard(server_t *serv) {
+    accepted_t *acc;
+
+    while ((acc = serv->accepted)) {
+        serv->accepted = acc->next;
+        SOCK_CLOSE(acc->fd);
+        efree(acc);
+    }
     SOCK_CLOSE(serv->server_socket);
     string_discard(serv->addr);
     efree(serv);
@@ -482,31 +1070,388 @@ Long make_udp_connection(char *addr, unsigned short port, cObjnum receiver) {
 
 /*
 // --------------------------------------------------------------------
-// Write out everything in connections' write buffers.  Called by main()
-// before exiting; does not modify the write buffers to reflect writing.
+// Write out everything in connections' write buffers and queued files.
+// Called by main() before exiting; does not modify the write buffers to
+// reflect writing.
 */
 
+static void flush_buffer(SOCKET fd, cBuf * buf) {
+    unsigned char * s = buf->s;
+    Int len = buf->len, r;
+
+    while (len) {
+        r = SOCK_WRITE(fd, s, len);
+        if ((r == SOCKET_ERROR) && (GETERR() != ERR_AGAIN))
+            break;
+        /*
+         * If it would've blocked, then don't change len or s,
+         * so set the bytes written to 0
+         */
+        if ((r == SOCKET_ERROR) && (GETERR() == ERR_AGAIN))
+            r = 0;
+        len -= r;
+        s += r;
+    }
+}
+
 void flush_output(void) {
-    Conn  * conn;
-    unsigned char * s;
-    Int len, r;
+    Conn         * conn;
+    conn_file_t  * file;
+    conn_dgram_t * dgram;
+    Long           r;
+    Int            i;
 
     /* do connections */
-    for (conn = connections; conn; conn = conn->next) {
-        s = conn->write_buf->s;
-        len = conn->write_buf->len;
-        while (len) {
-            r = SOCK_WRITE(conn->fd, s, len);
-            if ((r == SOCKET_ERROR) && (GETERR() != ERR_AGAIN))
-                break;
-            /*
-             * If it would've blocked, then don't change len or s,
-             * so set the bytes written to 0
-             */
-            if ((r == SOCKET_ERROR) && (GETERR() == ERR_AGAIN))
-                r = 0;
-            len -= r;
-            s += r;
+    for (i = 0; i < conns.output.len; i++) {
+        conn = conns.output.conns[i];
+        flush_buffer(conn->fd, conn->write_buf);
+        for (file = conn->files; file; file = file->next) {
+            while (file->len > 0) {
+                r = net_sendfile(conn->fd, file->fd, &file->offset,
+                                 (Long) (file->len > SENDFILE_MAX ?
+                                         SENDFILE_MAX : file->len));
+                if (r == SOCKET_ERROR && GETERR() == ERR_AGAIN)
+                    continue;
+                if (r == SOCKET_ERROR || !r)
+                    break;
+                file->len -= r;
+            }
+            flush_buffer(conn->fd, file->after);
+        }
+        for (dgram = conn->dgrams; dgram; ) {
+            r = net_send_datagrams(conn->fd, dgram);
+            if (r == SOCKET_ERROR && GETERR() == ERR_AGAIN)
+                continue;
+            if (r == SOCKET_ERROR)
+                r = 1;
+            while (r-- && dgram)
+                dgram = dgram->next;
+        }
+    }
+}
+
+/*
+// --------------------------------------------------------------------
+// Spawned processes.
+//
+// spawn_process() forks fname with pipes on its stdin, stdout and
+// stderr; the parent ends are non-blocking and watched by
+// io_event_wait().  SIGCHLD only sets caught_chld, the actual reaping
+// happens in handle_process_events() from the main loop.  Returns the
+// new process, or NULL with errno set.
+*/
+
+#ifdef __UNIX__
+static void process_fd_setup(int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+#ifdef FD_CLOEXEC
+    fcntl(fd, F_SETFD, fcntl(fd, F_GETFD) | FD_CLOEXEC);
+#endif
+}
+#endif
+
+process_t * spawn_process(char *fname, char **argv, cBuf *input,
+                          Int timeout, cObjnum objnum, Ident method)
+{
+#ifdef __UNIX__
+    process_t *proc;
+    int in[2], out[2], err[2], i, fds[6];
+    pid_t pid;
+
+    if (pipe(in) == -1)
+        return NULL;
+    if (pipe(out) == -1) {
+        close(in[0]);
+        close(in[1]);
+        return NULL;
+    }
+    if (pipe(err) == -1) {
+        close(in[0]);
+        close(in[1]);
+        close(out[0]);
+        close(out[1]);
+        return NULL;
+    }
+
+    pid = fork();
+    if (pid == 0) {
+        dup2(in[0], STDIN_FILENO);
+        dup2(out[1], STDOUT_FILENO);
+        dup2(err[1], STDERR_FILENO);
+        fds[0] = in[0];  fds[1] = in[1];
+        fds[2] = out[0]; fds[3] = out[1];
+        fds[4] = err[0]; fds[5] = err[1];
+        for (i = 0; i < 6; i++) {
+            if (fds[i] > STDERR_FILENO)
+                close(fds[i]);
+        }
+        execv(fname, argv);
+        write_err("SPAWN: Failed to exec \"%s\": %s.", fname,
+                  strerror(GETERR()));
+        _exit(-1);
+    }
+
+    close(in[0]);
+    close(out[1]);
+    close(err[1]);
+    if (pid == -1) {
+        close(in[1]);
+        close(out[0]);
+        close(err[0]);
+        return NULL;
+    }
+
+    process_fd_setup(in[1]);
+    process_fd_setup(out[0]);
+    process_fd_setup(err[0]);
+
+    proc = EMALLOC(process_t, 1);
+    proc->pid = pid;
+    proc->out_fd = out[0];
+    proc->err_fd = err[0];
+    if (input && input->len) {
+        proc->in_fd = in[1];
+        proc->in_buf = buffer_dup(input);
+    } else {
+        /* nothing to send, let the child see EOF straight away */
+        close(in[1]);
+        proc->in_fd = -1;
+        proc->in_buf = buffer_new(0);
+    }
+    proc->out_buf = buffer_new(0);
+    proc->err_buf = buffer_new(0);
+    proc->objnum = objnum;
+    if (method == NOT_AN_IDENT) {
+        proc->method = NOT_AN_IDENT;
+        proc->task_id = task_id;
+    } else {
+        proc->method = ident_dup(method);
+        proc->task_id = -1;
+    }
+    proc->deadline = (timeout > 0) ? time(NULL) + timeout : 0;
+    proc->status = 0;
+    proc->flags.out_readable = 0;
+    proc->flags.err_readable = 0;
+    proc->flags.in_writable = 0;
+    proc->flags.exited = 0;
+    proc->flags.timed_out = 0;
+    proc->next = processes;
+    processes = proc;
+
+    return proc;
+#else
+    return NULL;
+#endif
+}
+
+#ifdef __UNIX__
+/*
+// --------------------------------------------------------------------
+// Read one chunk from a process's stdout or stderr pipe.  Collected
+// output is appended to *bufp, streamed output is passed on to the
+// callback method.  Returns the number of bytes read; the pipe is
+// closed when it reaches EOF.
+*/
+static Int process_read(process_t *proc, SOCKET *fdp, cBuf **bufp,
+                        Ident stream)
+{
+    uChar chunk[BIGBUF];
+    Int len;
+    cBuf *buf;
+    cData d1, d2, d3;
+
+    len = read(*fdp, chunk, BIGBUF);
+    if (len == SOCKET_ERROR &&
+        (GETERR() == ERR_AGAIN || GETERR() == ERR_INTR))
+        return 0;
+    if (len <= 0) {
+        close(*fdp);
+        *fdp = -1;
+        return 0;
+    }
+
+    if (proc->method == NOT_AN_IDENT) {
+        *bufp = buffer_append_uchars(*bufp, chunk, len);
+    } else {
+        buf = buffer_append_uchars(buffer_new(len), chunk, len);
+        d1.type = INTEGER;
+        d1.u.val = proc->pid;
+        d2.type = SYMBOL;
+        d2.u.symbol = stream;
+        d3.type = BUFFER;
+        d3.u.buffer = buf;
+        vm_task(proc->objnum, proc->method, 3, &d1, &d2, &d3);
+        buffer_discard(buf);
+    }
+
+    return len;
+}
+
+/*
+// --------------------------------------------------------------------
+*/
+static void process_write(process_t *proc) {
+    cBuf *buf = proc->in_buf;
+    Int r;
+
+    proc->flags.in_writable = 0;
+    r = write(proc->in_fd, buf->s, buf->len);
+    if (r == SOCKET_ERROR) {
+        if (GETERR() == ERR_AGAIN || GETERR() == ERR_INTR)
+            return;
+        /* the child closed its stdin; drop the rest */
+        r = buf->len;
+    }
+    MEMMOVE(buf->s, buf->s + r, buf->len - r);
+    proc->in_buf = buffer_resize(buf, buf->len - r);
+
+    /* all input is written, close the pipe so the child sees EOF */
+    if (!proc->in_buf->len) {
+        close(proc->in_fd);
+        proc->in_fd = -1;
+    }
+}
+#endif
+
+/*
+// --------------------------------------------------------------------
+// Reap exited children, move data through the process pipes, enforce
+// timeouts, and report on processes which have finished.
+*/
+void handle_process_events(void) {
+#ifdef __UNIX__
+    process_t **procp, *proc, *done = NULL;
+    pid_t pid;
+    int status;
+    time_t now;
+
+    if (caught_chld) {
+        caught_chld = 0;
+
+        /* children we aren't tracking came from a non-waiting execute() */
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+            for (proc = processes; proc; proc = proc->next) {
+                if (proc->pid == pid) {
+                    proc->status = status;
+                    proc->flags.exited = 1;
+                    break;
+                }
+            }
         }
     }
+
+    if (!processes)
+        return;
+
+    now = time(NULL);
+    for (proc = processes; proc; proc = proc->next) {
+        if (proc->flags.in_writable)
+            process_write(proc);
+        if (proc->flags.out_readable) {
+            proc->flags.out_readable = 0;
+            process_read(proc, &proc->out_fd, &proc->out_buf, stdout_id);
+        }
+        if (proc->flags.err_readable) {
+            proc->flags.err_readable = 0;
+            process_read(proc, &proc->err_fd, &proc->err_buf, stderr_id);
+        }
+        if (proc->deadline && now >= proc->deadline &&
+            !proc->flags.exited && !proc->flags.timed_out)
+        {
+            kill(proc->pid, SIGKILL);
+            proc->flags.timed_out = 1;
+        }
+    }
+
+    /* Pull finished processes off the list before reporting on them,
+     * the callbacks may spawn more. */
+    procp = &processes;
+    while (*procp) {
+        proc = *procp;
+        if (proc->flags.exited) {
+            /* whatever the child wrote is already in the pipes; don't
+             * wait on anything which inherited the write ends */
+            while (proc->out_fd != -1 &&
+                   process_read(proc, &proc->out_fd, &proc->out_buf,
+                                stdout_id) > 0);
+            while (proc->err_fd != -1 &&
+                   process_read(proc, &proc->err_fd, &proc->err_buf,
+                                stderr_id) > 0);
+            *procp = proc->next;
+            proc->next = done;
+            done = proc;
+        } else {
+            procp = &proc->next;
+        }
+    }
+
+    while (done) {
+        proc = done;
+        done = done->next;
+        process_finish(proc);
+    }
+#endif
+}
+
+/*
+// --------------------------------------------------------------------
+// Hand the result of a process to whoever is waiting for it: a
+// suspended task is resumed with [status, stdout, stderr], a streaming
+// process gets a final .method(pid, 'exit, status).  The status is the
+// exit code, minus the signal number if it was killed, or ~timeout.
+*/
+static void process_finish(process_t *proc) {
+#ifdef __UNIX__
+    cData d1, d2, d3;
+    cList *list;
+
+    if (proc->flags.timed_out) {
+        d3.type = T_ERROR;
+        d3.u.error = timeout_id;
+    } else {
+        d3.type = INTEGER;
+        if (WIFEXITED(proc->status))
+            d3.u.val = WEXITSTATUS(proc->status);
+        else if (WIFSIGNALED(proc->status))
+            d3.u.val = -WTERMSIG(proc->status);
+        else
+            d3.u.val = -1;
+    }
+
+    if (proc->method == NOT_AN_IDENT) {
+        list = list_new(3);
+        list = list_add(list, &d3);
+        d1.type = BUFFER;
+        d1.u.buffer = proc->out_buf;
+        list = list_add(list, &d1);
+        d1.u.buffer = proc->err_buf;
+        list = list_add(list, &d1);
+        d1.type = LIST;
+        d1.u.list = list;
+
+        /* the task may have been resumed or cancelled by hand in the
+           meantime, and be running or suspended on something else */
+        if (vm_waiting(proc->task_id, proc))
+            vm_resume(proc->task_id, &d1);
+        list_discard(list);
+    } else {
+        d1.type = INTEGER;
+        d1.u.val = proc->pid;
+        d2.type = SYMBOL;
+        d2.u.symbol = exit_id;
+        vm_task(proc->objnum, proc->method, 3, &d1, &d2, &d3);
+        ident_discard(proc->method);
+    }
+
+    if (proc->in_fd != -1)
+        close(proc->in_fd);
+    if (proc->out_fd != -1)
+        close(proc->out_fd);
+    if (proc->err_fd != -1)
+        close(proc->err_fd);
+    buffer_discard(proc->in_buf);
+    buffer_discard(proc->out_buf);
+    buffer_discard(proc->err_buf);
+    efree(proc);
+#endif
 }
@@ -56,6 +56,7 @@ pthread_mutex_t lookup_mutex;
 
 Int name_cache_hits = 0;
 Int name_cache_misses = 0;
+Int name_cache_negative = 0;
 
 static datum objnum_key(cObjnum objnum, Number_buf nbuf);
 static datum name_key(Ident name);
@@ -65,18 +66,27 @@ static datum objnum_value(cObjnum objnum, Number_buf nbuf);
 static void sync_name_cache(void);
 static Int store_name(Ident name, cObjnum objnum);
 static Int get_name(Ident name, cObjnum *objnum);
+static struct name_cache_entry *name_cache_find(Ident name);
+static struct name_cache_entry *name_cache_add(Ident name);
 
 static DBM *dbp;
 
+/*
+// The name cache is set associative: a name may be in any of the
+// NAME_CACHE_WAYS entries of set name % NAME_CACHE_SIZE, which are kept
+// most recently used first.  An entry with an objnum of INV_OBJNUM
+// records a name which is known not to exist.  Changed names stay dirty
+// in the cache until lookup_sync() writes them all out.
+*/
 struct name_cache_entry {
     Ident   name;
     cObjnum objnum;
     char    dirty;
     char    on_disk;
-} name_cache[NAME_CACHE_SIZE + 1];
+} name_cache[NAME_CACHE_SIZE][NAME_CACHE_WAYS];
 
 void lookup_open(char *name, Int cnew) {
-    Int i;
+    Int i, j;
 
 #ifdef USE_CLEANER_THREAD
     pthread_mutex_init(&lookup_mutex, NULL);
@@ -89,8 +99,10 @@ void lookup_open(char *name, Int cnew) {
     if (!dbp)
         fail_to_start("Cannot open dbm database file.");
 
-    for (i = 0; i < NAME_CACHE_SIZE; i++)
-        name_cache[i].name = NOT_AN_IDENT;
+    for (i = 0; i < NAME_CACHE_SIZE; i++) {
+        for (j = 0; j < NAME_CACHE_WAYS; j++)
+            name_cache[i][j].name = NOT_AN_IDENT;
+    }
 }
 
 void lookup_close(void) {
@@ -116,6 +128,22 @@ void lookup_sync(void) {
         panic("Cannot reopen dbm database file.");
 }
 
+/* Reopen the index after lookup_close(); forked decompile workers open it
+   read-only so they do not contend with the parent for the write lock. */
+void lookup_reopen(Bool readonly) {
+    char buf[255];
+
+    sprintf(buf, "%s/index", c_dir_binary);
+
+    if (readonly)
+        dbp = dbm_open(buf, O_RDONLY | O_BINARY, READ_WRITE);
+    else
+        dbp = dbm_open(buf, O_RDWR | O_BINARY, READ_WRITE);
+
+    if (!dbp)
+        panic("Cannot reopen dbm database file.");
+}
+
 Int lookup_retrieve_objnum(cObjnum objnum, off_t *offset, Int *size)
 {
     datum key, value;
@@ -198,72 +226,112 @@ cObjnum lookup_next_objnum(void)
     return lookup_next_objnum();
 }
 
+/* Find name in its set, moving it to the front. */
+static struct name_cache_entry *name_cache_find(Ident name)
+{
+    struct name_cache_entry *set = name_cache[name % NAME_CACHE_SIZE];
+    struct name_cache_entry entry;
+    Int i;
+
+    for (i = 0; i < NAME_CACHE_WAYS && set[i].name != NOT_AN_IDENT; i++) {
+        if (set[i].name == name) {
+            if (i) {
+                entry = set[i];
+                MEMMOVE(set + 1, set, i);
+                set[0] = entry;
+            }
+            return set;
+        }
+    }
+    return NULL;
+}
+
+/* Make room at the front of name's set and give it the entry.  The least
+ * recently used clean entry goes; if the whole set is dirty, it is all
+ * written out first. */
+static struct name_cache_entry *name_cache_add(Ident name)
+{
+    struct name_cache_entry *set = name_cache[name % NAME_CACHE_SIZE];
+    Int i;
+
+    for (i = NAME_CACHE_WAYS - 1; i > 0; i--) {
+        if (set[i].name == NOT_AN_IDENT || !set[i].dirty)
+            break;
+    }
+    if (!i && set[0].name != NOT_AN_IDENT && set[0].dirty) {
+        for (i = 0; i < NAME_CACHE_WAYS; i++) {
+            store_name(set[i].name, set[i].objnum);
+            set[i].dirty = 0;
+            set[i].on_disk = 1;
+        }
+        i = NAME_CACHE_WAYS - 1;
+    }
+
+    if (set[i].name != NOT_AN_IDENT)
+        ident_discard(set[i].name);
+    MEMMOVE(set + 1, set, i);
+    set[0].name = ident_dup(name);
+    return set;
+}
+
 Int lookup_retrieve_name(Ident name, cObjnum *objnum)
 {
-    Int i = name % NAME_CACHE_SIZE;
+    struct name_cache_entry *entry;
+    Int found;
 
     LOCK_LOOKUP("lookup_retrieve_name");
     /* See if it's in the cache. */
-    if (name_cache[i].name == name) {
+    if ((entry = name_cache_find(name)) != NULL) {
+        if (entry->objnum == INV_OBJNUM) {
+            name_cache_negative++;
+            UNLOCK_LOOKUP("lookup_retrieve_name");
+            return 0;
+        }
         name_cache_hits++;
-        *objnum = name_cache[i].objnum;
+        *objnum = entry->objnum;
         UNLOCK_LOOKUP("lookup_retrieve_name");
         return 1;
     }
 
     name_cache_misses++;
 
-    /* Get it from the database. */
-    if (!get_name(name, objnum)) {
-        UNLOCK_LOOKUP("lookup_retrieve_name");
-        return 0;
-    }
-
-    /* Discard the old cache entry if it exists. */
-    if (name_cache[i].name != NOT_AN_IDENT) {
-        if (name_cache[i].dirty)
-            store_name(name_cache[i].name, name_cache[i].objnum);
-        ident_discard(name_cache[i].name);
+    /* Get it from the database, remembering if it isn't there. */
+    entry = name_cache_add(name);
+    entry->dirty = 0;
+    if (get_name(name, objnum)) {
+        entry->objnum = *objnum;
+        entry->on_disk = 1;
+    } else {
+        entry->objnum = INV_OBJNUM;
+        entry->on_disk = 0;
     }
-
-    /* Make a new cache entry. */
-    name_cache[i].name = ident_dup(name);
-    name_cache[i].objnum = *objnum;
-    name_cache[i].dirty = 0;
-    name_cache[i].on_disk = 1;
+    found = entry->objnum != INV_OBJNUM;
 
     UNLOCK_LOOKUP("lookup_retrieve_name");
-    return 1;
+    return found;
 }
 
 Int lookup_store_name(Ident name, cObjnum objnum)
 {
-    Int i = name % NAME_CACHE_SIZE;
+    struct name_cache_entry *entry;
 
     LOCK_LOOKUP("lookup_store_name");
 
     /* See if it's in the cache. */
-    if (name_cache[i].name == name) {
-        if (name_cache[i].objnum != objnum) {
-            name_cache[i].objnum = objnum;
-            name_cache[i].dirty = 1;
+    if ((entry = name_cache_find(name)) != NULL) {
+        if (entry->objnum != objnum) {
+            entry->objnum = objnum;
+            entry->dirty = 1;
         }
         UNLOCK_LOOKUP("lookup_store_name");
         return 1;
     }
 
-    /* Discard the old cache entry if it exists. */
-    if (name_cache[i].name != NOT_AN_IDENT) {
-        if (name_cache[i].dirty)
-            store_name(name_cache[i].name, name_cache[i].objnum);
-        ident_discard(name_cache[i].name);
-    }
-
-    /* Make a new cache entry. */
-    name_cache[i].name = ident_dup(name);
-    name_cache[i].objnum = objnum;
-    name_cache[i].dirty = 1;
-    name_cache[i].on_disk = 0;
+    /* Make a new cache entry, written out at the next sync. */
+    entry = name_cache_add(name);
+    entry->objnum = objnum;
+    entry->dirty = 1;
+    entry->on_disk = 0;
 
     UNLOCK_LOOKUP("lookup_store_name");
     return 1;
@@ -271,21 +339,26 @@ Int lookup_store_name(Ident name, cObjnum objnum)
 
 Int lookup_remove_name(Ident name)
 {
+    struct name_cache_entry *entry;
     datum key;
-    Int i = name % NAME_CACHE_SIZE;
 
     LOCK_LOOKUP("lookup_remove_name");
-    /* See if it's in the cache. */
-    if (name_cache[i].name == name) {
-        /* Delete it from the cache.  If it's not on disk, then we're done. */
-        /*write_err("##lookup_remove_name %d %s", name_cache[i].name, ident_name(name_cache[i].name));*/
-        ident_discard(name_cache[i].name);
-        name_cache[i].name = NOT_AN_IDENT;
-        if (!name_cache[i].on_disk) {
-            UNLOCK_LOOKUP("lookup_remove_name");
-            return 1;
-        }
+
+    /* Keep it in the cache as missing; done unless it's on disk. */
+    if ((entry = name_cache_find(name)) == NULL) {
+        entry = name_cache_add(name);
+        entry->on_disk = 1;
+    } else if (entry->objnum == INV_OBJNUM) {
+        UNLOCK_LOOKUP("lookup_remove_name");
+        return 0;
+    }
+    entry->objnum = INV_OBJNUM;
+    entry->dirty = 0;
+    if (!entry->on_disk) {
+        UNLOCK_LOOKUP("lookup_remove_name");
+        return 1;
     }
+    entry->on_disk = 0;
 
     /* Remove the key from the database. */
     key = name_key(name);
@@ -369,15 +442,19 @@ static datum objnum_value(cObjnum objnum, Number_buf nbuf)
 
 static void sync_name_cache(void)
 {
-    Int i;
+    struct name_cache_entry *entry;
+    Int i, j;
 
     write_err ("Syncing lookup name cache...");
 
     for (i = 0; i < NAME_CACHE_SIZE; i++) {
-        if (name_cache[i].name != NOT_AN_IDENT && name_cache[i].dirty) {
-            store_name(name_cache[i].name, name_cache[i].objnum);
-            name_cache[i].dirty = 0;
-            name_cache[i].on_disk = 1;
+        for (j = 0; j < NAME_CACHE_WAYS; j++) {
+            entry = &name_cache[i][j];
+            if (entry->name != NOT_AN_IDENT && entry->dirty) {
+                store_name(entry->name, entry->objnum);
+                entry->dirty = 0;
+                entry->on_disk = 1;
+            }
         }
     }
 }
@@ -46,6 +46,7 @@ pthread_mutex_t lookup_mutex;
 
 Int name_cache_hits = 0;
 Int name_cache_misses = 0;
+Int name_cache_negative = 0;
 
 typedef struct _offset_size _offset_size;
 struct _offset_size {
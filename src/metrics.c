@@ -0,0 +1,191 @@
+/*
+// Full copyright information is available in the file ../doc/CREDITS
+//
+// Timing of the driver's main loop: how long each phase of a pass takes,
+// how late the loop wakes up, and how many tasks each pass starts.  Read
+// with driver_metrics(); with config('metrics_log) set, a summary of each
+// interval is also written to the error log as key=value pairs.
+*/
+
+#include "defs.h"
+
+#include <string.h>
+#include "util.h"
+#include "metrics.h"
+
+typedef struct phase_stats_s {
+    Long    count;
+    int64_t total;
+    int64_t max;
+    Long    buckets[METRIC_BUCKETS];
+
+    /* since the last log line */
+    Long    log_count;
+    int64_t log_total;
+    int64_t log_max;
+} phase_stats_t;
+
+static phase_stats_t phases[PHASES];
+static Long          iterations, tasks, tasks_max;
+static Long          log_iterations, log_tasks, log_tasks_max;
+static Long          log_bytes_in, log_bytes_out;
+static int64_t       last_log;
+
+/* counted by io.c */
+Long metrics_bytes_in, metrics_bytes_out;
+
+/*
+// --------------------------------------------------------------------
+// Record a phase which ran from start to end, in microseconds.
+*/
+void metrics_phase(Int phase, int64_t start, int64_t end) {
+    phase_stats_t * p = &phases[phase];
+    int64_t         t = (end > start) ? end - start : 0;
+    Int             b;
+
+    for (b = 0; b < METRIC_BUCKETS - 1 && (t >> b); b++);
+
+    p->count++;
+    p->total += t;
+    if (t > p->max)
+        p->max = t;
+    p->buckets[b]++;
+
+    p->log_count++;
+    p->log_total += t;
+    if (t > p->log_max)
+        p->log_max = t;
+}
+
+/* what happened since the last line, for config('metrics_log) */
+static void metrics_log_line(void) {
+    char            line[1024];
+    static char   * names[PHASES] = {
+        "io_wait", "input", "heartbeat", "output", "paused", "dump", "lag"
+    };
+    phase_stats_t * p;
+    Int             i, len;
+
+    len = snprintf(line, sizeof(line),
+                   "metrics iterations=%ld tasks=%ld tasks_max=%ld "
+                   "bytes_in=%ld bytes_out=%ld",
+                   (long) log_iterations, (long) log_tasks,
+                   (long) log_tasks_max,
+                   (long) (metrics_bytes_in - log_bytes_in),
+                   (long) (metrics_bytes_out - log_bytes_out));
+    for (i = 0; i < PHASES && len < (Int) sizeof(line); i++) {
+        p = &phases[i];
+        len += snprintf(line + len, sizeof(line) - len,
+                        " %s_n=%ld %s_avg=%ld %s_max=%ld",
+                        names[i], (long) p->log_count,
+                        names[i], (long) (p->log_count ?
+                                          p->log_total / p->log_count : 0),
+                        names[i], (long) p->log_max);
+        p->log_count = 0;
+        p->log_total = p->log_max = 0;
+    }
+    write_err("%s", line);
+
+    log_iterations = log_tasks = log_tasks_max = 0;
+    log_bytes_in = metrics_bytes_in;
+    log_bytes_out = metrics_bytes_out;
+}
+
+/*
+// --------------------------------------------------------------------
+// The end of a pass through the main loop, which started the given
+// number of tasks.  Writes the log line when one is due.
+*/
+void metrics_iteration(Long started, int64_t now) {
+    iterations++;
+    tasks += started;
+    if (started > tasks_max)
+        tasks_max = started;
+
+    log_iterations++;
+    log_tasks += started;
+    if (started > log_tasks_max)
+        log_tasks_max = started;
+
+    if (metrics_log <= 0) {
+        last_log = 0;
+    } else if (!last_log) {
+        last_log = now;
+    } else if (now - last_log >= (int64_t) metrics_log * 1000000) {
+        metrics_log_line();
+        last_log = now;
+    }
+}
+
+/*
+// --------------------------------------------------------------------
+// For driver_metrics():
+//
+//     [iterations, tasks, most tasks in one pass, bytes in, bytes out,
+//      [[phase, count, total usec, max usec, [histogram]], ...]]
+//
+// where the phases are 'io_wait, 'input, 'heartbeat, 'output, 'paused,
+// 'dump and 'lag.
+*/
+cList * metrics_info(void) {
+    Ident   ids[PHASES];
+    cList * out, * list;
+    cData * d, * e, * h;
+    Int     i, b;
+
+    ids[PHASE_IO_WAIT] = io_wait_id;
+    ids[PHASE_INPUT] = input_id;
+    ids[PHASE_HEARTBEAT] = heartbeat_id;
+    ids[PHASE_OUTPUT] = output_id;
+    ids[PHASE_PAUSED] = paused_id;
+    ids[PHASE_DUMP] = dump_id;
+    ids[PHASE_LAG] = lag_id;
+
+    list = list_new(PHASES);
+    d = list_empty_spaces(list, PHASES);
+    for (i = 0; i < PHASES; i++) {
+        d[i].type = LIST;
+        d[i].u.list = list_new(5);
+        e = list_empty_spaces(d[i].u.list, 5);
+        e[0].type = SYMBOL;
+        e[0].u.symbol = ident_dup(ids[i]);
+        e[1].type = INTEGER;
+        e[1].u.val = phases[i].count;
+        e[2].type = INTEGER;
+        e[2].u.val = (Long) phases[i].total;
+        e[3].type = INTEGER;
+        e[3].u.val = (Long) phases[i].max;
+        e[4].type = LIST;
+        e[4].u.list = list_new(METRIC_BUCKETS);
+        h = list_empty_spaces(e[4].u.list, METRIC_BUCKETS);
+        for (b = 0; b < METRIC_BUCKETS; b++) {
+            h[b].type = INTEGER;
+            h[b].u.val = phases[i].buckets[b];
+        }
+    }
+
+    out = list_new(6);
+    d = list_empty_spaces(out, 6);
+    d[0].type = INTEGER;
+    d[0].u.val = iterations;
+    d[1].type = INTEGER;
+    d[1].u.val = tasks;
+    d[2].type = INTEGER;
+    d[2].u.val = tasks_max;
+    d[3].type = INTEGER;
+    d[3].u.val = metrics_bytes_in;
+    d[4].type = INTEGER;
+    d[4].u.val = metrics_bytes_out;
+    d[5].type = LIST;
+    d[5].u.list = list;
+
+    return out;
+}
+
+void metrics_reset(void) {
+    memset(phases, 0, sizeof(phases));
+    iterations = tasks = tasks_max = 0;
+    log_iterations = log_tasks = log_tasks_max = 0;
+    metrics_bytes_in = metrics_bytes_out = 0;
+    log_bytes_in = log_bytes_out = 0;
+}
@@ -0,0 +1,624 @@
+/*
+// Full copyright information is available in the file ../doc/CREDITS
+*/
+
+/*
+// JSON (RFC 8259) to and from ColdC data, in one pass each way.
+//
+//   object          dictionary, keyed by strings
+//   array           list
+//   string          string, \u escapes decoded to UTF-8
+//   number          integer, or float if it has a fraction or exponent
+//                   or will not fit in an integer
+//   true false null the symbols 'true, 'false and 'null
+//
+// Encoding is the reverse; other symbols become strings, and the types
+// JSON has no room for (objnums, errors, frobs and buffers) are written
+// as strings holding their ColdC literal.  Both directions take an
+// optional nesting limit, JSON_MAX_DEPTH by default, and throw
+// ~maxdepth past it.
+*/
+
+#define NATIVE_MODULE "$json"
+
+#include <ctype.h>
+#include <math.h>
+#include "json.h"
+#include "util.h"
+
+#define JSON_MAX_DEPTH 128
+
+module_t json_module = {true, init_json, true, uninit_json};
+
+static Ident true_id, false_id, null_id;
+
+void init_json(Int argc, char ** argv) {
+    true_id = ident_get("true");
+    false_id = ident_get("false");
+    null_id = ident_get("null");
+}
+
+void uninit_json(void) {
+    ident_discard(true_id);
+    ident_discard(false_id);
+    ident_discard(null_id);
+}
+
+/*
+// -----------------------------------------------------------------------
+// Decoding.  The parser walks s..end once; on failure it sets error and
+// a message and every level unwinds returning 0.
+*/
+
+typedef struct {
+    uChar * start;
+    uChar * s;
+    uChar * end;
+    Int     depth;
+    Int     max_depth;
+    Ident   error;
+    char  * msg;
+} json_parser_t;
+
+static Int json_value(json_parser_t * p, cData * d);
+
+static Int json_fail(json_parser_t * p, Ident error, char * msg) {
+    if (p->error == NOT_AN_IDENT) {
+        p->error = error;
+        p->msg = msg;
+    }
+    return 0;
+}
+
+static void json_space(json_parser_t * p) {
+    while (p->s < p->end &&
+           (*p->s == ' ' || *p->s == '\t' || *p->s == '\n' || *p->s == '\r'))
+        p->s++;
+}
+
+static Int json_hex4(json_parser_t * p, uLong * code) {
+    Int i, c;
+
+    if (p->end - p->s < 4)
+        return json_fail(p, parse_id, "Truncated \\u escape");
+    for (*code = 0, i = 0; i < 4; i++) {
+        c = *p->s++;
+        if (!isxdigit(c))
+            return json_fail(p, parse_id, "Invalid \\u escape");
+        *code = (*code << 4) | (isdigit(c) ? c - '0' : LCASE(c) - 'a' + 10);
+    }
+    return 1;
+}
+
+static cStr * json_add_utf8(cStr * str, uLong code) {
+    char u[4];
+    Int  n;
+
+    if (code < 0x80) {
+        u[0] = (char) code;
+        n = 1;
+    } else if (code < 0x800) {
+        u[0] = (char) (0xC0 | (code >> 6));
+        u[1] = (char) (0x80 | (code & 0x3F));
+        n = 2;
+    } else if (code < 0x10000) {
+        u[0] = (char) (0xE0 | (code >> 12));
+        u[1] = (char) (0x80 | ((code >> 6) & 0x3F));
+        u[2] = (char) (0x80 | (code & 0x3F));
+        n = 3;
+    } else {
+        u[0] = (char) (0xF0 | (code >> 18));
+        u[1] = (char) (0x80 | ((code >> 12) & 0x3F));
+        u[2] = (char) (0x80 | ((code >> 6) & 0x3F));
+        u[3] = (char) (0x80 | (code & 0x3F));
+        n = 4;
+    }
+    return string_add_chars(str, u, n);
+}
+
+/* p->s is just past the opening quote */
+static cStr * json_string(json_parser_t * p) {
+    cStr  * str = string_new(0);
+    uChar * run;
+    uLong   code, low;
+
+    for (;;) {
+        /* copy plain runs in one go */
+        for (run = p->s; p->s < p->end && *p->s != '"' && *p->s != '\\'
+                         && *p->s >= 0x20; p->s++);
+        if (p->s > run)
+            str = string_add_chars(str, (char *) run, p->s - run);
+
+        if (p->s >= p->end) {
+            json_fail(p, parse_id, "Unterminated string");
+            break;
+        }
+        if (*p->s == '"') {
+            p->s++;
+            return str;
+        }
+        if (*p->s < 0x20) {
+            json_fail(p, parse_id, "Control character in string");
+            break;
+        }
+
+        /* an escape */
+        if (++p->s >= p->end) {
+            json_fail(p, parse_id, "Unterminated string");
+            break;
+        }
+        switch (*p->s++) {
+            case '"':  str = string_addc(str, '"');  break;
+            case '\\': str = string_addc(str, '\\'); break;
+            case '/':  str = string_addc(str, '/');  break;
+            case 'b':  str = string_addc(str, '\b'); break;
+            case 'f':  str = string_addc(str, '\f'); break;
+            case 'n':  str = string_addc(str, '\n'); break;
+            case 'r':  str = string_addc(str, '\r'); break;
+            case 't':  str = string_addc(str, '\t'); break;
+            case 'u':
+                if (!json_hex4(p, &code))
+                    goto fail;
+                /* a surrogate pair makes one code point; either half
+                   alone has no UTF-8 form */
+                if (code >= 0xD800 && code <= 0xDBFF) {
+                    if (p->end - p->s < 6 || p->s[0] != '\\' ||
+                        p->s[1] != 'u') {
+                        json_fail(p, parse_id, "Unpaired surrogate");
+                        goto fail;
+                    }
+                    p->s += 2;
+                    if (!json_hex4(p, &low))
+                        goto fail;
+                    if (low < 0xDC00 || low > 0xDFFF) {
+                        json_fail(p, parse_id, "Unpaired surrogate");
+                        goto fail;
+                    }
+                    code = 0x10000 + ((code - 0xD800) << 10)
+                                   + (low - 0xDC00);
+                } else if (code >= 0xDC00 && code <= 0xDFFF) {
+                    json_fail(p, parse_id, "Unpaired surrogate");
+                    goto fail;
+                }
+                str = json_add_utf8(str, code);
+                break;
+            default:
+                json_fail(p, parse_id, "Invalid escape in string");
+                goto fail;
+        }
+    }
+
+  fail:
+    string_discard(str);
+    return NULL;
+}
+
+static Int json_number(json_parser_t * p, cData * d) {
+    uChar * start = p->s;
+    Int     is_float = 0, digits;
+    char    num[64], * s;
+
+    if (p->s < p->end && *p->s == '-')
+        p->s++;
+    for (digits = 0; p->s < p->end && isdigit(*p->s); p->s++, digits++);
+    if (!digits || (digits > 1 && p->s[-digits] == '0'))
+        return json_fail(p, parse_id, "Invalid number");
+    if (p->s < p->end && *p->s == '.') {
+        is_float = 1;
+        for (p->s++, digits = 0; p->s < p->end && isdigit(*p->s);
+             p->s++, digits++);
+        if (!digits)
+            return json_fail(p, parse_id, "Invalid number");
+    }
+    if (p->s < p->end && (*p->s == 'e' || *p->s == 'E')) {
+        is_float = 1;
+        p->s++;
+        if (p->s < p->end && (*p->s == '+' || *p->s == '-'))
+            p->s++;
+        for (digits = 0; p->s < p->end && isdigit(*p->s); p->s++, digits++);
+        if (!digits)
+            return json_fail(p, parse_id, "Invalid number");
+    }
+
+    /* the text is not terminated, and may be long */
+    if (p->s - start >= (Long) sizeof(num)) {
+        s = (char *) emalloc(p->s - start + 1);
+    } else {
+        s = num;
+    }
+    memcpy(s, start, p->s - start);
+    s[p->s - start] = '\0';
+
+    if (!is_float) {
+        errno = 0;
+        d->u.val = (cNum) strtoll(s, NULL, 10);
+        if (errno == ERANGE)
+            is_float = 1;
+        else
+            d->type = INTEGER;
+    }
+    if (is_float) {
+        d->type = FLOAT;
+        d->u.fval = (cFloat) strtod(s, NULL);
+    }
+
+    if (s != num)
+        efree(s);
+    return 1;
+}
+
+static Int json_literal(json_parser_t * p, char * word, Ident sym,
+                        cData * d)
+{
+    Int len = strlen(word);
+
+    if (p->end - p->s < len || strncmp((char *) p->s, word, len))
+        return json_fail(p, parse_id, "Unexpected character");
+    p->s += len;
+    d->type = SYMBOL;
+    d->u.symbol = ident_dup(sym);
+    return 1;
+}
+
+static Int json_array(json_parser_t * p, cData * d) {
+    cList * list = list_new(0);
+    cData   elem;
+
+    json_space(p);
+    if (p->s < p->end && *p->s == ']') {
+        p->s++;
+    } else {
+        for (;;) {
+            if (!json_value(p, &elem))
+                goto fail;
+            list = list_add(list, &elem);
+            data_discard(&elem);
+            json_space(p);
+            if (p->s < p->end && *p->s == ',') {
+                p->s++;
+                continue;
+            }
+            if (p->s < p->end && *p->s == ']') {
+                p->s++;
+                break;
+            }
+            json_fail(p, parse_id, "Expected ',' or ']'");
+            goto fail;
+        }
+    }
+
+    d->type = LIST;
+    d->u.list = list;
+    return 1;
+
+  fail:
+    list_discard(list);
+    return 0;
+}
+
+static Int json_object(json_parser_t * p, cData * d) {
+    cDict * dict = dict_new_empty();
+    cData   key, value;
+
+    json_space(p);
+    if (p->s < p->end && *p->s == '}') {
+        p->s++;
+    } else {
+        for (;;) {
+            json_space(p);
+            if (p->s >= p->end || *p->s != '"') {
+                json_fail(p, parse_id, "Expected a string key");
+                goto fail;
+            }
+            p->s++;
+            key.type = STRING;
+            if (!(key.u.str = json_string(p)))
+                goto fail;
+            json_space(p);
+            if (p->s >= p->end || *p->s != ':') {
+                string_discard(key.u.str);
+                json_fail(p, parse_id, "Expected ':'");
+                goto fail;
+            }
+            p->s++;
+            if (!json_value(p, &value)) {
+                string_discard(key.u.str);
+                goto fail;
+            }
+            dict = dict_add(dict, &key, &value);
+            data_discard(&key);
+            data_discard(&value);
+            json_space(p);
+            if (p->s < p->end && *p->s == ',') {
+                p->s++;
+                continue;
+            }
+            if (p->s < p->end && *p->s == '}') {
+                p->s++;
+                break;
+            }
+            json_fail(p, parse_id, "Expected ',' or '}'");
+            goto fail;
+        }
+    }
+
+    d->type = DICT;
+    d->u.dict = dict;
+    return 1;
+
+  fail:
+    dict_discard(dict);
+    return 0;
+}
+
+static Int json_value(json_parser_t * p, cData * d) {
+    Int r;
+
+    json_space(p);
+    if (p->s >= p->end)
+        return json_fail(p, parse_id, "Unexpected end of input");
+
+    switch (*p->s) {
+        case '{':
+        case '[':
+            if (++p->depth > p->max_depth)
+                return json_fail(p, maxdepth_id, "Nesting is too deep");
+            r = (*p->s++ == '{') ? json_object(p, d) : json_array(p, d);
+            p->depth--;
+            return r;
+        case '"':
+            p->s++;
+            d->type = STRING;
+            return (d->u.str = json_string(p)) != NULL;
+        case 't':
+            return json_literal(p, "true", true_id, d);
+        case 'f':
+            return json_literal(p, "false", false_id, d);
+        case 'n':
+            return json_literal(p, "null", null_id, d);
+        default:
+            if (*p->s == '-' || isdigit(*p->s))
+                return json_number(p, d);
+            return json_fail(p, parse_id, "Unexpected character");
+    }
+}
+
+static Int json_decode(uChar * s, Int len, Int max_depth, cData * d) {
+    json_parser_t p;
+
+    p.start = p.s = s;
+    p.end = s + len;
+    p.depth = 0;
+    p.max_depth = max_depth;
+    p.error = NOT_AN_IDENT;
+    p.msg = NULL;
+
+    if (json_value(&p, d)) {
+        json_space(&p);
+        if (p.s == p.end)
+            return 1;
+        data_discard(d);
+        json_fail(&p, parse_id, "Trailing characters");
+    }
+
+    cthrow(p.error, "%s at byte %d.", p.msg, (Int) (p.s - p.start) + 1);
+    return 0;
+}
+
+/*
+// -----------------------------------------------------------------------
+// Encoding, appended to one string as the data is walked.
+*/
+
+static cStr * json_encode_string(cStr * out, char * s, Int len) {
+    static char hex[] = "0123456789abcdef";
+    char      * run, esc[6];
+    char      * end = s + len;
+
+    out = string_addc(out, '"');
+    while (s < end) {
+        for (run = s; s < end && *s != '"' && *s != '\\' &&
+                      (uChar) *s >= 0x20; s++);
+        if (s > run)
+            out = string_add_chars(out, run, s - run);
+        if (s >= end)
+            break;
+        switch (*s) {
+            case '"':  out = string_add_chars(out, "\\\"", 2); break;
+            case '\\': out = string_add_chars(out, "\\\\", 2); break;
+            case '\b': out = string_add_chars(out, "\\b", 2);  break;
+            case '\f': out = string_add_chars(out, "\\f", 2);  break;
+            case '\n': out = string_add_chars(out, "\\n", 2);  break;
+            case '\r': out = string_add_chars(out, "\\r", 2);  break;
+            case '\t': out = string_add_chars(out, "\\t", 2);  break;
+            default:
+                esc[0] = '\\';
+                esc[1] = 'u';
+                esc[2] = '0';
+                esc[3] = '0';
+                esc[4] = hex[(*s >> 4) & 0xF];
+                esc[5] = hex[*s & 0xF];
+                out = string_add_chars(out, esc, 6);
+        }
+        s++;
+    }
+    return string_addc(out, '"');
+}
+
+static cStr * json_encode(cStr * out, cData * d, Int depth, Int max_depth,
+                          Int * ok)
+{
+    char    num[64];
+    cStr  * str;
+    cData * keys, * values;
+    Int     i, len, prec;
+
+    switch (d->type) {
+        case INTEGER:
+            sprintf(num, "%lld", (long long) d->u.val);
+            return string_add_chars(out, num, strlen(num));
+
+        case FLOAT:
+            if (!isfinite(d->u.fval)) {
+                cthrow(type_id, "%D cannot be represented in JSON.", d);
+                *ok = 0;
+                return out;
+            }
+            /* the shortest form which reads back as the same float */
+            prec = (sizeof(cFloat) == sizeof(double)) ? 15 : 6;
+            do {
+                sprintf(num, "%.*g", prec++, (double) d->u.fval);
+            } while ((cFloat) strtod(num, NULL) != d->u.fval && prec <= 17);
+            /* keep it a float when read back */
+            if (!strpbrk(num, ".eE"))
+                strcat(num, ".0");
+            return string_add_chars(out, num, strlen(num));
+
+        case STRING:
+            return json_encode_string(out, string_chars(d->u.str),
+                                      string_length(d->u.str));
+
+        case SYMBOL:
+            if (d->u.symbol == true_id)
+                return string_add_chars(out, "true", 4);
+            if (d->u.symbol == false_id)
+                return string_add_chars(out, "false", 5);
+            if (d->u.symbol == null_id)
+                return string_add_chars(out, "null", 4);
+            return json_encode_string(out, ident_name(d->u.symbol),
+                                      strlen(ident_name(d->u.symbol)));
+
+        case LIST:
+        case DICT:
+            if (depth >= max_depth) {
+                cthrow(maxdepth_id, "Nesting is deeper than %d.", max_depth);
+                *ok = 0;
+                return out;
+            }
+            break;
+
+        default:
+            str = data_to_literal(d, DF_WITH_OBJNAMES);
+            out = json_encode_string(out, string_chars(str),
+                                     string_length(str));
+            string_discard(str);
+            return out;
+    }
+
+    if (d->type == LIST) {
+        len = list_length(d->u.list);
+        values = list_first(d->u.list);
+        out = string_addc(out, '[');
+        for (i = 0; i < len && *ok; i++) {
+            if (i)
+                out = string_addc(out, ',');
+            out = json_encode(out, &values[i], depth + 1, max_depth, ok);
+        }
+        return string_addc(out, ']');
+    }
+
+    len = list_length(d->u.dict->keys);
+    keys = list_first(d->u.dict->keys);
+    values = list_first(d->u.dict->values);
+    out = string_addc(out, '{');
+    for (i = 0; i < len && *ok; i++) {
+        if (i)
+            out = string_addc(out, ',');
+        /* JSON keys are strings, so other keys are written as literals */
+        if (keys[i].type == STRING) {
+            out = json_encode(out, &keys[i], depth + 1, max_depth, ok);
+        } else {
+            str = data_to_literal(&keys[i], DF_WITH_OBJNAMES);
+            out = json_encode_string(out, string_chars(str),
+                                     string_length(str));
+            string_discard(str);
+        }
+        out = string_addc(out, ':');
+        out = json_encode(out, &values[i], depth + 1, max_depth, ok);
+    }
+    return string_addc(out, '}');
+}
+
+/*
+// -----------------------------------------------------------------------
+*/
+
+static Int json_depth_arg(cData * args, Int argc, Int * depth) {
+    *depth = JSON_MAX_DEPTH;
+    if (argc == 2) {
+        if (args[1].u.val < 1)
+            THROW((range_id, "Depth limit (%d) must be positive.",
+                   args[1].u.val));
+        *depth = (Int) args[1].u.val;
+    }
+    RETURN_TRUE;
+}
+
+/* hand the decoded value to the stack, which takes the reference */
+static void json_push(cData * d) {
+    switch (d->type) {
+        case INTEGER: native_push_int(d->u.val);       break;
+        case FLOAT:   native_push_float(d->u.fval);    break;
+        case STRING:  native_push_string(d->u.str);    break;
+        case SYMBOL:  native_push_symbol(d->u.symbol); break;
+        case LIST:    native_push_list(d->u.list);     break;
+        case DICT:    native_push_dict(d->u.dict);     break;
+    }
+}
+
+NATIVE_METHOD(encode_json) {
+    cStr * out;
+    Int    depth, ok = 1;
+
+    DEF_args;
+    DEF_argc;
+
+    CHECK_BINDING
+    if (argc < 1 || argc > 2)
+        THROW_NUM_ERROR(argc, "one or two");
+    INIT_OPT_ARG2(INTEGER);
+    if (!json_depth_arg(args, argc, &depth))
+        RETURN_FALSE;
+
+    out = json_encode(string_new(0), &args[0], 0, depth, &ok);
+    if (!ok) {
+        string_discard(out);
+        RETURN_FALSE;
+    }
+
+    CLEAN_RETURN_STRING(out);
+}
+
+NATIVE_METHOD(decode_json) {
+    cData d;
+    Int   depth;
+
+    INIT_1_OR_2_ARGS(STRING, INTEGER);
+    if (!json_depth_arg(args, argc, &depth))
+        RETURN_FALSE;
+
+    if (!json_decode((uChar *) string_chars(STR1), string_length(STR1),
+                     depth, &d))
+        RETURN_FALSE;
+
+    CLEAN_STACK();
+    json_push(&d);
+    RETURN_TRUE;
+}
+
+NATIVE_METHOD(decode_json_buffer) {
+    cData d;
+    Int   depth;
+
+    INIT_1_OR_2_ARGS(BUFFER, INTEGER);
+    if (!json_depth_arg(args, argc, &depth))
+        RETURN_FALSE;
+
+    if (!json_decode(BUF1->s, BUF1->len, depth, &d))
+        RETURN_FALSE;
+
+    CLEAN_STACK();
+    json_push(&d);
+    RETURN_TRUE;
+}
+
@@ -0,0 +1,18 @@
+#ifndef _json_h_
+#define _json_h_
+
+#include "defs.h"
+#include "cdc_pcode.h"
+
+void init_json(Int argc, char ** argv);
+void uninit_json(void);
+
+#ifndef _json_
+extern module_t json_module;
+#endif
+
+NATIVE_METHOD(encode_json);
+NATIVE_METHOD(decode_json);
+NATIVE_METHOD(decode_json_buffer);
+
+#endif
@@ -0,0 +1,5 @@
+##     object  method          function
+native $json.encode()          encode_json
+native $json.decode()          decode_json
+native $json.decode_buffer()   decode_json_buffer
+objs json.o
@@ -24,6 +24,8 @@
 
 #define NATIVE_MODULE "$http"
 
+#include <ctype.h>
+#include <limits.h>
 #include "web.h"
 #include "util.h"
 
@@ -217,6 +219,550 @@ NATIVE_METHOD(encode) {
     CLEAN_RETURN_STRING(str);
 }
 
+/*
+// -----------------------------------------------------------------------
+// HTTP/1.1 requests (RFC 7230).
+//
+// http_parse() looks for one whole request at the front of buf, which
+// is whatever has arrived on the connection so far.  It returns 0 if the
+// request is still incomplete (call again once more has been read), -1
+// with *err set if it is malformed, or the length of the request; the
+// request line, headers and decoded body are filled into req.  A body
+// is only copied out once all of it has arrived, and one larger than
+// HTTP_MAX_BODY is refused, which bounds the work of parsing the same
+// incomplete request again on every read.
+*/
+
+#define HTTP_MAX_HEADER  65536     /* request line and headers */
+#define HTTP_MAX_BODY    16777216  /* body as sent, chunk framing included */
+
+typedef struct {
+    cStr  * method;
+    cStr  * uri;
+    cStr  * version;
+    cDict * headers;               /* lowercased name: value */
+    cBuf  * body;
+    Int     keep_alive;
+} http_req_t;
+
+static void http_req_free(http_req_t * req) {
+    if (req->method)
+        string_discard(req->method);
+    if (req->uri)
+        string_discard(req->uri);
+    if (req->version)
+        string_discard(req->version);
+    if (req->headers)
+        dict_discard(req->headers);
+    if (req->body)
+        buffer_discard(req->body);
+}
+
+/* the end of the line starting at s (its '\n'), or NULL */
+static uChar * http_line(uChar * s, uChar * end, uChar ** next) {
+    uChar * nl = (uChar *) memchr(s, '\n', end - s);
+
+    if (!nl)
+        return NULL;
+    *next = nl + 1;
+    if (nl > s && nl[-1] == '\r')
+        nl--;
+    return nl;
+}
+
+static cStr * http_header(cDict * headers, char * name) {
+    cData key, value;
+    cStr * str;
+
+    key.type = STRING;
+    key.u.str = string_from_chars(name, strlen(name));
+    str = (dict_find(headers, &key, &value) == NOT_AN_IDENT) ? value.u.str
+                                                               : NULL;
+    string_discard(key.u.str);
+    return str;
+}
+
+/* does the comma separated list in str contain token? */
+static Int http_has_token(cStr * str, char * token) {
+    char * s = string_chars(str), * e;
+    Int    len = strlen(token), n;
+
+    while (*s) {
+        while (*s == ' ' || *s == '\t' || *s == ',')
+            s++;
+        for (e = s; *e && *e != ','; e++);
+        for (n = e - s; n && (s[n-1] == ' ' || s[n-1] == '\t'); n--);
+        if (n == len && !strncasecmp(s, token, len))
+            return 1;
+        s = e;
+    }
+    return 0;
+}
+
+static Int http_parse_headers(uChar ** sp, uChar * end, cDict ** headers,
+                              char ** err)
+{
+    uChar * s = *sp, * e, * next, * colon, * v;
+    cData   key, value, old;
+    cStr  * str, * last = NULL;
+    Int     r = 1;
+
+    for (;;) {
+        if (!(e = http_line(s, end, &next))) {
+            r = 0;
+            break;
+        }
+        if (e == s)
+            break;
+
+        if (*s == ' ' || *s == '\t') {
+            /* obsolete line folding, continues the header on the line
+               before, which need not be the dictionary's last key */
+            if (!last) {
+                *err = "Continuation line without a header";
+                r = -1;
+                break;
+            }
+            for (v = s; v < e && (*v == ' ' || *v == '\t'); v++);
+            key.type = STRING;
+            key.u.str = string_dup(last);
+            dict_find(*headers, &key, &old);
+            str = string_addc(old.u.str, ' ');
+            value.type = STRING;
+            value.u.str = string_add_chars(str, (char *) v, e - v);
+            *headers = dict_add(*headers, &key, &value);
+            data_discard(&key);
+            data_discard(&value);
+            s = next;
+            continue;
+        }
+
+        colon = (uChar *) memchr(s, ':', e - s);
+        if (!colon || colon == s || colon[-1] == ' ' || colon[-1] == '\t') {
+            *err = "Malformed header line";
+            r = -1;
+            break;
+        }
+        for (v = colon + 1; v < e && (*v == ' ' || *v == '\t'); v++);
+        while (e > v && (e[-1] == ' ' || e[-1] == '\t'))
+            e--;
+
+        key.type = STRING;
+        key.u.str = string_lowercase(string_from_chars((char *) s,
+                                                       colon - s));
+        value.type = STRING;
+        if (dict_find(*headers, &key, &old) == NOT_AN_IDENT) {
+            /* repeated fields are one comma separated list */
+            str = string_add_chars(old.u.str, ", ", 2);
+            value.u.str = string_add_chars(str, (char *) v, e - v);
+        } else {
+            value.u.str = string_from_chars((char *) v, e - v);
+        }
+        *headers = dict_add(*headers, &key, &value);
+        if (last)
+            string_discard(last);
+        last = string_dup(key.u.str);
+        data_discard(&key);
+        data_discard(&value);
+        s = next;
+    }
+
+    if (last)
+        string_discard(last);
+    if (r == 1)
+        *sp = next;
+    return r;
+}
+
+/*
+// Chunked body at *sp: 1 with *sp past the last chunk, 0 if incomplete,
+// -1 if malformed.  The chunks are appended to *body when it is given,
+// so the first pass over an incomplete request copies nothing.
+*/
+static Int http_chunked(uChar ** sp, uChar * end, cBuf ** body,
+                        char ** err) {
+    uChar * s = *sp, * start = *sp, * e, * next, * p;
+    Long    len;
+
+    for (;;) {
+        if (s - start > HTTP_MAX_BODY) {
+            *err = "Request body too large";
+            return -1;
+        }
+        if (!(e = http_line(s, end, &next)))
+            return 0;
+        for (len = 0, p = s; p < e && isxdigit(*p); p++) {
+            if (len > (INT_MAX >> 4)) {
+                *err = "Chunk too large";
+                return -1;
+            }
+            len = len * 16 + (isdigit(*p) ? *p - '0'
+                                          : LCASE(*p) - 'a' + 10);
+        }
+        if (p == s || (p < e && *p != ';' && *p != ' ' && *p != '\t')) {
+            *err = "Malformed chunk size";
+            return -1;
+        }
+        s = next;
+        if (!len)
+            break;
+        if (len > HTTP_MAX_BODY) {
+            *err = "Request body too large";
+            return -1;
+        }
+        if (end - s < len)
+            return 0;
+        if (body)
+            *body = buffer_append_uchars(*body, s, len);
+        s += len;
+        if (!(e = http_line(s, end, &next)))
+            return 0;
+        if (e != s) {
+            *err = "Malformed chunk";
+            return -1;
+        }
+        s = next;
+    }
+
+    *sp = s;
+    return 1;
+}
+
+static Long http_parse(cBuf * buf, http_req_t * req, char ** err) {
+    uChar * s = buf->s, * end = buf->s + buf->len, * e, * next, * p, * q;
+    cStr  * te, * cl, * conn;
+    Long    len, n;
+    Int     r;
+
+    /* tolerate blank lines ahead of the request line */
+    while (s < end && (*s == '\r' || *s == '\n'))
+        s++;
+
+    if (!(e = http_line(s, end, &next))) {
+        if (end - s > HTTP_MAX_HEADER) {
+            *err = "Request line too long";
+            return -1;
+        }
+        return 0;
+    }
+
+    /* method SP request-target SP HTTP-version */
+    p = (uChar *) memchr(s, ' ', e - s);
+    q = p ? (uChar *) memchr(p + 1, ' ', e - p - 1) : NULL;
+    if (!p || !q || p == s || q == p + 1 || e - q < 6 ||
+        strncmp((char *) q + 1, "HTTP/", 5)) {
+        *err = "Malformed request line";
+        return -1;
+    }
+    req->method = string_from_chars((char *) s, p - s);
+    req->uri = string_from_chars((char *) p + 1, q - p - 1);
+    req->version = string_from_chars((char *) q + 1, e - q - 1);
+
+    s = next;
+    req->headers = dict_new_empty();
+    if ((r = http_parse_headers(&s, end, &req->headers, err)) <= 0) {
+        if (!r && end - buf->s > HTTP_MAX_HEADER) {
+            *err = "Request headers too long";
+            return -1;
+        }
+        return r;
+    }
+
+    /* persistent unless asked otherwise; HTTP/1.0 must ask for it */
+    conn = http_header(req->headers, "connection");
+    if (!strcmp(string_chars(req->version), "HTTP/1.0"))
+        req->keep_alive = conn && http_has_token(conn, "keep-alive");
+    else
+        req->keep_alive = !(conn && http_has_token(conn, "close"));
+    if (conn)
+        string_discard(conn);
+
+    te = http_header(req->headers, "transfer-encoding");
+    cl = http_header(req->headers, "content-length");
+    req->body = buffer_new(0);
+
+    if (te) {
+        /* chunked must be the final coding, and wins over a length */
+        r = http_has_token(te, "chunked");
+        string_discard(te);
+        if (cl)
+            string_discard(cl);
+        if (!r) {
+            *err = "Unsupported transfer coding";
+            return -1;
+        }
+        /* find the end before copying anything out */
+        p = s;
+        if ((r = http_chunked(&p, end, NULL, err)) <= 0)
+            return r;
+        http_chunked(&s, end, &req->body, err);
+        /* trailer fields are merged into the headers */
+        if ((r = http_parse_headers(&s, end, &req->headers, err)) <= 0)
+            return r;
+    } else if (cl) {
+        for (len = 0, p = (uChar *) string_chars(cl); isdigit(*p); p++) {
+            n = len * 10 + (*p - '0');
+            if (n > INT_MAX)
+                break;
+            len = n;
+        }
+        r = (*p != '\0' || p == (uChar *) string_chars(cl));
+        string_discard(cl);
+        if (r) {
+            *err = "Malformed content-length";
+            return -1;
+        }
+        if (len > HTTP_MAX_BODY) {
+            *err = "Request body too large";
+            return -1;
+        }
+        if (end - s < len)
+            return 0;
+        req->body = buffer_append_uchars(req->body, s, len);
+        s += len;
+    }
+
+    return s - buf->s;
+}
+
+/*
+// -----------------------------------------------------------------------
+// Responses.  The status line and headers, framed either with a
+// content-length for a whole body, or with chunked transfer coding to be
+// followed by $http.chunk() calls.
+*/
+
+static char * http_reason(Int status) {
+    switch (status) {
+        case 100: return "Continue";
+        case 101: return "Switching Protocols";
+        case 200: return "OK";
+        case 201: return "Created";
+        case 202: return "Accepted";
+        case 204: return "No Content";
+        case 206: return "Partial Content";
+        case 301: return "Moved Permanently";
+        case 302: return "Found";
+        case 303: return "See Other";
+        case 304: return "Not Modified";
+        case 307: return "Temporary Redirect";
+        case 308: return "Permanent Redirect";
+        case 400: return "Bad Request";
+        case 401: return "Unauthorized";
+        case 403: return "Forbidden";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 408: return "Request Timeout";
+        case 409: return "Conflict";
+        case 411: return "Length Required";
+        case 413: return "Content Too Large";
+        case 414: return "URI Too Long";
+        case 415: return "Unsupported Media Type";
+        case 426: return "Upgrade Required";
+        case 429: return "Too Many Requests";
+        case 500: return "Internal Server Error";
+        case 501: return "Not Implemented";
+        case 502: return "Bad Gateway";
+        case 503: return "Service Unavailable";
+        case 504: return "Gateway Timeout";
+        case 505: return "HTTP Version Not Supported";
+    }
+    return "Unknown";
+}
+
+static cBuf * http_add(cBuf * buf, char * s) {
+    return buffer_append_uchars(buf, (uChar *) s, strlen(s));
+}
+
+static cBuf * http_add_data(cBuf * buf, cData * d) {
+    cStr * str;
+
+    switch (d->type) {
+        case STRING:
+            return buffer_append_uchars(buf, (uChar *) string_chars(d->u.str),
+                                        string_length(d->u.str));
+        case BUFFER:
+            return buffer_append(buf, d->u.buffer);
+        default:
+            str = data_to_literal(d, DF_WITH_OBJNAMES);
+            buf = buffer_append_uchars(buf, (uChar *) string_chars(str),
+                                       string_length(str));
+            string_discard(str);
+            return buf;
+    }
+}
+
+/* a header name or value as written from buf->s + from; CR and LF would
+   end the field early, and a ':' the name */
+static Int http_field_ok(cBuf * buf, Int from, Int is_name) {
+    uChar * s = buf->s + from, * end = buf->s + buf->len;
+
+    if (is_name && s == end)
+        return 0;
+    for (; s < end; s++) {
+        if (*s == '\r' || *s == '\n' || (is_name && *s == ':'))
+            return 0;
+    }
+    return 1;
+}
+
+static cBuf * http_chunk(cBuf * buf, uChar * s, Int len) {
+    char size[24];
+
+    sprintf(size, "%lx\r\n", (unsigned long) len);
+    buf = http_add(buf, size);
+    if (len) {
+        buf = buffer_append_uchars(buf, s, len);
+        buf = http_add(buf, "\r\n");
+    } else {
+        buf = http_add(buf, "\r\n");
+    }
+    return buf;
+}
+
+NATIVE_METHOD(parse_request) {
+    http_req_t req;
+    cList    * list;
+    cData    * d;
+    cBuf     * rest;
+    char     * err = NULL;
+    Long       len;
+
+    INIT_1_ARG(BUFFER);
+
+    memset(&req, 0, sizeof(req));
+    len = http_parse(BUF1, &req, &err);
+
+    if (len == -1) {
+        http_req_free(&req);
+        THROW((parse_id, "%s.", err));
+    }
+    if (!len) {
+        http_req_free(&req);
+        CLEAN_RETURN_INTEGER(0);
+    }
+
+    rest = buffer_subrange(buffer_dup(BUF1), len, BUF1->len - len);
+
+    list = list_new(7);
+    d = list_empty_spaces(list, 7);
+    d[0].type = STRING;
+    d[0].u.str = req.method;
+    d[1].type = STRING;
+    d[1].u.str = req.uri;
+    d[2].type = STRING;
+    d[2].u.str = req.version;
+    d[3].type = DICT;
+    d[3].u.dict = req.headers;
+    d[4].type = BUFFER;
+    d[4].u.buffer = req.body;
+    d[5].type = INTEGER;
+    d[5].u.val = req.keep_alive;
+    d[6].type = BUFFER;
+    d[6].u.buffer = rest;
+
+    CLEAN_RETURN_LIST(list);
+}
+
+NATIVE_METHOD(response) {
+    cBuf  * buf;
+    cDict * headers;
+    cData * name, * value;
+    char    line[64];
+    Int     i, from, status, has_length = 0, no_body;
+
+    DEF_args;
+    DEF_argc;
+
+    CHECK_BINDING
+    if (argc < 2 || argc > 3)
+        THROW_NUM_ERROR(argc, "two or three");
+    INIT_ARG1(INTEGER);
+    INIT_ARG2(DICT);
+    if (argc == 3 && args[2].type != STRING && args[2].type != BUFFER)
+        THROW((type_id, "The third argument (%D) is not a string or buffer.",
+               &args[2]));
+
+    status = INT1;
+    if (status < 100 || status > 999)
+        THROW((range_id, "Status %d is not a valid HTTP status.", status));
+    headers = DICT2;
+    /* 1xx, 204 and 304 responses never carry a body */
+    no_body = (status < 200 || status == 204 || status == 304);
+
+    buf = buffer_new(0);
+    sprintf(line, "HTTP/1.1 %d ", status);
+    buf = http_add(buf, line);
+    buf = http_add(buf, http_reason(status));
+    buf = http_add(buf, "\r\n");
+
+    for (i = 0; i < headers->keys->len; i++) {
+        name = &headers->keys->el[i];
+        value = &headers->values->el[i];
+        if (name->type == STRING &&
+            (!strcasecmp(string_chars(name->u.str), "content-length") ||
+             !strcasecmp(string_chars(name->u.str), "transfer-encoding")))
+            has_length = 1;
+        from = buf->len;
+        buf = http_add_data(buf, name);
+        if (!http_field_ok(buf, from, 1)) {
+            buffer_discard(buf);
+            THROW((type_id, "Header name %D is empty or contains CR, LF "
+                   "or ':'.", name));
+        }
+        buf = http_add(buf, ": ");
+        from = buf->len;
+        buf = http_add_data(buf, value);
+        if (!http_field_ok(buf, from, 0)) {
+            buffer_discard(buf);
+            THROW((type_id, "Header value %D contains CR or LF.", value));
+        }
+        buf = http_add(buf, "\r\n");
+    }
+
+    if (!has_length && !no_body) {
+        if (argc == 3) {
+            sprintf(line, "Content-Length: %ld\r\n", (long)
+                    (args[2].type == STRING ? string_length(args[2].u.str)
+                                            : args[2].u.buffer->len));
+            buf = http_add(buf, line);
+        } else {
+            buf = http_add(buf, "Transfer-Encoding: chunked\r\n");
+        }
+    }
+    buf = http_add(buf, "\r\n");
+
+    if (argc == 3 && !no_body)
+        buf = http_add_data(buf, &args[2]);
+
+    CLEAN_RETURN_BUFFER(buf);
+}
+
+NATIVE_METHOD(chunk) {
+    cBuf * buf = buffer_new(0);
+
+    DEF_args;
+    DEF_argc;
+
+    CHECK_BINDING
+    if (argc > 1)
+        THROW_NUM_ERROR(argc, "zero or one");
+    if (argc && args[0].type != STRING && args[0].type != BUFFER)
+        THROW((type_id, "The first argument (%D) is not a string or buffer.",
+               &args[0]));
+
+    /* an empty or missing chunk is the last one */
+    if (!argc)
+        buf = http_chunk(buf, NULL, 0);
+    else if (args[0].type == STRING)
+        buf = http_chunk(buf, (uChar *) string_chars(args[0].u.str),
+                         string_length(args[0].u.str));
+    else
+        buf = http_chunk(buf, args[0].u.buffer->s, args[0].u.buffer->len);
+
+    CLEAN_RETURN_BUFFER(buf);
+}
+
 NATIVE_METHOD(html_escape) {
     cStr * new, * orig;
 
@@ -14,5 +14,8 @@ extern module_t web_module;
 NATIVE_METHOD(decode);
 NATIVE_METHOD(encode);
 NATIVE_METHOD(html_escape);
+NATIVE_METHOD(parse_request);
+NATIVE_METHOD(response);
+NATIVE_METHOD(chunk);
 
 #endif
@@ -1,5 +1,8 @@
 ##     object  method          function
 native $http.decode()          decode
 native $http.encode()          encode
+native $http.parse_request()   parse_request
+native $http.response()        response
+native $http.chunk()           chunk
 native $string.html_escape()   html_escape
 objs web.o
@@ -5,6 +5,7 @@
 */
 
 #define _BSD 44 /* For RS6000s. */
+#define _GNU_SOURCE /* accept4(), recvmmsg() and sendmmsg() */
 #include "defs.h"
 
 #include <sys/types.h>
@@ -17,6 +18,12 @@
 #include <arpa/inet.h>
 #include <netdb.h>
 #endif
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
 #include <ctype.h>
 #include <fcntl.h>
 #include "net.h"
@@ -26,17 +33,33 @@ cBuf * socket_buffer;
 
 static SOCKET grab_port(unsigned short port, char * addr, int socktype);
 static Long translate_connect_error(Int error);
+static SOCKET accept_client(SOCKET server_socket);
 
 static struct sockaddr_in sockin;        /* An internet address. */
 static socklen_t addr_size = sizeof(sockin);        /* Size of sockin. */
 
 Long server_failure_reason;
+net_stats_t net_stats;
+
+/* What a connection is watched for, kept in conn->events. */
+#define NET_READ    1
+#define NET_WRITE   2
+#define NET_ADDED   4   /* registered with the epoll set */
+
+#ifdef HAVE_SYS_EPOLL_H
+#define EPOLL_BATCH 256
+static int epoll_fd = -1;
+#endif
 
 void init_net(void) {
 #ifdef __Win32__
     WSADATA wsa;
 
     WSAStartup(0x0101, &wsa);
+#endif
+#ifdef HAVE_SYS_EPOLL_H
+    /* if this fails we fall back on walking the connection table */
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
 #endif
     socket_buffer = buffer_new(BIGBUF);
 }
@@ -44,10 +67,201 @@ void init_net(void) {
 void uninit_net(void) {
 #ifdef __Win32__
     WSACleanup();
+#endif
+#ifdef HAVE_SYS_EPOLL_H
+    if (epoll_fd != -1) {
+        close(epoll_fd);
+        epoll_fd = -1;
+    }
 #endif
     buffer_discard(socket_buffer);
 }
 
+/*
+// -------------------------------------------------------------------
+// Send up to len bytes of fd from *offset on sock, advancing *offset.
+// With sendfile() the data goes from the page cache to the socket
+// without passing through the driver; elsewhere it is read a chunk at a
+// time.  Returns the count sent (0 at the end of the file), or
+// SOCKET_ERROR.
+*/
+Long net_sendfile(SOCKET sock, int fd, off_t *offset, Long len) {
+#ifdef HAVE_SYS_SENDFILE_H
+    ssize_t r;
+
+    r = sendfile(sock, fd, offset, (size_t) len);
+    return (r == -1) ? SOCKET_ERROR : (Long) r;
+#else
+    unsigned char chunk[BIGBUF * 8];
+    Long          r;
+
+    if (len > (Long) sizeof(chunk))
+        len = sizeof(chunk);
+    if (lseek(fd, *offset, SEEK_SET) == -1)
+        return SOCKET_ERROR;
+    r = read(fd, chunk, len);
+    if (r <= 0)
+        return r ? SOCKET_ERROR : 0;
+    r = SOCK_WRITE(sock, chunk, r);
+    if (r != SOCKET_ERROR)
+        *offset += r;
+    return r;
+#endif
+}
+
+/*
+// -------------------------------------------------------------------
+// Read up to n (at most DGRAM_BATCH) datagrams into the slots of dgrams,
+// with their senders, in one recvmmsg() where there is one.  Returns the
+// count read, or SOCKET_ERROR if there were none (ERR_AGAIN once the
+// socket is drained).
+*/
+Int net_recv_datagrams(SOCKET sock, net_dgram_t * dgrams, Int n) {
+    struct sockaddr_in from[DGRAM_BATCH];
+#ifdef HAVE_RECVMMSG
+    struct mmsghdr     msgs[DGRAM_BATCH];
+    struct iovec       iov[DGRAM_BATCH];
+#else
+    socklen_t          from_len;
+    Long               r;
+#endif
+    Int                i;
+
+    if (n > DGRAM_BATCH)
+        n = DGRAM_BATCH;
+
+#ifdef HAVE_RECVMMSG
+    memset(msgs, 0, n * sizeof(struct mmsghdr));
+    for (i = 0; i < n; i++) {
+        iov[i].iov_base = dgrams[i].s;
+        iov[i].iov_len = DGRAM_MAX;
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = &from[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(from[i]);
+    }
+    n = recvmmsg(sock, msgs, n, MSG_DONTWAIT, NULL);
+    if (n == -1)
+        return SOCKET_ERROR;
+    for (i = 0; i < n; i++)
+        dgrams[i].len = msgs[i].msg_len;
+#else
+    for (i = 0; i < n; i++) {
+        from_len = sizeof(from[i]);
+        r = recvfrom(sock, dgrams[i].s, DGRAM_MAX, 0,
+                     (struct sockaddr *) &from[i], &from_len);
+        if (r == SOCKET_ERROR) {
+            if (!i)
+                return SOCKET_ERROR;
+            break;
+        }
+        dgrams[i].len = r;
+    }
+    n = i;
+#endif
+
+    for (i = 0; i < n; i++) {
+        strcpy(dgrams[i].addr, inet_ntoa(from[i].sin_addr));
+        dgrams[i].port = ntohs(from[i].sin_port);
+    }
+    return n;
+}
+
+/*
+// -------------------------------------------------------------------
+// Send datagrams from the head of a queue, up to DGRAM_BATCH of them in
+// one sendmmsg() where there is one.  Returns the count sent, or
+// SOCKET_ERROR if the first could not be.
+*/
+Int net_send_datagrams(SOCKET sock, conn_dgram_t * dgrams) {
+    struct sockaddr_in to[DGRAM_BATCH];
+#ifdef HAVE_SENDMMSG
+    struct mmsghdr     msgs[DGRAM_BATCH];
+    struct iovec       iov[DGRAM_BATCH];
+#endif
+    Int                n;
+
+    for (n = 0; dgrams && n < DGRAM_BATCH; dgrams = dgrams->next, n++) {
+        memset(&to[n], 0, sizeof(to[n]));
+        to[n].sin_family = AF_INET;
+        to[n].sin_port = htons(dgrams->port);
+        to[n].sin_addr.s_addr = dgrams->addr;
+#ifdef HAVE_SENDMMSG
+        memset(&msgs[n], 0, sizeof(msgs[n]));
+        iov[n].iov_base = dgrams->buf->s;
+        iov[n].iov_len = dgrams->buf->len;
+        msgs[n].msg_hdr.msg_iov = &iov[n];
+        msgs[n].msg_hdr.msg_iovlen = 1;
+        msgs[n].msg_hdr.msg_name = &to[n];
+        msgs[n].msg_hdr.msg_namelen = sizeof(to[n]);
+#else
+        if (sendto(sock, dgrams->buf->s, dgrams->buf->len, 0,
+                   (struct sockaddr *) &to[n], sizeof(to[n]))
+            == SOCKET_ERROR)
+            return n ? n : SOCKET_ERROR;
+#endif
+    }
+
+#ifdef HAVE_SENDMMSG
+    n = sendmmsg(sock, msgs, n, MSG_DONTWAIT);
+    return (n == -1) ? SOCKET_ERROR : n;
+#else
+    return n;
+#endif
+}
+
+/* whether sock is a datagram socket, for set_framing('datagram) */
+Bool net_is_datagram(SOCKET sock) {
+    int       type;
+    socklen_t len = sizeof(type);
+
+    if (getsockopt(sock, SOL_SOCKET, SO_TYPE, (void *) &type, &len))
+        return false;
+    return type == SOCK_DGRAM;
+}
+
+/*
+// -------------------------------------------------------------------
+// Tell the event backend what a connection is interested in: input
+// while it is alive, and room to write while it is on the output queue.
+// Called whenever either changes; net_unwatch() before it is closed.
+*/
+void net_watch(Conn * conn) {
+    Int events;
+#ifdef HAVE_SYS_EPOLL_H
+    struct epoll_event ev;
+#endif
+
+    events = (conn->flags.dead ? 0 : NET_READ) |
+             (conn->output_slot != -1 ? NET_WRITE : 0);
+    if ((conn->events & ~NET_ADDED) == events && conn->events)
+        return;
+
+#ifdef HAVE_SYS_EPOLL_H
+    if (epoll_fd != -1) {
+        ev.events = ((events & NET_READ) ? EPOLLIN : 0) |
+                    ((events & NET_WRITE) ? EPOLLOUT : 0);
+        ev.data.ptr = conn;
+        if (epoll_ctl(epoll_fd, (conn->events & NET_ADDED) ? EPOLL_CTL_MOD
+                                                         : EPOLL_CTL_ADD,
+                      conn->fd, &ev) == -1)
+            write_err("epoll_ctl(%d): %s", conn->fd, strerror(errno));
+        events |= NET_ADDED;
+    }
+#endif
+    conn->events = events;
+}
+
+void net_unwatch(Conn * conn) {
+#ifdef HAVE_SYS_EPOLL_H
+    struct epoll_event ev;
+
+    if (epoll_fd != -1 && (conn->events & NET_ADDED))
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, &ev);
+#endif
+    conn->events = 0;
+}
+
 /*
 // -------------------------------------------------------------------
 // inet_aton() courtesy of Luc Girardin <girardin@hei.unige.ch>, I dont
@@ -124,6 +338,16 @@ int inet_aton (const char * cp, struct in_addr * addr) {
 }
 #endif
 
+/* an IPv4 address in network byte order, for cwriteto() */
+Bool net_inet_addr(char * addr, unsigned long * inaddr) {
+    struct in_addr in;
+
+    if (!inet_aton(addr, &in))
+        return false;
+    *inaddr = in.s_addr;
+    return true;
+}
+
 /*
 // -----------------------------------------------------------------------
 // prebind things--basically call socket() and bind() but nothing else,
@@ -272,7 +496,7 @@ SOCKET get_tcp_socket(unsigned short port, char * addr) {
     if (sock == SOCKET_ERROR)
         return SOCKET_ERROR;
 
-    listen(sock, 8);
+    listen(sock, SOMAXCONN);
 
     return sock;
 }
@@ -291,15 +515,23 @@ SOCKET get_udp_socket(unsigned short port, char * addr) {
 /* Wait for I/O events.  sec is the number of seconds we can wait before
  * returning, or -1 if we can wait forever.  Returns nonzero if an I/O event
  * happened. */
-Int io_event_wait(Int sec, Conn *connections, server_t *servers,
-                  pending_t *pendings)
+Int io_event_wait(Int sec, conn_set_t *conns, server_t *servers,
+                  pending_t *pendings, process_t *processes, Int wake_fd)
 {
     struct timeval tv, *tvp;
     Conn *conn;
+    Int fd;
+#ifdef HAVE_SYS_EPOLL_H
+    struct epoll_event events[EPOLL_BATCH];
+    Int i, n;
+#endif
     server_t *serv;
     pending_t *pend;
+    process_t *proc;
+    accepted_t *acc;
+    SOCKET client;
     fd_set read_fds, write_fds, except_fds;
-    Int flags, nfds, count, result, error;
+    Int nfds, count, result, error;
     socklen_t dummy = sizeof(int);
 
     /* Set time structure according to sec. */
@@ -320,16 +552,26 @@ Int io_event_wait(Int sec, Conn *connections, server_t *servers,
     nfds = 0;
 
     /* Listen for new data on connections, and also check for ability to write
-     * to them if we have data to write. */
-    for (conn = connections; conn; conn = conn->next) {
+     * to them if we have data to write.  With epoll the connections are
+     * registered as they change (see net_watch()), and select() only needs
+     * to know whether the epoll set has anything ready. */
+#ifdef HAVE_SYS_EPOLL_H
+    if (epoll_fd != -1) {
+        FD_SET(epoll_fd, &read_fds);
+        if (epoll_fd >= nfds)
+            nfds = epoll_fd + 1;
+    } else
+#endif
+    for (fd = 0; fd <= conns->max_fd; fd++) {
+        if (!(conn = conns->by_fd[fd]))
+            continue;
         if (!conn->flags.dead) {
-            FD_SET(conn->fd, &except_fds);
-            FD_SET(conn->fd, &read_fds);
+            FD_SET(fd, &except_fds);
+            FD_SET(fd, &read_fds);
         }
-        if (conn->write_buf->len)
-            FD_SET(conn->fd, &write_fds);
-        if (conn->fd >= nfds)
-            nfds = conn->fd + 1;
+        if (conn->output_slot != -1)
+            FD_SET(fd, &write_fds);
+        nfds = fd + 1;
     }
 
     /* Listen for connections on the server sockets. */
@@ -351,13 +593,40 @@ Int io_event_wait(Int sec, Conn *connections, server_t *servers,
         }
     }
 
+    /* Listen for output from spawned processes, and for room in their
+     * stdin pipes if we have input left to give them. */
+    for (proc = processes; proc; proc = proc->next) {
+        if (proc->out_fd != -1) {
+            FD_SET(proc->out_fd, &read_fds);
+            if (proc->out_fd >= nfds)
+                nfds = proc->out_fd + 1;
+        }
+        if (proc->err_fd != -1) {
+            FD_SET(proc->err_fd, &read_fds);
+            if (proc->err_fd >= nfds)
+                nfds = proc->err_fd + 1;
+        }
+        if (proc->in_fd != -1 && proc->in_buf->len) {
+            FD_SET(proc->in_fd, &write_fds);
+            if (proc->in_fd >= nfds)
+                nfds = proc->in_fd + 1;
+        }
+    }
+
+    /* Wake up when another thread has work for the main loop. */
+    if (wake_fd != -1) {
+        FD_SET(wake_fd, &read_fds);
+        if (wake_fd >= nfds)
+            nfds = wake_fd + 1;
+    }
+
 #ifdef __Win32__
     /* Winsock 2.0 will return EINVAL (invalid argument) if there are no
        sockets checked in any of the FDSETs.  At least one server must be
        listening before the call is made.  Winsock 1.1 behaves differently.
      */
 
-    if (servers || connections || pendings) {
+    if (servers || conns->max_fd >= 0 || pendings) {
 #endif
     /* Call select(). */
     count = select(nfds, &read_fds, &write_fds, &except_fds, tvp);
@@ -377,46 +646,73 @@ Int io_event_wait(Int sec, Conn *connections, server_t *servers,
         return 0;
     }
 
-    /* Check if any connections are readable or writable. */
-    for (conn = connections; conn; conn = conn->next) {
-        if (FD_ISSET(conn->fd, &except_fds)) {
-            conn->flags.dead = 1;
+    /* Queue the connections which are readable or writable; errors and
+     * hangups are left for the read or write to discover. */
+#ifdef HAVE_SYS_EPOLL_H
+    if (epoll_fd != -1) {
+        if (FD_ISSET(epoll_fd, &read_fds)) {
+            n = epoll_wait(epoll_fd, events, EPOLL_BATCH, 0);
+            for (i = 0; i < n; i++) {
+                conn = (Conn *) events[i].data.ptr;
+                if ((events[i].events & (EPOLLIN|EPOLLERR|EPOLLHUP)) &&
+                    !conn->flags.readable) {
+                    conn->flags.readable = 1;
+                    conn_queue_add(&conns->readable, conn);
+                }
+                if ((events[i].events & (EPOLLOUT|EPOLLERR|EPOLLHUP)) &&
+                    conn->output_slot != -1 && !conn->flags.writable) {
+                    conn->flags.writable = 1;
+                    conn_queue_add(&conns->writable, conn);
+                }
+            }
+        }
+    } else
+#endif
+    for (fd = 0; fd <= conns->max_fd; fd++) {
+        if (!(conn = conns->by_fd[fd]))
+            continue;
+        if (FD_ISSET(fd, &except_fds)) {
             fprintf(stderr, "An exception occurred during select()\n");
+            FD_SET(fd, &read_fds);
         }
-        if (FD_ISSET(conn->fd, &read_fds))
+        if (FD_ISSET(fd, &read_fds) && !conn->flags.readable) {
             conn->flags.readable = 1;
-        if (FD_ISSET(conn->fd, &write_fds))
+            conn_queue_add(&conns->readable, conn);
+        }
+        if (FD_ISSET(fd, &write_fds) && !conn->flags.writable) {
             conn->flags.writable = 1;
+            conn_queue_add(&conns->writable, conn);
+        }
     }
 
-    /* Check if any server sockets have new connections. */
+    /* Drain the backlog of any server sockets with new connections, up
+     * to accept_budget clients each; these are queued on the server for
+     * handle_new_and_pending_connections(). */
     for (serv = servers; serv; serv = serv->next) {
-        if (FD_ISSET(serv->server_socket, &read_fds)) {
-            serv->client_socket = accept(serv->server_socket,
-                                 (struct sockaddr *) &sockin, &addr_size);
-            if (serv->client_socket == SOCKET_ERROR)
-                continue;
-#ifdef __Win32__
-            result = 1;
-            ioctlsocket(serv->client_socket, FIONBIO, &result);
-#else
-            flags = fcntl(serv->client_socket, F_GETFL);
-            flags |= O_NONBLOCK;
-            fcntl(serv->client_socket, F_SETFL, flags);
-#endif
-
-            /* Get address and local port of client. */
-            strcpy(serv->client_addr, inet_ntoa(sockin.sin_addr));
-            serv->client_port = ntohs(sockin.sin_port);
+        if (!FD_ISSET(serv->server_socket, &read_fds))
+            continue;
+        for (count = 0; count < accept_budget || !count; count++) {
+            client = accept_client(serv->server_socket);
+            if (client == SOCKET_ERROR) {
+                error = GETERR();
+                if (error == ERR_INTR || error == ECONNABORTED)
+                    continue;
+                if (error != ERR_AGAIN)
+                    net_stats.accept_errors++;
+                break;
+            }
 
-            /* Set the CLOEXEC flag on socket so that it will be closed for a
-             * execute() operation. */
-#ifdef FD_CLOEXEC
-            flags = fcntl(serv->client_socket, F_GETFD);
-            flags |= FD_CLOEXEC;
-            fcntl(serv->client_socket, F_SETFD, flags);
-#endif
+            acc = EMALLOC(accepted_t, 1);
+            acc->fd = client;
+            strcpy(acc->addr, inet_ntoa(sockin.sin_addr));
+            acc->port = ntohs(sockin.sin_port);
+            acc->next = NULL;
+            *serv->accepted_tail = acc;
+            serv->accepted_tail = &acc->next;
+            net_stats.accepted++;
         }
+        if (client != SOCKET_ERROR && count >= accept_budget)
+            net_stats.accept_deferred++;
     }
 
     /* Check if any pending connections have succeeded or failed. */
@@ -435,10 +731,54 @@ Int io_event_wait(Int sec, Conn *connections, server_t *servers,
         }
     }
 
+    /* Check if any spawned processes have output or can take input. */
+    for (proc = processes; proc; proc = proc->next) {
+        if (proc->out_fd != -1 && FD_ISSET(proc->out_fd, &read_fds))
+            proc->flags.out_readable = 1;
+        if (proc->err_fd != -1 && FD_ISSET(proc->err_fd, &read_fds))
+            proc->flags.err_readable = 1;
+        if (proc->in_fd != -1 && FD_ISSET(proc->in_fd, &write_fds))
+            proc->flags.in_writable = 1;
+    }
+
     /* Return nonzero, indicating that at least one I/O event occurred. */
     return 1;
 }
 
+/* Accept a client, non-blocking and closed on exec like our other
+ * sockets, leaving its address in sockin. */
+static SOCKET accept_client(SOCKET server_socket) {
+    SOCKET sock;
+#ifndef HAVE_ACCEPT4
+    Int    flags;
+#endif
+
+    addr_size = sizeof(sockin);
+#ifdef HAVE_ACCEPT4
+    sock = accept4(server_socket, (struct sockaddr *) &sockin, &addr_size,
+                   SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+    sock = accept(server_socket, (struct sockaddr *) &sockin, &addr_size);
+    if (sock == SOCKET_ERROR)
+        return SOCKET_ERROR;
+#ifdef __Win32__
+    flags = 1;
+    ioctlsocket(sock, FIONBIO, &flags);
+#else
+    flags = fcntl(sock, F_GETFL);
+    flags |= O_NONBLOCK;
+    fcntl(sock, F_SETFL, flags);
+#endif
+#ifdef FD_CLOEXEC
+    flags = fcntl(sock, F_GETFD);
+    flags |= FD_CLOEXEC;
+    fcntl(sock, F_SETFD, flags);
+#endif
+#endif
+
+    return sock;
+}
+
 Long non_blocking_connect(char *addr, unsigned short port, Int *socket_return)
 {
     SOCKET fd;
@@ -150,6 +150,7 @@ static Op_info op_info[] = {
     FDEF(F_CLASS,                 "class",                 frob_class),   /* devalued, see frob_class */
     FDEF(F_CLEAR_VAR,             "clear_var",             clear_var),
     FDEF(F_CLOSE_CONNECTION,      "close_connection",      close_connection),
+    FDEF(F_COMPACT,               "compact",               compact),
     FDEF(F_CONFIG,                "config",                config),
     FDEF(F_CONNECTION,            "connection",            connection),
     FDEF(F_COS,                   "cos",                   cos),
@@ -158,6 +159,7 @@ static Op_info op_info[] = {
     FDEF(F_CTIME,                 "ctime",                 ctime),
     FDEF(F_CWRITE,                "cwrite",                cwrite),
     FDEF(F_CWRITEF,               "cwritef",               cwritef),
+    FDEF(F_CWRITETO,              "cwriteto",              cwriteto),
     FDEF(F_DATA,                  "data",                  data),
     FDEF(F_DBLOG,                 "dblog",                 dblog),
     FDEF(F_DEBUG_CALLERS,         "debug_callers",         debug_callers),
@@ -174,6 +176,7 @@ static Op_info op_info[] = {
     FDEF(F_DICT_KEYS,             "dict_keys",             dict_keys),
     FDEF(F_DICT_UNION,            "dict_union",            dict_union),
     FDEF(F_DICT_VALUES,           "dict_values",           dict_values),
+    FDEF(F_DRIVER_METRICS,        "driver_metrics",        driver_metrics),
     FDEF(F_ERROR_FUNC,            "error",                 error),
     FDEF(F_ERROR_DATA,            "error_data",            error_data),
     FDEF(F_ERROR_MESSAGE,         "error_message",         error_message),
@@ -192,6 +195,7 @@ static Op_info op_info[] = {
     FDEF(F_FMKDIR,                "fmkdir",                fmkdir),
     FDEF(F_FOPEN,                 "fopen",                 fopen),
     FDEF(F_FREAD,                 "fread",                 fread),
+    FDEF(F_FREADLINES,            "freadlines",            freadlines),
     FDEF(F_FREMOVE,               "fremove",               fremove),
     FDEF(F_FRENAME,               "frename",               frename),
     FDEF(F_FRMDIR,                "frmdir",                frmdir),
@@ -200,7 +204,9 @@ static Op_info op_info[] = {
     FDEF(F_FROB_VALUE,            "frob_value",            frob_value),
     FDEF(F_FROMLITERAL,           "fromliteral",           fromliteral),
     FDEF(F_FSEEK,                 "fseek",                 fseek),
+    FDEF(F_FSLICE,                "fslice",                fslice),
     FDEF(F_FSTAT,                 "fstat",                 fstat),
+    FDEF(F_FTELL,                 "ftell",                 ftell),
     FDEF(F_FWRITE,                "fwrite",                fwrite),
     FDEF(F_GET_VAR,               "get_var",               get_var),
     FDEF(F_HAS_ANCESTOR,          "has_ancestor",          has_ancestor),
@@ -228,9 +234,13 @@ static Op_info op_info[] = {
     FDEF(F_METHOD_BYTECODE,       "method_bytecode",       method_bytecode),
     FDEF(F_METHOD_FLAGS,          "method_flags",          method_flags),
     FDEF(F_METHOD_INFO,           "method_info",           method_info),
+    FDEF(F_METHOD_STATS,          "method_stats",          method_stats),
+    FDEF(F_METHOD_STATS_RESET,    "method_stats_reset",    method_stats_reset),
+    FDEF(F_METHOD_STATS_TOP,      "method_stats_top",      method_stats_top),
     FDEF(F_METHODS,               "methods",               methods),
     FDEF(F_MIN,                   "min",                   min),
     FDEF(F_MTIME,                 "mtime",                 mtime),
+    FDEF(F_NET_STATS,             "net_stats",             net_stats),
     FDEF(F_OBJNAME,               "objname",               objname),
     FDEF(F_OBJNUM,                "objnum",                objnum),
     FDEF(F_OPEN_CONNECTION,       "open_connection",       open_connection),
@@ -238,6 +248,8 @@ static Op_info op_info[] = {
     FDEF(F_PARENTS,               "parents",               parents),
     FDEF(F_PAUSE,                 "pause",                 pause),
     FDEF(F_POW,                   "pow",                   pow),
+    FDEF(F_PROFILE,               "profile",               profile),
+    FDEF(F_PROFILE_REPORT,        "profile_report",        profile_report),
     FDEF(F_RANDOM,                "random",                random),
     FDEF(F_REASSIGN_CONNECTION,   "reassign_connection",   reassign_connection),
     FDEF(F_REFRESH,               "refresh",               refresh),
@@ -248,6 +260,7 @@ static Op_info op_info[] = {
     FDEF(F_RETHROW,               "rethrow",               rethrow),
     FDEF(F_ROUND,                 "round",                 round),
     FDEF(F_SENDER,                "sender",                sender),
+    FDEF(F_SET_FRAMING,           "set_framing",           set_framing),
     FDEF(F_SET_HEARTBEAT,         "set_heartbeat",         set_heartbeat),
     FDEF(F_SET_METHOD_ACCESS,     "set_method_access",     set_method_access),
     FDEF(F_SET_METHOD_FLAGS,      "set_method_flags",      set_method_flags),
@@ -259,6 +272,7 @@ static Op_info op_info[] = {
     FDEF(F_SHUTDOWN,              "shutdown",              shutdown),
     FDEF(F_SIN,                   "sin",                   sin),
     FDEF(F_SIZE,                  "size",                  size),
+    FDEF(F_SPAWN,                 "spawn",                 spawn),
     FDEF(F_SPLIT,                 "split",                 split),
     FDEF(F_SQRT,                  "sqrt",                  sqrt),
     FDEF(F_STACK,                 "stack",                 stack),
@@ -279,6 +293,7 @@ static Op_info op_info[] = {
     FDEF(F_TAN,                   "tan",                   tan),
     FDEF(F_TASK_ID,               "task_id",               task_id),
     FDEF(F_TASK_INFO,             "task_info",             task_info),
+    FDEF(F_TASK_STATS,            "task_stats",            task_stats),
     FDEF(F_TASKS,                 "tasks",                 tasks),
     FDEF(F_THIS,                  "this",                  this),
     FDEF(F_THROW,                 "throw",                 throw),
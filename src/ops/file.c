@@ -41,6 +41,7 @@
 #include "execute.h"
 #include "util.h"      /* some file functions */
 #include "file.h"
+#include "opcodes.h"  /* INVALID_BINDING */
 
 #define GET_FILE_CONTROLLER(__f) do { \
         __f = find_file_controller(cur_frame->object); \
@@ -48,6 +49,10 @@
             cthrow(file_id, "No file is bound to this object."); \
             return; \
         } \
+        if (__f->f.busy) { \
+            cthrow(file_id, "File is busy."); \
+            return; \
+        } \
     } while(0)
 
 /*
@@ -122,6 +127,7 @@ COLDC_FUNC(files) {
     struct dirent * dent;
     DIR           * dp;
     struct stat     sbuf;
+    void          * job;
 
     INIT_1_ARG(STRING);
 
@@ -129,6 +135,15 @@ COLDC_FUNC(files) {
     if (!path)
         return;
 
+    if (FILE_WORKERS_OK) {
+        if ((job = file_job_start(FILE_JOB_DIR, NULL, NULL, path, false))) {
+            string_discard(path);
+            pop(1);
+            vm_suspend_on(job);
+            return;
+        }
+    }
+
     if (stat(path->s, &sbuf) == F_FAILURE) {
         cthrow(directory_id, "Unable to find directory \"%s\".", path->s);
         string_discard(path);
@@ -361,7 +376,7 @@ COLDC_FUNC(fseek) {
 
     GET_FILE_CONTROLLER(file);
 
-    if (!file->f.readable || !file->f.writable)
+    if (!file->f.mapped && (!file->f.readable || !file->f.writable))
         THROW((file_id,
                "File \"%s\" is not both readable and writable.",
                file->path->s));
@@ -375,7 +390,17 @@ COLDC_FUNC(fseek) {
     else
         THROW((type_id,"Whence is not one of 'SEEK_SET 'SEEK_CUR or 'SEEK_END"));
 
-    if (fseek(file->fp, (long) INT1, whence) != F_SUCCESS)
+    if (file->f.mapped) {
+        Long pos = INT1;
+
+        if (whence == SEEK_CUR)
+            pos += file->map_pos;
+        else if (whence == SEEK_END)
+            pos += file->map_len;
+        if (pos < 0 || pos > file->map_len)
+            THROW((range_id, "Offset %l is outside of the file.", pos));
+        file->map_pos = pos;
+    } else if (fseek(file->fp, (long) INT1, whence) != F_SUCCESS)
         THROW((file_id, strerror(GETERR())));
 
     pop(2);
@@ -454,7 +479,7 @@ COLDC_FUNC(feof) {
 
     GET_FILE_CONTROLLER(file);
 
-    if (feof(file->fp))
+    if (file_eof(file))
         push_int(1);
     else
         push_int(0);
@@ -478,12 +503,32 @@ COLDC_FUNC(fread) {
     if (file->f.binary) {
         cBuf * buf = NULL;
         Int      block = DEF_BLOCKSIZE;
+        void   * job;
 
-        if (argc) {
+        if (argc)
             block = INT1;
-            pop(1);
+
+        if (!file->f.mapped && FILE_ASYNC(block)) {
+            if (feof(file->fp)) {
+                cthrow(eof_id, "End of file.");
+                return;
+            }
+            buf = buffer_new(block);
+            buf->len = block;
+            if ((job = file_job_start(FILE_JOB_READ, file, buf, NULL,
+                                      false)))
+            {
+                buffer_discard(buf);
+                pop(argc);
+                vm_suspend_on(job);
+                return;
+            }
+            buffer_discard(buf);
         }
 
+        if (argc)
+            pop(1);
+
         buf = read_binary_file(file, block);
 
         if (!buf)
@@ -506,12 +551,101 @@ COLDC_FUNC(fread) {
     }
 }
 
+/*
+// -----------------------------------------------------------------
+// Read up to count lines from a text file at once, saving a builtin
+// call per line when scanning large files.
+*/
+COLDC_FUNC(freadlines) {
+    filec_t  * file;
+    cList    * list;
+    cStr     * str;
+    cData      d;
+    Int        count;
+
+    INIT_1_ARG(INTEGER);
+
+    GET_FILE_CONTROLLER(file);
+
+    if (!file->f.readable)
+        THROW((file_id, "File is not readable."));
+    if (file->f.binary)
+        THROW((file_id, "File type is binary, use fread()."));
+    if ((count = INT1) < 1)
+        THROW((range_id, "Line count (%d) must be positive.", count));
+
+    /* the first line throws ~eof if there isn't one */
+    if (!(str = read_file(file)))
+        return;
+
+    list = list_new(count < 64 ? count : 64);
+    d.type = STRING;
+    for (;;) {
+        d.u.str = str;
+        list = list_add(list, &d);
+        string_discard(str);
+        if (!--count || !(str = file_getline(file)))
+            break;
+    }
+
+    pop(1);
+    push_list(list);
+    list_discard(list);
+}
+
+/*
+// -----------------------------------------------------------------
+// The current read/write offset in the bound file.
+*/
+COLDC_FUNC(ftell) {
+    filec_t  * file;
+
+    INIT_NO_ARGS();
+
+    GET_FILE_CONTROLLER(file);
+
+    push_int(file_tell(file));
+}
+
+/*
+// -----------------------------------------------------------------
+// A range of a file opened with fopen(name, "="), leaving the read
+// cursor where it is.
+*/
+COLDC_FUNC(fslice) {
+    filec_t  * file;
+    cBuf     * buf;
+
+    INIT_2_ARGS(INTEGER, INTEGER);
+
+    GET_FILE_CONTROLLER(file);
+
+    if (!file->f.mapped)
+        THROW((file_id, "File \"%s\" is not mapped.", file->path->s));
+    if (file->f.truncated)
+        THROW((file_id, "File \"%s\" was truncated while mapped.",
+               file->path->s));
+    if (INT1 < 0 || INT1 > file->map_len)
+        THROW((range_id, "Offset %d is outside of the file.", INT1));
+    if (INT2 < 0 || INT2 > file->map_len - INT1)
+        THROW((range_id, "Length %d is past the end of the file.", INT2));
+
+    if (!(buf = file_slice(file, INT1, INT2)))
+        return;
+
+    pop(2);
+    push_buffer(buf);
+    buffer_discard(buf);
+}
+
 /*
 // -----------------------------------------------------------------
 */
 COLDC_FUNC(fwrite) {
     Int        count;
     filec_t  * file;
+    cBuf     * buf;
+    void     * job;
 
     INIT_1_ARG(ANY_TYPE);
 
@@ -527,6 +661,14 @@ COLDC_FUNC(fwrite) {
             cthrow(type_id,"File type is binary, you may only fwrite buffers.");
             return;
         }
+        if (FILE_ASYNC(args[0].u.buffer->len) &&
+            (job = file_job_start(FILE_JOB_WRITE, file, args[0].u.buffer,
+                                  NULL, false)))
+        {
+            pop(1);
+            vm_suspend_on(job);
+            return;
+        }
         count = fwrite(args[0].u.buffer->s,
                        sizeof(unsigned char),
                        args[0].u.buffer->len,
@@ -537,6 +679,20 @@ COLDC_FUNC(fwrite) {
             cthrow(type_id, "File type is text, you may only fwrite strings.");
             return;
         }
+        if (FILE_ASYNC(args[0].u.str->len)) {
+            buf = buffer_append_uchars(buffer_new(0),
+                                       (uChar *) args[0].u.str->s,
+                                       args[0].u.str->len);
+            if ((job = file_job_start(FILE_JOB_WRITE, file, buf, NULL,
+                                      true)))
+            {
+                buffer_discard(buf);
+                pop(1);
+                vm_suspend_on(job);
+                return;
+            }
+            buffer_discard(buf);
+        }
         count = fwrite(args[0].u.str->s,
                        sizeof(unsigned char),
                        args[0].u.str->len,
@@ -562,6 +718,26 @@ COLDC_FUNC(fstat) {
 
     INIT_0_OR_1_ARGS(STRING);
 
+    if (FILE_WORKERS_OK) {
+        cStr * path;
+        void * job;
+
+        if (!argc) {
+            GET_FILE_CONTROLLER(file);
+            path = string_dup(file->path);
+        } else if (!(path = build_path(STR1->s, NULL, ALLOW_DIR))) {
+            return;
+        }
+
+        if ((job = file_job_start(FILE_JOB_STAT, NULL, NULL, path, false))) {
+            string_discard(path);
+            pop(argc);
+            vm_suspend_on(job);
+            return;
+        }
+        string_discard(path);
+    }
+
     if (!argc) {
         GET_FILE_CONTROLLER(file);
         stat_file(file, &sbuf);
@@ -589,23 +765,19 @@ COLDC_FUNC(fstat) {
 /*
 // -----------------------------------------------------------------
 //
-// run an executable from the filesystem
+// Check the script name and arguments given to execute() or spawn(),
+// and build the path of the script in c_dir_bin and its argument
+// vector.  Returns the number of arguments (including the script), or
+// -1 if an error was thrown.
 //
 */
 
-COLDC_FUNC(execute) {
-    cData *args, *d;
+static Int exec_args(cData *args, char **fname_ret, char ***argv_ret) {
+    cData *d;
     cList *script_args;
-    Int num_args, argc, len, i, fd, dlen;
-    int status;
-    pid_t pid;
+    Int argc, len, i, dlen;
     char *fname, **argv;
 
-    /* Accept a name of a script to run, a list of arguments to give it, and
-     * an optional flag signifying that we should not wait for completion. */
-    if (!func_init_2_or_3(&args, &num_args, STRING, LIST, INTEGER))
-        return;
-
     script_args = args[1].u.list;
 
     /* Verify that all items in argument list are strings. */
@@ -616,14 +788,14 @@ COLDC_FUNC(execute) {
             cthrow(type_id,
                    "Execute argument %d (%D) is not a string.",
                    i+1, d);
-            return;
+            return -1;
         }
     }
 
     /* Don't allow walking back up the directory tree. */
     if (strstr(string_chars(args[0].u.str), "../")) {
         cthrow(perm_id, "Filename %D is not legal.", &args[0]);
-        return;
+        return -1;
     }
 
     /* Construct the name of the script. */
@@ -647,6 +819,42 @@ COLDC_FUNC(execute) {
         argv[i + 1] = tstrdup(string_chars(d->u.str));
     argv[argc] = NULL;
 
+    *fname_ret = fname;
+    *argv_ret = argv;
+    return argc;
+}
+
+static void exec_args_free(char *fname, char **argv, Int argc) {
+    Int i;
+
+    for (i = 0; i < argc; i++)
+        tfree_chars(argv[i]);
+    TFREE(argv, argc + 1);
+    tfree_chars(fname);
+}
+
+/*
+// -----------------------------------------------------------------
+//
+// run an executable from the filesystem
+//
+*/
+
+COLDC_FUNC(execute) {
+    cData *args;
+    Int num_args, argc, fd;
+    int status;
+    pid_t pid;
+    char *fname, **argv;
+
+    /* Accept a name of a script to run, a list of arguments to give it, and
+     * an optional flag signifying that we should not wait for completion. */
+    if (!func_init_2_or_3(&args, &num_args, STRING, LIST, INTEGER))
+        return;
+
+    if ((argc = exec_args(args, &fname, &argv)) == -1)
+        return;
+
     pop(num_args);
 
 #ifdef __Win32__
@@ -715,9 +923,101 @@ COLDC_FUNC(execute) {
 #endif
 
     /* Free the argument list. */
-    for (i = 0; i < argc; i++)
-        tfree_chars(argv[i]);
-    TFREE(argv, argc + 1);
+    exec_args_free(fname, argv, argc);
 
     push_int(status);
 }
+
+/*
+// -----------------------------------------------------------------
+//
+// Run an executable with pipes on its stdin, stdout and stderr, which
+// are serviced by the main loop.  The optional input (a string or
+// buffer) is fed to the child's stdin, and the child is killed if it
+// runs for longer than timeout seconds.
+//
+// Without a method the calling task is suspended until the child
+// exits, and spawn() returns [status, stdout, stderr].  With a method,
+// spawn() returns the pid straight away and output is streamed to
+// this().method(pid, 'stdout or 'stderr, buffer) as it arrives,
+// followed by this().method(pid, 'exit, status).
+//
+*/
+
+COLDC_FUNC(spawn) {
+    cData *args;
+    Int arg_start, num_args, argc, timeout = 0;
+    Ident method = NOT_AN_IDENT;
+    cBuf *input = NULL;
+    process_t *proc;
+    char *fname, **argv;
+
+    arg_start = arg_starts[--arg_pos];
+    args = &stack[arg_start];
+    num_args = stack_pos - arg_start;
+
+    if (num_args < 2 || num_args > 5)
+        THROW((numargs_id, "Called with %d arguments, requires two to five.",
+               num_args));
+    if (args[0].type != STRING)
+        THROW((type_id, "First argument (%D) not a string.", &args[0]));
+    if (args[1].type != LIST)
+        THROW((type_id, "Second argument (%D) not a list.", &args[1]));
+    if (num_args > 2 && args[2].type != STRING && args[2].type != BUFFER &&
+        !(args[2].type == INTEGER && args[2].u.val == 0))
+        THROW((type_id, "Third argument (%D) not a string or buffer.",
+               &args[2]));
+    if (num_args > 3) {
+        if (args[3].type != INTEGER)
+            THROW((type_id, "Fourth argument (%D) not an integer.", &args[3]));
+        if (args[3].u.val < 0)
+            THROW((range_id, "Timeout (%d) is negative.", args[3].u.val));
+        timeout = args[3].u.val;
+    }
+    if (num_args > 4) {
+        if (args[4].type != SYMBOL)
+            THROW((type_id, "Fifth argument (%D) not a symbol.", &args[4]));
+        method = args[4].u.symbol;
+    }
+    if (INVALID_BINDING)
+        THROW((perm_id, "%s() is bound to %O", FUNC_NAME(), FUNC_BINDING()));
+
+#ifdef __Win32__
+    THROW((file_id, "spawn() is not supported on this platform."));
+#else
+    if (method == NOT_AN_IDENT && atomic)
+        THROW((atomic_id, "Attempt to suspend while executing atomically."));
+
+    if ((argc = exec_args(args, &fname, &argv)) == -1)
+        return;
+
+    if (num_args > 2) {
+        /* strings go to the child as-is, without str_to_buf()'s CRLFs */
+        if (args[2].type == STRING)
+            input = buffer_append_uchars(buffer_new(0),
+                                (uChar *) string_chars(args[2].u.str),
+                                string_length(args[2].u.str));
+        else if (args[2].type == BUFFER)
+            input = buffer_dup(args[2].u.buffer);
+    }
+
+    proc = spawn_process(fname, argv, input, timeout,
+                         cur_frame->object->objnum, method);
+    if (input)
+        buffer_discard(input);
+    exec_args_free(fname, argv, argc);
+
+    if (!proc)
+        THROW((file_id, "Unable to spawn %D: %s.", &args[0],
+               strerror(GETERR())));
+
+    pop(num_args);
+
+    if (method == NOT_AN_IDENT) {
+        /* the process will push [status, stdout, stderr] on resume */
+        vm_suspend_on(proc);
+    } else {
+        push_int(proc->pid);
+    }
+#endif
+}
@@ -5,6 +5,7 @@
 #include "defs.h"
 
 #include <limits.h>
+#include <fcntl.h>
 #include <string.h>
 #include "functions.h"
 #include "execute.h"
@@ -40,7 +41,7 @@ COLDC_FUNC(reassign_connection) {
             cache_discard(obj);
             return;
         }
-        c->objnum = obj->objnum;
+        connection_reassign(c, obj->objnum);
         cache_discard(obj);
         object_extra_unregister(cur_frame->object, object_extra_connection, c);
         pop(1);
@@ -157,6 +158,58 @@ COLDC_FUNC(close_connection) {
     push_int(boot(cur_frame->object, NULL));
 }
 
+/*
+// -----------------------------------------------------------------
+// Choose how input on the current object's connection reaches parse:
+// 'raw buffers as read, or a list of complete frames per read, either
+// 'line (strings, lines longer than max are cut) or 'length (buffers,
+// each after a big-endian length of width bytes; a frame longer than
+// max drops the connection).  On a UDP socket 'datagram hands parse up
+// to max [addr, port, buffer] lists per wakeup, see also cwriteto().
+*/
+COLDC_FUNC(set_framing) {
+    cData * args;
+    Int     nargs, mode, max, width = 4;
+
+    if (!func_init_1_to_3(&args, &nargs, SYMBOL, INTEGER, INTEGER))
+        return;
+
+    if (args[0].u.symbol == raw_id) {
+        mode = FRAME_RAW;
+        max = 0;
+    } else if (args[0].u.symbol == line_id) {
+        mode = FRAME_LINE;
+        max = FRAME_LINE_MAX;
+    } else if (args[0].u.symbol == length_id) {
+        mode = FRAME_LENGTH;
+        max = FRAME_LENGTH_MAX;
+    } else if (args[0].u.symbol == datagram_id) {
+        mode = FRAME_DATAGRAM;
+        max = FRAME_DATAGRAM_MAX;
+    } else {
+        THROW((type_id,
+               "Framing must be one of 'raw, 'line, 'length or 'datagram."));
+    }
+
+    if (nargs >= 2 && mode != FRAME_RAW) {
+        if (args[1].u.val < 1)
+            THROW((range_id, "Maximum frame size must be positive."));
+        max = (Int) args[1].u.val;
+    }
+    if (nargs == 3) {
+        width = (Int) args[2].u.val;
+        if (width != 1 && width != 2 && width != 4)
+            THROW((range_id, "Length prefix must be 1, 2 or 4 bytes."));
+    }
+
+    mode = connection_framing(cur_frame->object, mode, max, width);
+    if (mode == -1)
+        THROW((socket_id, "The connection is not a datagram socket."));
+
+    pop(nargs);
+    push_int(mode);
+}
+
 /*
 // -----------------------------------------------------------------
 // Echo a buffer to the connection
@@ -176,65 +229,126 @@ COLDC_FUNC(cwrite) {
     push_int(rval);
 }
 
+/*
+// -----------------------------------------------------------------
+// Send datagrams from the connection's UDP socket, given as a list of
+// [addr, port, buffer] like those 'datagram framing delivers.  They are
+// queued and go out in batches; returns 1, or 0 without a connection.
+// At most CONN_DGRAMS_MAX may be waiting at once.
+*/
+COLDC_FUNC(cwriteto) {
+    cData         * args, * d, * e = NULL;
+    cList         * dgrams;
+    unsigned long * addrs;
+    Ident           error = NOT_AN_IDENT;
+    char          * why = NULL;
+    Int             i, rval = 1;
+
+    if (!func_init_1(&args, LIST))
+        return;
+
+    /* check them all before queueing any */
+    dgrams = args[0].u.list;
+    addrs = TMALLOC(unsigned long, dgrams->len + 1);
+    for (i = 0, d = list_first(dgrams); d; d = list_next(dgrams, d), i++) {
+        if (d->type == LIST && list_length(d->u.list) == 3)
+            e = list_elem(d->u.list, 0);
+        if (d->type != LIST || list_length(d->u.list) != 3
+            || e[0].type != STRING || e[1].type != INTEGER
+            || e[2].type != BUFFER) {
+            error = type_id;
+            why = "is not [addr, port, buffer]";
+        } else if (e[1].u.val < 1 || e[1].u.val > 65535) {
+            error = range_id;
+            why = "has an invalid port";
+        } else if (!net_inet_addr(string_chars(e[0].u.str), &addrs[i])) {
+            error = address_id;
+            why = "has an invalid address";
+        }
+        if (why)
+            break;
+    }
+    if (why) {
+        TFREE(addrs, dgrams->len + 1);
+        THROW((error, "Datagram %d %s.", i + 1, why));
+    }
+
+    switch (connection_datagram_room(cur_frame->object, dgrams->len)) {
+        case -1:
+            TFREE(addrs, dgrams->len + 1);
+            THROW((type_id, "The connection is not a datagram socket."));
+        case -2:
+            TFREE(addrs, dgrams->len + 1);
+            THROW((socket_id, "Too many datagrams queued for output (%d).",
+                   CONN_DGRAMS_MAX));
+    }
+
+    for (i = 0, d = list_first(dgrams); d && rval;
+         d = list_next(dgrams, d), i++) {
+        e = list_elem(d->u.list, 0);
+        rval = ctell_datagram(cur_frame->object, addrs[i],
+                              (unsigned short) e[1].u.val, e[2].u.buffer)
+               ? 1 : 0;
+    }
+    TFREE(addrs, dgrams->len + 1);
+
+    pop(1);
+    push_int(rval);
+}
+
 /*
 // -----------------------------------------------------------------
 // write a file to the connection
 */
 COLDC_FUNC(cwritef) {
-    size_t        block, r;
-    cData      * args;
-    FILE        * fp;
-    cBuf    * buf;
-    cStr    * str;
+    cData       * args;
+    cStr        * str;
     struct stat   statbuf;
-    Int           nargs;
+    FILE        * fp;
+    Int           nargs, fd;
 
-    /* Accept the name of a file to echo */
+    /* Accept the name of a file to echo; the block size is no longer
+       used, the file is sent as the connection takes it */
     if (!func_init_1_or_2(&args, &nargs, STRING, INTEGER))
         return;
 
+    /* every queued range holds a descriptor until it has been sent */
+    if (conn_files_queued >= CONN_FILES_MAX)
+        THROW((file_id, "Too many files queued for output (%d).",
+               CONN_FILES_MAX));
+
     /* Initialize the file */
     str = build_path(args[0].u.str->s, &statbuf, DISALLOW_DIR);
     if (str == NULL)
         return;
 
-    /* Open the file for reading. */
+    /* Open the file for reading and hand the connection a descriptor of
+       its own, placed above FD_SETSIZE where the limit allows so that it
+       does not take one select() could still need for a socket. */
     fp = open_scratch_file(str->s, "rb");
-    if (!fp)
-        THROW((file_id, "Cannot open file \"%s\" for reading.", str->s));
-
-    /* how big of a chunk do we read at a time? */
-    if (nargs == 2) {
-        if (args[1].u.val == -1)
-            block = statbuf.st_size;
-        else
-            block = (size_t) args[1].u.val;
-    } else
-        block = (size_t) DEF_BLOCKSIZE;
-
-    /* Allocate a buffer to hold the block */
-    buf = buffer_new(block);
-
-    while (!feof(fp)) {
-        r = fread(buf->s, sizeof(unsigned char), block, fp);
-        if (r != block) {
-            if (!feof(fp)) {
-                buffer_discard(buf);
-                close_scratch_file(fp);
-                cthrow(file_id, "Trouble reading file \"%s\": %s",
-                       str->s, strerror(GETERR()));
-                return;
-            } else {
-                buf->len = r;
-                ctell(cur_frame->object, buf);
-            }
-        } else
-            ctell(cur_frame->object, buf);
+    if (!fp) {
+        cthrow(file_id, "Cannot open file \"%s\" for reading.", str->s);
+        string_discard(str);
+        return;
     }
-
-    /* Discard the buffer and close the file. */
-    buffer_discard(buf);
+    fd = -1;
+#ifdef F_DUPFD
+    fd = fcntl(fileno(fp), F_DUPFD, FD_SETSIZE);
+#endif
+    if (fd == -1)
+        fd = dup(fileno(fp));
     close_scratch_file(fp);
+    if (fd == -1) {
+        cthrow(file_id, "Cannot open file \"%s\" for reading.", str->s);
+        string_discard(str);
+        return;
+    }
+#ifdef FD_CLOEXEC
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+#endif
+    string_discard(str);
+
+    ctell_file(cur_frame->object, fd, statbuf.st_size);
 
     pop(nargs);
     push_int((cNum) statbuf.st_size);
@@ -271,3 +385,41 @@ COLDC_FUNC(connection) {
     push_list(info);
     list_discard(info);
 }
+
+/*
+// -----------------------------------------------------------------
+// Network counters: connections accepted, wakeups which used up
+// config('accept_budget) with clients still waiting, failed accepts,
+// and datagrams received and sent.  A true argument resets them once
+// read.
+*/
+COLDC_FUNC(net_stats) {
+    cData * args;
+    cList * info;
+    cData * list;
+    Int     argc;
+
+    if (!func_init_0_or_1(&args, &argc, INTEGER))
+        return;
+
+    info = list_new(5);
+    list = list_empty_spaces(info, 5);
+
+    list[0].type = INTEGER;
+    list[0].u.val = (cNum) net_stats.accepted;
+    list[1].type = INTEGER;
+    list[1].u.val = (cNum) net_stats.accept_deferred;
+    list[2].type = INTEGER;
+    list[2].u.val = (cNum) net_stats.accept_errors;
+    list[3].type = INTEGER;
+    list[3].u.val = (cNum) net_stats.datagrams_in;
+    list[4].type = INTEGER;
+    list[4].u.val = (cNum) net_stats.datagrams_out;
+
+    if (argc && INT1)
+        memset(&net_stats, 0, sizeof(net_stats));
+
+    pop(argc);
+    push_list(info);
+    list_discard(info);
+}
@@ -791,8 +791,7 @@ COLDC_OP(message) {
                 target[1].u.symbol = m;
             }
             else {
-                if (!lookup_retrieve_name(data_type_id(target->type),
-                                          &objnum)) {
+                if (!data_type_handler(target->type, &objnum)) {
                     cthrow(objnf_id, "No object for data type %I.",
                            data_type_id(target->type));
                     return;
@@ -864,8 +863,7 @@ COLDC_OP(expr_message) {
                 arg_start -= 2;
             }
             else {
-                if (!lookup_retrieve_name(data_type_id(target->type),
-                                          &objnum)) {
+                if (!data_type_handler(target->type, &objnum)) {
                     cthrow(objnf_id,
                            "No object for data type %I",
                            data_type_id(target->type));
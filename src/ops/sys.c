@@ -17,6 +17,7 @@
 #include "cache.h"
 #include "execute.h"
 #include "binarydb.h"
+#include "metrics.h"
 
 COLDC_FUNC(dblog) {
     cData * args;
@@ -194,6 +195,25 @@ COLDC_FUNC(backup) {
     push_int(1);
 }
 
+/*
+// -----------------------------------------------------------------
+//
+// Starts moving objects towards the front of the objects file, a few
+// blocks at a time from the main loop, after which the file is truncated
+// and $sys.compact_done() is called.  Returns the share of the file which
+// is free, so calling it again while compaction runs reports progress.
+//
+*/
+
+COLDC_FUNC(compact) {
+    /* Accept no arguments. */
+    if (!func_init_0())
+        return;
+
+    simble_compact_start();
+    push_float((cFloat) simble_fragmentation());
+}
+
 /*
 // -----------------------------------------------------------------
 //
@@ -322,6 +342,14 @@ COLDC_FUNC(config) {
 #endif
     _CONFIG_INT(log_malloc_size_id,            log_malloc_size)
     _CONFIG_INT(log_method_cache_id,           log_method_cache)
+    _CONFIG_INT(sched_ticks_id,                sched_tick_budget)
+    _CONFIG_INT(sched_time_id,                 sched_time_budget)
+    _CONFIG_INT(method_stats_id,               method_stats_flag)
+    _CONFIG_INT(file_workers_id,               file_workers)
+    _CONFIG_INT(file_async_threshold_id,       file_async_threshold)
+    _CONFIG_INT(compress_threshold_id,         compress_threshold)
+    _CONFIG_INT(accept_budget_id,              accept_budget)
+    _CONFIG_INT(metrics_log_id,                metrics_log)
 #ifdef USE_CACHE_HISTORY
     _CONFIG_INT(cache_history_size_id,         cache_history_size)
 #endif
@@ -345,8 +373,9 @@ COLDC_FUNC(cache_stats) {
     cData * args;
     cList * list, * entry;
     cData * val, list_entry;
+    Int     argc;
 
-    if (!func_init_1(&args, SYMBOL))
+    if (!func_init_1_or_2(&args, &argc, SYMBOL, INTEGER))
         return;
 
     if (SYM1 == ancestor_cache_id) {
@@ -374,19 +403,53 @@ COLDC_FUNC(cache_stats) {
         list = list_add(list, &list_entry);
         list_discard(entry);
     } else if (SYM1 == name_cache_id) {
-        list = list_new(2);
-        val = list_empty_spaces(list, 2);
+        /* hits, misses, and hits on names known not to exist */
+        list = list_new(3);
+        val = list_empty_spaces(list, 3);
         val[0].type = INTEGER;
         val[0].u.val = name_cache_hits;
         val[1].type = INTEGER;
         val[1].u.val = name_cache_misses;
+        val[2].type = INTEGER;
+        val[2].u.val = name_cache_negative;
+        if (argc == 2 && INT2)
+            name_cache_hits = name_cache_misses = name_cache_negative = 0;
     } else if (SYM1 == object_cache_id) {
-        THROW((type_id, "Object cache stats not yet supported."));
+        list = cache_stats_info();
+        /* a true second argument resets the counters once read */
+        if (argc == 2 && INT2)
+            cache_stats_reset();
+    } else if (SYM1 == compression_id) {
+        list = simble_compress_info();
+        if (argc == 2 && INT2)
+            simble_compress_reset();
     } else {
         THROW((type_id, "Invalid cache type."));
     }
 
-    pop(1);
+    pop(argc);
+    push_list(list);
+    list_discard(list);
+}
+
+/*
+// -----------------------------------------------------------------
+// Timing of the driver's main loop, see metrics_info().  A true
+// argument resets it once read.
+*/
+COLDC_FUNC(driver_metrics) {
+    cData * args;
+    cList * list;
+    Int     argc;
+
+    if (!func_init_0_or_1(&args, &argc, INTEGER))
+        return;
+
+    list = metrics_info();
+    if (argc && INT1)
+        metrics_reset();
+
+    pop(argc);
     push_list(list);
     list_discard(list);
 }
@@ -5,6 +5,7 @@
 #include "defs.h"
 #include "functions.h"
 #include "execute.h"
+#include "cache.h"
 
 /* ----------------------------------------------------------------- */
 /* cancel a suspended task                                           */
@@ -141,6 +142,127 @@ COLDC_FUNC(tasks) {
     list_discard(list);
 }
 
+/* ----------------------------------------------------------------- */
+/* statistics on the scheduling of preempted tasks                   */
+COLDC_FUNC(task_stats) {
+    cList * list;
+
+    if (!func_init_0())
+        return;
+
+    list = vm_sched_stats();
+
+    push_list(list);
+    list_discard(list);
+}
+
+/* ----------------------------------------------------------------- */
+/* sample the ColdC stack every <interval> ticks, 0 stops sampling    */
+COLDC_FUNC(profile) {
+    cData * args;
+    Int     nargs, samples;
+
+    if (!func_init_0_or_1(&args, &nargs, INTEGER))
+        return;
+
+    if (nargs) {
+        if (INT1 < 0)
+            THROW((range_id, "Profile interval must be zero or greater."));
+        samples = profile_set(INT1);
+    } else {
+        samples = profile_samples();
+    }
+
+    pop(nargs);
+    push_int(samples);
+}
+
+/* ----------------------------------------------------------------- */
+COLDC_FUNC(profile_report) {
+    cData * args;
+    cList * list;
+    Int     nargs;
+    Ident   type = folded_id;
+
+    if (!func_init_0_or_1(&args, &nargs, SYMBOL))
+        return;
+
+    if (nargs) {
+        type = SYM1;
+        if (type != folded_id && type != lines_id && type != methods_id)
+            THROW((type_id, "Unknown profile report type %I.", type));
+    }
+
+    list = profile_report(type);
+
+    pop(nargs);
+    push_list(list);
+    list_discard(list);
+}
+
+/* ----------------------------------------------------------------- */
+/* counters for a method, kept while config('method_stats) is set    */
+COLDC_FUNC(method_stats) {
+    cData  * args;
+    cList  * list;
+    Obj    * obj;
+    Method * method;
+
+    if (!func_init_2(&args, OBJNUM, SYMBOL))
+        return;
+
+    obj = cache_retrieve(OBJNUM1);
+    if (!obj)
+        THROW((objnf_id, "Object #%l does not exist.", OBJNUM1));
+
+    method = object_find_method_local(obj, SYM2, FROB_ANY);
+    if (!method) {
+        cache_discard(obj);
+        THROW((methodnf_id, "Method %O.%I() not found.", OBJNUM1, SYM2));
+    }
+
+    list = method_stats_info(OBJNUM1, SYM2);
+    cache_discard(obj);
+
+    pop(2);
+    push_list(list);
+    list_discard(list);
+}
+
+/* ----------------------------------------------------------------- */
+COLDC_FUNC(method_stats_reset) {
+    if (!func_init_0())
+        return;
+
+    method_stats_reset();
+
+    push_int(1);
+}
+
+/* ----------------------------------------------------------------- */
+COLDC_FUNC(method_stats_top) {
+    cData * args;
+    cList * list;
+    Int     nargs;
+    Ident   key = ticks_id;
+
+    if (!func_init_1_or_2(&args, &nargs, INTEGER, SYMBOL))
+        return;
+
+    if (nargs == 2) {
+        key = SYM2;
+        if (key != calls_id && key != ticks_id &&
+            key != time_id && key != faults_id)
+            THROW((type_id, "Unknown method stats key %I.", key));
+    }
+
+    list = method_stats_top(INT1, key);
+
+    pop(nargs);
+    push_list(list);
+    list_discard(list);
+}
+
 /* ----------------------------------------------------------------- */
 COLDC_FUNC(tick) {
     if (!func_init_0())
@@ -13,6 +13,7 @@
 #include "sig.h"
 
 short caught_fpe;
+volatile sig_atomic_t caught_chld;
 
 void catch_SIGFPE(int sig);
 #ifdef __UNIX__
@@ -39,6 +40,7 @@ static void uninit_sig(void) {
 
 void init_sig(void) {
     caught_fpe = 0;
+    caught_chld = 0;
     signal(SIGFPE,  catch_SIGFPE);
     signal(SIGILL,  catch_signal);
     signal(SIGINT,  catch_signal);
@@ -60,8 +62,10 @@ void catch_SIGPIPE(int sig) {
     signal(SIGPIPE,  catch_SIGPIPE);
 }
 
+/* Children are reaped from the main loop by handle_process_events(), so
+ * spawn() can collect the exit status of the processes it tracks. */
 void catch_SIGCHLD(int sig) {
-    waitpid(-1, NULL, WNOHANG);
+    caught_chld = 1;
     signal(SIGCHLD, catch_SIGCHLD);
 }
 #endif
@@ -13,6 +13,9 @@
 
 #include <string.h>
 #include <ctype.h>
+#ifndef __Win32__
+#include <sys/wait.h>
+#endif
 #include "cdc_db.h"
 #include "cdc_pcode.h"
 #include "coldcc.h"
@@ -21,6 +24,7 @@
 #include "moddef.h"
 #include "quickhash.h"
 #include "cache.h"
+#include "dbpack.h"
 
 /*
 // ------------------------------------------------------------------------
@@ -43,6 +47,8 @@ Long       method_start;
 Obj * cur_obj;
 static Hash * dump_hash;
 extern Bool print_objs;
+extern Int  coldcc_workers;
+extern Bool dump_incremental;
 extern Bool print_invalid;
 extern Bool print_warn;
 
@@ -102,6 +108,7 @@ extern Bool print_warn;
 #define N_NEW 1
 #define N_OLD 0
 #define N_UNDEF -1
+#define N_RESET 2
 
 #define A_NONE       0x0
 #define A_PUBLIC     MS_PUBLIC
@@ -115,9 +122,20 @@ extern Bool print_warn;
 // ------------------------------------------------------------------------
 */
 static Method * get_method(FILE * fp, Obj * obj, char * name);
+static cList * get_method_code(FILE * fp);
+#ifndef ONLY_PARSE_TEXTDB
+static Bool method_pending(cObjnum objnum);
+static void defer_method(FILE * fp, Obj * obj, Ident name,
+                         Int access, Int flags);
+static void compile_pending_methods(void);
+static cStr * format_errstr(char * err, char * name, cObjnum objnum,
+                            Long start);
+#endif
 char * strchop(char * str, Int len);
 static void print_dbref(Obj * obj, cObjnum objnum, FILE * fp, Bool objnames);
 void blank_and_print_obj(char * what, Float percent_done, Obj * obj);
+static void blank_and_print(char * what, Float percent_done,
+                            cObjnum objnum, Ident objname);
 
 typedef struct holder_s holder_t;
 
@@ -160,6 +178,7 @@ static Int add_objname(Ident id, Long objnum, Int skip_lookup) {
         holder_t * holder = (holder_t *) tmalloc(sizeof(holder_t));
 
         lookup_store_name(id, objnum);
+        data_type_handlers_reset();
 
         holder->objnum = objnum;
         holder->str = string_dup(ident_name_str(id));
@@ -225,6 +244,7 @@ static void cleanup_holders(void) {
                         printf("\rWARNING: Object $%s (#%d) was never defined.\n",
                                ident_name(id), (int) objnum);
                     lookup_remove_name(id);
+                    data_type_handlers_reset();
                 }
             }
             ident_discard(id);
@@ -661,6 +681,27 @@ static Obj * handle_objcmd(char * line, char * s, Int new) {
                 return NULL;
             }
         }
+    } else if (new == N_RESET) {
+        /* from an incremental dump: redefine the object in place, keeping
+           its children, or create it if this is its first appearance */
+        if (method_pending(objnum))
+            compile_pending_methods();
+        target = cache_retrieve(objnum);
+        if (target) {
+            if (objnum != ROOT_OBJNUM &&
+                object_change_parents(target, parents) >= 0)
+                WARN(("reset: Unable to set parents for %s.", obj_str));
+            if (objnum != ROOT_OBJNUM && objnum != SYSTEM_OBJNUM &&
+                target->objname != NOT_AN_IDENT)
+                object_del_objname(target);
+            object_reset(target);
+        } else {
+            if (!parents->len && objnum != ROOT_OBJNUM)
+                DIEf("reset: Attempt to define object %s without parents.",
+                     obj_str);
+            target = object_new(objnum, parents);
+            objnum = target->objnum;
+        }
     } else if (new == N_NEW) {
         if (!parents->len && objnum != ROOT_OBJNUM)
             DIEf("new: Attempt to define object %s without parents.", obj_str);
@@ -680,6 +721,9 @@ static Obj * handle_objcmd(char * line, char * s, Int new) {
             //      The code that makes this unsafe isn't checked in, so at the moment its
             //      still safe
             //
+            /* methods still waiting to be compiled belong to the old one */
+            if (method_pending(objnum))
+                compile_pending_methods();
             if ((target = cache_retrieve(objnum))) {
                 WARN(("new: destroying existing object %s.", obj_str));
                 cache_dirty_object(target);
@@ -996,6 +1040,9 @@ static void handle_evalcmd(FILE * fp, char * s, Int new, Int access) {
 #ifndef ONLY_PARSE_TEXTDB
     Long       name;
 
+    /* anything the eval might call has to be compiled first */
+    compile_pending_methods();
+
     /* set the name as 'coldcc_eval */
     name   = ident_get("coldcc_eval");
 
@@ -1175,6 +1222,20 @@ static void handle_methcmd(FILE * fp, char * s, Int new, Int access) {
 
     if (!obj)
         DIE("Abnormal disappearance of object.");
+
+    /* with workers, method bodies are compiled in a second pass */
+    if (coldcc_workers > 1) {
+        if (*p != ';' && !(flags & MF_NATIVE)) {
+            defer_method(fp, obj, name, access, flags);
+            ident_discard(name);
+            cache_discard(obj);
+            return;
+        }
+
+        /* keep this in order with anything still waiting on the object */
+        if (method_pending(definer))
+            compile_pending_methods();
+    }
 #endif
 
     if (*p != ';') {
@@ -1226,9 +1287,10 @@ static void handle_methcmd(FILE * fp, char * s, Int new, Int access) {
 /*
 // ------------------------------------------------------------------------
 */
-static void frob_n_print_errstr(char * err, char * name, cObjnum objnum) {
+static cStr * format_errstr(char * err, char * name, cObjnum objnum,
+                            Long start)
+{
     Int    line = 0;
-    cStr * str;
 
     if (strncmp("Line ", err, 5) == 0) {
         err += 5;
@@ -1237,12 +1299,18 @@ static void frob_n_print_errstr(char * err, char * name, cObjnum objnum) {
         err += 2;
     }
 
-    str = format("\rLine %l: [line %d in %O.%s()]: %s",
-                 method_start + line,
-                 line,
-                 objnum,
-                 name,
-                 err);
+    return format("\rLine %l: [line %d in %O.%s()]: %s",
+                  start + line,
+                  line,
+                  objnum,
+                  name,
+                  err);
+}
+
+static void frob_n_print_errstr(char * err, char * name, cObjnum objnum) {
+    cStr * str;
+
+    str = format_errstr(err, name, objnum, method_start);
 
     write_err("%s", str->s);
 
@@ -1251,13 +1319,36 @@ static void frob_n_print_errstr(char * err, char * name, cObjnum objnum) {
 #endif
 
 static Method * get_method(FILE * fp, Obj * obj, char * name) {
-    Method * method;
-    cStr   * line;
-#ifndef ONLY_PARSE_TEXTDB
+    Method * method = NULL;
     cList  * code;
+#ifndef ONLY_PARSE_TEXTDB
     cList  * errors;
-    cData    d;
     Int      i;
+#endif
+
+    code = get_method_code(fp);
+
+#ifndef ONLY_PARSE_TEXTDB
+    method = compile(obj, code, &errors);
+    list_discard(code);
+
+    /* do warnings and errors, if they exist */
+    for (i = 0; i < errors->len; i++)
+        frob_n_print_errstr(errors->el[i].u.str->s, name, obj->objnum);
+
+    list_discard(errors);
+#endif
+
+    /* return the method, null or not */
+    return method;
+}
+
+/* Read a method body, up to its closing "};" */
+static cList * get_method_code(FILE * fp) {
+    cStr   * line;
+    cList  * code = NULL;
+#ifndef ONLY_PARSE_TEXTDB
+    cData    d;
 
     code = list_new(0);
     d.type = STRING;
@@ -1271,19 +1362,7 @@ static Method * get_method(FILE * fp, Obj * obj, char * name) {
         /* hack for determining the end of a method */
         if (line->len == 2 && line->s[0] == '}' && line->s[1] == ';') {
             string_discard(line);
-#ifndef ONLY_PARSE_TEXTDB
-            method = compile(obj, code, &errors);
-            list_discard(code);
-
-            /* do warnings and errors, if they exist */
-            for (i = 0; i < errors->len; i++)
-                frob_n_print_errstr(errors->el[i].u.str->s, name, obj->objnum);
-
-            list_discard(errors);
-#endif
-
-            /* return the method, null or not */
-            return method;
+            return code;
         }
 #ifndef ONLY_PARSE_TEXTDB
         d.u.str = line;
@@ -1298,6 +1377,431 @@ static Method * get_method(FILE * fp, Obj * obj, char * name) {
     return NULL;
 }
 
+#ifndef __Win32__
+/*
+// Worker processes, for coldcc -j N; see compile_methods_parallel() and
+// text_dump_parallel().  Workers report back to the parent over a pipe.
+*/
+#define DUMP_CHUNK 64
+
+#define DUMP_MSG_OBJECT 0
+#define DUMP_MSG_CHUNK  1
+
+typedef struct dump_msg_s {
+    Long what;          /* DUMP_MSG_OBJECT or DUMP_MSG_CHUNK */
+    Long n;             /* index into the order, or chunk number */
+    Long len;           /* bytes written for a chunk */
+} dump_msg_t;
+
+static void dump_msg(int fd, Long what, Long n, Long len) {
+    dump_msg_t msg;
+
+    msg.what = what;
+    msg.n = n;
+    msg.len = len;
+    while (write(fd, &msg, sizeof(msg)) < 0) {
+        if (errno != EINTR)
+            _exit(1);
+    }
+}
+#endif
+
+#ifndef ONLY_PARSE_TEXTDB
+/*
+// ------------------------------------------------------------------------
+// Two pass compile (coldcc -j N).
+//
+// With workers, method bodies are read but not compiled on the first pass,
+// which creates the objects and sets their parents, names and variables.
+// Compiling is deferred until the end of the file, or until something
+// depends on the methods: an eval, a method defined inline (native or
+// empty) on an object which has methods waiting, a redefinition of such
+// an object, or methods for one object split around those of another.
+//
+// Waiting methods are grouped into runs on the same object.  Runs are
+// cut into chunks of DUMP_CHUNK and chunk N goes to worker N % workers;
+// as with the decompiler, workers are forked processes since the parser
+// and code generator are full of global state.  Each worker compiles its
+// runs into a read-only copy of the db and writes back the errors and
+// resulting method table of each object, and the parent applies them in
+// order once every worker is done, so the db comes out the same as a
+// serial compile would leave it.
+// ------------------------------------------------------------------------
+*/
+typedef struct pending_method_s {
+    cObjnum objnum;
+    Ident   objname;     /* for progress reports */
+    Ident   name;
+    Int     access;
+    Int     flags;
+    cList * code;
+    Long    start;       /* line the body starts on, for errors */
+    Long    end;         /* line it ends on */
+} pending_method_t;
+
+static pending_method_t * pending = NULL;
+static Long               pending_len = 0;
+static Long               pending_size = 0;
+static Hash             * pending_hash = NULL;
+
+static Bool method_pending(cObjnum objnum) {
+    cData d;
+
+    if (!pending_hash)
+        return false;
+    d.type = OBJNUM;
+    d.u.objnum = objnum;
+    return hash_find(pending_hash, &d) != F_FAILURE;
+}
+
+static void defer_method(FILE * fp, Obj * obj, Ident name,
+                         Int access, Int flags)
+{
+    pending_method_t * pm;
+    cData              d;
+
+    /* each object's methods must be one run */
+    if (pending_len && pending[pending_len - 1].objnum != obj->objnum &&
+        method_pending(obj->objnum))
+        compile_pending_methods();
+
+    if (pending_len == pending_size) {
+        pending_size = pending_size * 2 + 64;
+        pending = EREALLOC(pending, pending_method_t, pending_size);
+    }
+
+    pm = &pending[pending_len++];
+    pm->objnum = obj->objnum;
+    pm->objname = (obj->objname == NOT_AN_IDENT)
+                  ? NOT_AN_IDENT
+                  : ident_dup(obj->objname);
+    pm->name = ident_dup(name);
+    pm->access = access;
+    pm->flags = flags;
+    pm->code = get_method_code(fp);
+    pm->start = method_start;
+    pm->end = line_count;
+
+    d.type = OBJNUM;
+    d.u.objnum = obj->objnum;
+    if (!pending_hash)
+        pending_hash = hash_new(0);
+    if (hash_find(pending_hash, &d) == F_FAILURE)
+        pending_hash = hash_add(pending_hash, &d);
+}
+
+/*
+// Compile pending[from..to), all on one object, into obj.  Errors are
+// printed, or collected in errs when compiling in a worker.  Returns the
+// index of a method which failed to compile, or -1.
+*/
+static Long compile_methods(Obj * obj, Long from, Long to, cList ** errs) {
+    pending_method_t * pm;
+    Method           * method;
+    cList            * errors;
+    cData              d;
+    Long               i;
+    Int                j;
+
+    for (i = from; i < to; i++) {
+        pm = &pending[i];
+        method = compile(obj, pm->code, &errors);
+
+        for (j = 0; j < errors->len; j++) {
+            d.type = STRING;
+            d.u.str = format_errstr(errors->el[j].u.str->s,
+                                    ident_name(pm->name),
+                                    pm->objnum, pm->start);
+            if (errs)
+                *errs = list_add(*errs, &d);
+            else
+                write_err("%s", d.u.str->s);
+            string_discard(d.u.str);
+        }
+        list_discard(errors);
+
+        if (!method)
+            return i;
+
+        method->m_access = pm->access;
+        method->m_flags = pm->flags;
+        object_add_method(obj, pm->name, method);
+        method_discard(method);
+    }
+
+    return -1;
+}
+
+#ifndef __Win32__
+static void write_long_to(FILE * fp, Long n) {
+    if (fwrite(&n, sizeof(n), 1, fp) != 1)
+        _exit(1);
+}
+
+static Long read_long_from(FILE * fp) {
+    Long n;
+
+    if (fread(&n, sizeof(n), 1, fp) != 1)
+        DIE("Unable to read compiled methods back from a worker.");
+    return n;
+}
+
+static void method_worker(Long * groups, Long ngroups, Int w,
+                          char * name, int fd)
+{
+    FILE   * fp;
+    Obj    * obj;
+    cList  * errs;
+    cBuf   * buf;
+    cData  * d;
+    Long     c, g, end, failed;
+
+    simble_attach(true);
+
+    fp = fopen(name, "wb");
+    if (!fp) {
+        write_err("Unable to open \"%s\": %s", name, strerror(GETERR()));
+        _exit(1);
+    }
+
+    for (c = w; c * DUMP_CHUNK < ngroups; c += coldcc_workers) {
+        end = (c + 1) * DUMP_CHUNK;
+        if (end > ngroups)
+            end = ngroups;
+        for (g = c * DUMP_CHUNK; g < end; g++) {
+            errs = list_new(0);
+            buf = buffer_new(0);
+            obj = cache_retrieve(pending[groups[g]].objnum);
+            if (obj) {
+                failed = compile_methods(obj, groups[g], groups[g + 1], &errs);
+                buf = pack_methods(buf, obj);
+                cache_discard(obj);
+            } else {
+                failed = groups[g];
+            }
+
+            write_long_to(fp, pending[groups[g]].objnum);
+            write_long_to(fp, errs->len);
+            for (d = list_first(errs); d; d = list_next(errs, d)) {
+                write_long_to(fp, d->u.str->len);
+                if (fwrite(d->u.str->s, 1, d->u.str->len, fp) != d->u.str->len)
+                    _exit(1);
+            }
+            write_long_to(fp, failed);
+            write_long_to(fp, obj ? buf->len : -1);
+            if (obj && fwrite(buf->s, 1, buf->len, fp) != buf->len)
+                _exit(1);
+
+            list_discard(errs);
+            buffer_discard(buf);
+            dump_msg(fd, DUMP_MSG_OBJECT, g, 0);
+        }
+    }
+
+    if (fclose(fp) == EOF)
+        _exit(1);
+
+    /* skip the atexit handlers, the parent owns the db */
+    _exit(0);
+}
+
+/* read back one object's results, returns the failed method or -1 */
+static Long apply_methods(FILE * fp) {
+    Obj    * obj;
+    Obj      tmp;
+    cBuf   * buf;
+    cStr   * str;
+    cObjnum  objnum;
+    Long     n, len, failed, pos = 0;
+
+    objnum = read_long_from(fp);
+    for (n = read_long_from(fp); n > 0; n--) {
+        len = read_long_from(fp);
+        str = string_new(len);
+        if (fread(str->s, 1, len, fp) != (size_t) len)
+            DIE("Unable to read compiled methods back from a worker.");
+        str->s[len] = '\0';
+        str->len = len;
+        write_err("%s", str->s);
+        string_discard(str);
+    }
+
+    failed = read_long_from(fp);
+    len = read_long_from(fp);
+    if (len < 0)
+        return failed;
+
+    buf = buffer_new(len);
+    if (fread(buf->s, 1, len, fp) != (size_t) len)
+        DIE("Unable to read compiled methods back from a worker.");
+    buf->len = len;
+
+    obj = cache_retrieve(objnum);
+    if (!obj)
+        DIE("Abnormal disappearance of object.");
+    tmp.methods = NULL;
+    unpack_methods(buf, &pos, &tmp);
+    object_set_methods(obj, tmp.methods);
+    cache_discard(obj);
+    buffer_discard(buf);
+
+    return failed;
+}
+
+static void compile_methods_parallel(void) {
+    dump_msg_t msg;
+    char    ** names;
+    FILE    ** in;
+    pid_t    * pids;
+    Long     * groups;
+    Long       ngroups = 0, done = 0, g, failed = -1;
+    Int        w, status, ok = 1;
+    int        fds[2];
+    ssize_t    r;
+
+    /* runs of methods on the same object */
+    groups = EMALLOC(Long, pending_len + 1);
+    for (g = 0; g < pending_len; g++) {
+        if (!g || pending[g].objnum != pending[g - 1].objnum)
+            groups[ngroups++] = g;
+    }
+    groups[ngroups] = pending_len;
+
+    names = EMALLOC(char *, coldcc_workers);
+    in = EMALLOC(FILE *, coldcc_workers);
+    pids = EMALLOC(pid_t, coldcc_workers);
+
+    /* workers need a clean, unlocked db to open */
+    cache_sync();
+    simble_detach();
+    fflush(stdout);
+
+    if (pipe(fds) == F_FAILURE) {
+        write_err("Unable to create pipe: %s", strerror(GETERR()));
+        fds[0] = fds[1] = -1;
+        ok = 0;
+    }
+
+    for (w = 0; w < coldcc_workers; w++) {
+        names[w] = EMALLOC(char, strlen(c_dir_binary) + 32);
+        sprintf(names[w], "%s/.compile.%d", c_dir_binary, (int) w);
+        in[w] = NULL;
+        pids[w] = -1;
+        if (!ok)
+            continue;
+        pids[w] = fork();
+        if (pids[w] == 0) {
+            close(fds[0]);
+            method_worker(groups, ngroups, w, names[w], fds[1]);
+        } else if (pids[w] < 0) {
+            write_err("Unable to fork worker: %s", strerror(GETERR()));
+            ok = 0;
+        }
+    }
+    if (fds[1] != -1)
+        close(fds[1]);
+
+    /* progress reports; EOF once every worker has exited */
+    while (ok) {
+        r = read(fds[0], &msg, sizeof(msg));
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r != sizeof(msg))
+            break;
+        if (print_objs)
+            blank_and_print("Compiling methods ", (100.0 * ++done) / ngroups,
+                            pending[groups[msg.n]].objnum,
+                            pending[groups[msg.n]].objname);
+    }
+    if (fds[0] != -1)
+        close(fds[0]);
+
+    for (w = 0; w < coldcc_workers; w++) {
+        if (pids[w] > 0) {
+            if (!ok)
+                kill(pids[w], SIGTERM);
+            while ((r = waitpid(pids[w], &status, 0)) < 0 && errno == EINTR);
+            if (r < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+                ok = 0;
+        }
+    }
+
+    simble_attach(false);
+
+    /* apply the results in order, stopping where a serial compile would */
+    for (g = 0; ok && g < ngroups && failed < 0; g++) {
+        w = (g / DUMP_CHUNK) % coldcc_workers;
+        if (!in[w] && !(in[w] = fopen(names[w], "rb")))
+            ok = 0;
+        else
+            failed = apply_methods(in[w]);
+    }
+
+    for (w = 0; w < coldcc_workers; w++) {
+        if (in[w])
+            fclose(in[w]);
+        unlink(names[w]);
+        efree(names[w]);
+    }
+    efree(names);
+    efree(in);
+    efree(pids);
+    efree(groups);
+
+    if (!ok)
+        DIE("Parallel compile failed.");
+    if (failed >= 0) {
+        line_count = pending[failed].end;
+        DIE("Method definition failed");
+    }
+}
+#endif
+
+static void compile_pending_methods(void) {
+    pending_method_t * pm;
+    Obj              * obj;
+    Long               i, j, failed;
+
+    if (!pending_len)
+        return;
+
+#ifndef __Win32__
+    if (pending_len >= DUMP_CHUNK) {
+        compile_methods_parallel();
+    } else
+#endif
+    {
+        /* not worth forking for */
+        for (i = 0; i < pending_len; i = j) {
+            for (j = i + 1; j < pending_len; j++) {
+                if (pending[j].objnum != pending[i].objnum)
+                    break;
+            }
+            obj = cache_retrieve(pending[i].objnum);
+            if (!obj)
+                DIE("Abnormal disappearance of object.");
+            failed = compile_methods(obj, i, j, NULL);
+            cache_discard(obj);
+            if (failed >= 0) {
+                line_count = pending[failed].end;
+                DIE("Method definition failed");
+            }
+        }
+    }
+
+    for (i = 0; i < pending_len; i++) {
+        pm = &pending[i];
+        if (pm->objname != NOT_AN_IDENT)
+            ident_discard(pm->objname);
+        ident_discard(pm->name);
+        list_discard(pm->code);
+    }
+    pending_len = 0;
+    hash_discard(pending_hash);
+    pending_hash = NULL;
+}
+#endif
+
 /*
 // ------------------------------------------------------------------------
 */
@@ -1389,6 +1893,14 @@ void compile_cdc_file(FILE * fp) {
                     NEXT_WORD(s);
                 }
                 break;
+            case 'r':
+            case 'R':
+                if (MATCH(s, "reset", 5)) {
+                    new = N_RESET;
+                    s += 5;
+                    NEXT_WORD(s);
+                }
+                break;
         }
 
         /* access? */
@@ -1532,6 +2044,12 @@ void compile_cdc_file(FILE * fp) {
     }
 
 #ifndef ONLY_PARSE_TEXTDB
+    compile_pending_methods();
+    if (pending) {
+        efree(pending);
+        pending = NULL;
+        pending_size = 0;
+    }
     cache_discard(cur_obj);
     verify_native_methods();
 #endif
@@ -1552,7 +2070,30 @@ void compile_cdc_file(FILE * fp) {
 // decompile the binary db to a text file
 */
 Int last_length; /* used in doing fancy formatting */
-void dump_object(Long objnum, FILE *fp, Bool objnames);
+
+/* an object in parent-first order, as computed for a parallel dump */
+typedef struct dump_entry_s {
+    cObjnum objnum;
+    Ident   objname;
+} dump_entry_t;
+
+/* dump_object() either writes each object as it is reached, or (when
+   ordering) just records the order objects should be written in */
+typedef struct dump_state_s {
+    FILE         * fp;
+    Bool           objnames;
+    Bool           ordering;
+    dump_entry_t * order;
+    Long           len;
+    Long           size;
+} dump_state_t;
+
+static void dump_object(Long objnum, dump_state_t * st);
+static void dump_object_text(Obj * obj, FILE * fp, Bool objnames, Bool reset);
+static Int text_dump_journal(FILE * fp, Bool objnames);
+#ifndef __Win32__
+static Int text_dump_parallel(FILE * fp, Bool objnames);
+#endif
 static char * method_definition(Method * m);
 
 #define PRINT_OBJNAME(__obj, __fp) { \
@@ -1602,9 +2143,32 @@ Int text_dump(Bool objnames) {
     }
 
     last_length = 0;
-    dump_hash = hash_new(0);
-    dump_object(ROOT_OBJNUM, fp, objnames);
-    hash_discard(dump_hash);
+    if (dump_incremental) {
+        if (!text_dump_journal(fp, objnames)) {
+            close_scratch_file(fp);
+            unlink(buf);
+            return 0;
+        }
+    } else
+#ifndef __Win32__
+    if (coldcc_workers > 1) {
+        if (!text_dump_parallel(fp, objnames)) {
+            close_scratch_file(fp);
+            unlink(buf);
+            return 0;
+        }
+    } else
+#endif
+    {
+        dump_state_t st;
+
+        st.fp = fp;
+        st.objnames = objnames;
+        st.ordering = false;
+        dump_hash = hash_new(0);
+        dump_object(ROOT_OBJNUM, &st);
+        hash_discard(dump_hash);
+    }
 
     close_scratch_file(fp);
 
@@ -1620,6 +2184,10 @@ Int text_dump(Bool objnames) {
         return 0;
     }
 
+    /* a full dump is the base for the next incremental one */
+    if (!dump_incremental)
+        simble_journal_checkpoint();
+
     fputc('\r', stdout);
     fflush(stdout);
     write_err("Done decompiling.");
@@ -1698,12 +2266,11 @@ static inline void dump_object_methods(Obj *obj, FILE *fp) {
 }
 
 #define is_system(__n) (__n == ROOT_OBJNUM || __n == SYSTEM_OBJNUM)
-void dump_object(Long objnum, FILE *fp, Bool objnames) {
+static void dump_object(Long objnum, dump_state_t * st) {
     Obj    * obj;
     cList  * objs;
     cData  * d,
              dobj;
-    Int      first;
     static Long objects_decompiled = 0;
 
     dobj.type = OBJNUM;
@@ -1729,24 +2296,60 @@ void dump_object(Long objnum, FILE *fp, Bool objnames) {
     /* first dump any parents which haven't already been dumped. */
     if (list_length(objs) != 0) {
         for (d = list_first(objs); d; d = list_next(objs, d))
-            dump_object(d->u.objnum, fp, objnames);
+            dump_object(d->u.objnum, st);
     }
+    list_discard(objs);
 
-    if (hash_find(dump_hash, &dobj) != F_FAILURE) {
-        list_discard(objs);
+    if (hash_find(dump_hash, &dobj) != F_FAILURE)
         return;
-    }
     dump_hash = hash_add(dump_hash, &dobj);
 
     /* ok, get this object now */
     obj = cache_retrieve(objnum);
 
-    /* let them know? */
-    if (print_objs)
-        blank_and_print_obj("Decompiling ", (100.0 * ++objects_decompiled) / num_objects, obj);
+    if (st->ordering) {
+        /* ordering pass only, the workers write it out later */
+        if (st->len == st->size) {
+            st->size = st->size * 2 + 64;
+            st->order = EREALLOC(st->order, dump_entry_t, st->size);
+        }
+        st->order[st->len].objnum = obj->objnum;
+        st->order[st->len].objname = (obj->objname == NOT_AN_IDENT)
+                                     ? NOT_AN_IDENT
+                                     : ident_dup(obj->objname);
+        st->len++;
+    } else {
+        /* let them know? */
+        if (print_objs)
+            blank_and_print_obj("Decompiling ", (100.0 * ++objects_decompiled) / num_objects, obj);
+
+        dump_object_text(obj, st->fp, st->objnames, false);
+    }
 
-    /* put 'new' on everything except the system objects */
-    if (!is_system(obj->objnum))
+    /* now dump it's children */
+    if (obj->children) {
+        objs = list_dup(obj->children);
+        cache_discard(obj);
+
+        if (objs->len) {
+            for (d = list_first(objs); d; d = list_next(objs, d))
+                dump_object(d->u.objnum, st);
+        }
+        list_discard(objs);
+    } else {
+        cache_discard(obj);
+    }
+}
+
+static void dump_object_text(Obj * obj, FILE * fp, Bool objnames, Bool reset) {
+    cData  * d;
+    Int      first;
+
+    /* put 'new' on everything except the system objects, an incremental
+       dump resets every object instead */
+    if (reset)
+       fputs("reset ", fp);
+    else if (!is_system(obj->objnum))
        fputs("new ", fp);
 
     /* print the object definition */
@@ -1754,18 +2357,17 @@ void dump_object(Long objnum, FILE *fp, Bool objnames) {
     print_dbref(obj, obj->objnum, fp, objnames);
 
     /* add the parents */
-    if (objs->len != 0) {
+    if (obj->parents->len != 0) {
         fputc(':', fp);
         fputc(' ', fp);
         first = 1;
-        for (d = list_first(objs); d; d = list_next(objs, d)) {
+        for (d = list_first(obj->parents); d; d = list_next(obj->parents, d)) {
             if (!first)
                 fputs(", ", fp);
             first = 0;
             print_dbref(NULL, d->u.objnum, fp, objnames);
         }
     }
-    list_discard(objs);
     fputs(";\n", fp);
 
     /* if we are doing number-only, put a name definition in */
@@ -1779,22 +2381,280 @@ void dump_object(Long objnum, FILE *fp, Bool objnames) {
 
     dump_object_variables(obj, fp, objnames);
     dump_object_methods(obj, fp);
+}
 
-    /* now dump it's children */
-    if (obj->children) {
-        objs = list_dup(obj->children);
-        cache_discard(obj);
+/*
+// ------------------------------------------------------------------------
+// Incremental dump (coldcc -d -i).
+//
+// Writes only the objects in the change journal, as a patch which
+// compile_cdc_file() applies on top of a db compiled from the last full
+// dump: "old object" for each object destroyed since, then each changed
+// or new object, parents first, as "reset object" followed by its full
+// definition.  Changes are cumulative from the last full dump, which is
+// where the journal is checkpointed.
+// ------------------------------------------------------------------------
+*/
+static void journal_dump_object(cObjnum objnum, char * kinds, Long len,
+                                FILE * fp, Bool objnames, Long * done,
+                                Long total)
+{
+    Obj    * obj;
+    cList  * parents;
+    cData  * d,
+             dobj;
 
-        if (objs->len) {
-            for (d = list_first(objs); d; d = list_next(objs, d))
-                dump_object(d->u.objnum, fp, objnames);
+    dobj.type = OBJNUM;
+    dobj.u.objnum = objnum;
+    if (hash_find(dump_hash, &dobj) != F_FAILURE)
+        return;
+    dump_hash = hash_add(dump_hash, &dobj);
+
+    obj = cache_retrieve(objnum);
+    if (!obj)
+        return;
+    parents = list_dup(obj->parents);
+    cache_discard(obj);
+
+    /* changed parents go first, so a new one exists before its children */
+    for (d = list_first(parents); d; d = list_next(parents, d)) {
+        if (d->u.objnum < len && kinds[d->u.objnum] == JOURNAL_CHANGED)
+            journal_dump_object(d->u.objnum, kinds, len, fp, objnames,
+                                done, total);
+    }
+    list_discard(parents);
+
+    obj = cache_retrieve(objnum);
+    if (print_objs)
+        blank_and_print_obj("Decompiling ", (100.0 * ++*done) / total, obj);
+    dump_object_text(obj, fp, objnames, true);
+    cache_discard(obj);
+}
+
+static Int text_dump_journal(FILE * fp, Bool objnames) {
+    char * kinds;
+    Long   len, i, done = 0, total = 0;
+
+    len = simble_journal_read(&kinds);
+
+    fputs("// incremental dump, apply on top of the last full dump\n\n", fp);
+
+    /* objects destroyed since, unless they have been recreated */
+    for (i = 0; i < len; i++) {
+        if (kinds[i] == JOURNAL_DESTROYED && !cache_check(i))
+            fprintf(fp, "old object #%li;\n\n", (long) i);
+        else if (kinds[i] == JOURNAL_CHANGED && cache_check(i))
+            total++;
+    }
+
+    dump_hash = hash_new(0);
+    for (i = 0; i < len; i++) {
+        if (kinds[i] == JOURNAL_CHANGED && cache_check(i))
+            journal_dump_object(i, kinds, len, fp, objnames, &done, total);
+    }
+    hash_discard(dump_hash);
+
+    if (kinds)
+        efree(kinds);
+
+    return !ferror(fp);
+}
+
+#ifndef __Win32__
+/*
+// ------------------------------------------------------------------------
+// Parallel decompile (coldcc -j N).
+//
+// The parent-first order is computed up front.  The order is then cut
+// into chunks of DUMP_CHUNK objects and chunk N goes to worker N % workers.
+// Workers are forked processes rather than threads, since the decompiler,
+// the cache and the ident table all keep global state; each worker opens
+// its own read-only handle on the binary db and writes its chunks, in
+// order, to a private file.  Workers report each object (for progress)
+// and each finished chunk over a pipe, and the parent copies the chunks
+// into the textdump in order as they become available.
+// ------------------------------------------------------------------------
+*/
+static void dump_worker(dump_state_t * st, Int w, char * name, int fd) {
+    FILE * fp;
+    Obj  * obj;
+    Long   c, i, end;
+    off_t  start;
+
+    simble_attach(true);
+
+    fp = fopen(name, "wb");
+    if (!fp) {
+        write_err("Unable to open \"%s\": %s", name, strerror(GETERR()));
+        _exit(1);
+    }
+
+    for (c = w; c * DUMP_CHUNK < st->len; c += coldcc_workers) {
+        start = ftello(fp);
+        end = (c + 1) * DUMP_CHUNK;
+        if (end > st->len)
+            end = st->len;
+        for (i = c * DUMP_CHUNK; i < end; i++) {
+            obj = cache_retrieve(st->order[i].objnum);
+            if (obj) {
+                dump_object_text(obj, fp, st->objnames, false);
+                cache_discard(obj);
+            }
+            dump_msg(fd, DUMP_MSG_OBJECT, i, 0);
         }
-        list_discard(objs);
-    } else {
-        cache_discard(obj);
+        if (fflush(fp) == EOF)
+            _exit(1);
+        dump_msg(fd, DUMP_MSG_CHUNK, c, (Long) (ftello(fp) - start));
+    }
+
+    if (fclose(fp) == EOF)
+        _exit(1);
+
+    /* skip the atexit handlers, the parent owns the db */
+    _exit(0);
+}
+
+static Bool copy_chunk(FILE * from, FILE * to, Long len) {
+    char   buf[BIGBUF * 8];
+    size_t n;
+
+    while (len > 0) {
+        n = fread(buf, 1, (len > (Long) sizeof(buf)) ? sizeof(buf) : len, from);
+        if (!n || fwrite(buf, 1, n, to) != n)
+            return false;
+        len -= n;
     }
+    return true;
 }
 
+static Int text_dump_parallel(FILE * fp, Bool objnames) {
+    dump_state_t st;
+    dump_msg_t   msg;
+    char      ** names;
+    FILE      ** in;
+    pid_t      * pids;
+    Long       * chunks;
+    Long         nchunks, next = 0, done = 0, i;
+    Int          w, status, ok = 1;
+    int          fds[2];
+    ssize_t      r;
+
+    /* compute the parent-first order */
+    st.fp = NULL;
+    st.objnames = objnames;
+    st.ordering = true;
+    st.order = NULL;
+    st.len = st.size = 0;
+    dump_hash = hash_new(0);
+    dump_object(ROOT_OBJNUM, &st);
+    hash_discard(dump_hash);
+
+    nchunks = (st.len + DUMP_CHUNK - 1) / DUMP_CHUNK;
+    chunks = EMALLOC(Long, nchunks + 1);
+    for (i = 0; i < nchunks; i++)
+        chunks[i] = -1;
+    names = EMALLOC(char *, coldcc_workers);
+    in = EMALLOC(FILE *, coldcc_workers);
+    pids = EMALLOC(pid_t, coldcc_workers);
+
+    /* workers need a clean, unlocked db to open */
+    cache_sync();
+    simble_detach();
+    fflush(stdout);
+    fflush(fp);
+
+    if (pipe(fds) == F_FAILURE) {
+        write_err("Unable to create pipe: %s", strerror(GETERR()));
+        fds[0] = fds[1] = -1;
+        ok = 0;
+    }
+
+    for (w = 0; w < coldcc_workers; w++) {
+        names[w] = EMALLOC(char, strlen(c_dir_textdump) + 32);
+        sprintf(names[w], "%s.out.%d", c_dir_textdump, (int) w);
+        in[w] = NULL;
+        pids[w] = -1;
+        if (!ok)
+            continue;
+        pids[w] = fork();
+        if (pids[w] == 0) {
+            close(fds[0]);
+            dump_worker(&st, w, names[w], fds[1]);
+        } else if (pids[w] < 0) {
+            write_err("Unable to fork worker: %s", strerror(GETERR()));
+            ok = 0;
+        }
+    }
+    if (fds[1] != -1)
+        close(fds[1]);
+
+    /* progress and chunk reports; EOF once every worker has exited */
+    while (ok) {
+        r = read(fds[0], &msg, sizeof(msg));
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r != sizeof(msg))
+            break;
+
+        if (msg.what == DUMP_MSG_OBJECT) {
+            if (print_objs)
+                blank_and_print("Decompiling ", (100.0 * ++done) / num_objects,
+                                st.order[msg.n].objnum,
+                                st.order[msg.n].objname);
+            continue;
+        }
+
+        chunks[msg.n] = msg.len;
+        while (ok && next < nchunks && chunks[next] >= 0) {
+            w = next % coldcc_workers;
+            if (!in[w] && !(in[w] = fopen(names[w], "rb")))
+                ok = 0;
+            else if (!copy_chunk(in[w], fp, chunks[next]))
+                ok = 0;
+            next++;
+        }
+        if (!ok)
+            write_err("Unable to copy decompiled chunk: %s",
+                      strerror(GETERR()));
+    }
+    if (fds[0] != -1)
+        close(fds[0]);
+
+    for (w = 0; w < coldcc_workers; w++) {
+        if (pids[w] > 0) {
+            if (!ok)
+                kill(pids[w], SIGTERM);
+            while ((r = waitpid(pids[w], &status, 0)) < 0 && errno == EINTR);
+            if (r < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+                ok = 0;
+        }
+        if (in[w])
+            fclose(in[w]);
+        unlink(names[w]);
+        efree(names[w]);
+    }
+    if (next != nchunks)
+        ok = 0;
+
+    simble_attach(false);
+
+    for (i = 0; i < st.len; i++) {
+        if (st.order[i].objname != NOT_AN_IDENT)
+            ident_discard(st.order[i].objname);
+    }
+    if (st.order)
+        efree(st.order);
+    efree(chunks);
+    efree(names);
+    efree(in);
+    efree(pids);
+
+    if (!ok)
+        write_err("Parallel decompile failed.");
+    return ok;
+}
+#endif
+
 #define ADD_FLAG(__bit, __str1, __str2) { \
         if (m->m_flags & __bit) { \
             if (flag) \
@@ -1852,6 +2712,11 @@ static char * method_definition(Method * m) {
 }
 
 void blank_and_print_obj(char * what, Float percent_done, Obj * obj) {
+    blank_and_print(what, percent_done, obj->objnum, obj->objname);
+}
+
+static void blank_and_print(char * what, Float percent_done,
+                            cObjnum objnum, Ident objname) {
     register int x;
     static Int len = 0;
     Number_buf nbuf;
@@ -1868,11 +2733,11 @@ void blank_and_print_obj(char * what, Float percent_done, Obj * obj) {
 
     /* let them know whats up now */
     len = fprintf(stdout, "%s(%.1f%%) ", what, percent_done);
-    if (obj->objname == NOT_AN_IDENT) {
-        sn = long_to_ascii(obj->objnum, nbuf);
+    if (objname == NOT_AN_IDENT) {
+        sn = long_to_ascii(objnum, nbuf);
         fputc('#', stdout);
     } else {
-        sn = ident_name(obj->objname);
+        sn = ident_name(objname);
         fputc('$', stdout);
     }
     fputs(sn, stdout);
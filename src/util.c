@@ -11,6 +11,9 @@
 #include <time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#ifdef __UNIX__
+#include <sys/time.h>
+#endif
 #include <stdarg.h>
 #include <fcntl.h>
 #include "util.h"
@@ -341,6 +344,21 @@ char * timestamp (char * str) {
     return s;
 }
 
+/*
+// wall-clock time in microseconds, used for the driver's internal
+// timing statistics (not for anything visible as a date)
+*/
+int64_t usec_time(void) {
+#ifdef HAVE_GETTIMEOFDAY
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (int64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+#else
+    return (int64_t) time(NULL) * 1000000;
+#endif
+}
+
 void fformat(FILE *fp, char *fmt, ...) {
     va_list arg;
     cStr *str;